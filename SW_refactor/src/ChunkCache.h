@@ -0,0 +1,350 @@
+// Copyright (C) 2018 Kaan Kara - Systems Group, ETH Zurich
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+//*************************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <algorithm>
+#include <deque>
+#include <unordered_map>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Upper bound on the threads reading through one cache at the same time, used to size the cache
+#define MAX_NUM_CACHE_READERS 16
+#define CHUNK_CACHE_PAGE_SIZE 4096
+
+// Order in which the solvers walk over (feature, chunk) pairs, used for read-ahead. In
+// minibatchMajor all chunks of a minibatch are read for one feature before the next feature.
+enum ChunkOrder {minibatchMajor, featureMajor};
+
+// Bounded LRU cache of column chunks that live in a file. A chunk is chunkSize consecutive
+// samples of one feature. Column j starts at columnsOffset + j*columnStride in the file.
+// Every miss enqueues the next readAheadDepth chunks (in the current ChunkOrder) to a
+// background thread, so that the solvers mostly hit chunks that are already loaded. The
+// solver's minibatches need not be chunks, SetOrder tells the cache their size.
+class ChunkCache {
+public:
+	ChunkCache(
+		int fd,
+		uint64_t columnsOffset,
+		uint64_t columnStride,
+		uint32_t numFeatures,
+		uint32_t numSamples,
+		uint32_t chunkSize,
+		uint32_t numSlots,
+		uint32_t readAheadDepth)
+	{
+		m_fd = fd;
+		m_columnsOffset = columnsOffset;
+		m_columnStride = columnStride;
+		m_numFeatures = numFeatures;
+		m_numSamples = numSamples;
+		m_chunkSize = chunkSize;
+		m_numChunks = numSamples/chunkSize + (numSamples%chunkSize > 0);
+		m_numSlots = numSlots;
+		m_readAheadDepth = readAheadDepth;
+		m_order = minibatchMajor;
+		m_minibatchSize = chunkSize;
+
+		m_hits = 0;
+		m_misses = 0;
+		m_readAheads = 0;
+
+		m_buffer = (float*)aligned_alloc(64, (size_t)m_numSlots*m_chunkSize*sizeof(float));
+		m_slots = (cache_slot*)malloc(m_numSlots*sizeof(cache_slot));
+		for (uint32_t s = 0; s < m_numSlots; s++) {
+			m_slots[s].m_key = 0;
+			m_slots[s].m_valid = false;
+			m_slots[s].m_ready = false;
+			m_slots[s].m_pinned = 0;
+			m_slots[s].m_lastUse = 0;
+		}
+		m_clock = 0;
+
+		pthread_mutex_init(&m_mutex, NULL);
+		pthread_cond_init(&m_readyCond, NULL);
+		pthread_cond_init(&m_queueCond, NULL);
+		m_stop = false;
+		pthread_create(&m_readAheadThread, NULL, readAheadThread, (void*)this);
+	}
+
+	~ChunkCache() {
+		pthread_mutex_lock(&m_mutex);
+		m_stop = true;
+		pthread_cond_signal(&m_queueCond);
+		pthread_mutex_unlock(&m_mutex);
+		pthread_join(m_readAheadThread, NULL);
+
+		cout << "ChunkCache hits: " << m_hits << ", misses: " << m_misses << ", read-aheads: " << m_readAheads << endl;
+
+		pthread_mutex_destroy(&m_mutex);
+		pthread_cond_destroy(&m_readyCond);
+		pthread_cond_destroy(&m_queueCond);
+		free(m_buffer);
+		free(m_slots);
+		close(m_fd);
+	}
+
+	// minibatchSize 0 keeps the current one
+	void SetOrder(ChunkOrder order, uint32_t minibatchSize) {
+		pthread_mutex_lock(&m_mutex);
+		m_order = order;
+		if (minibatchSize > 0) {
+			m_minibatchSize = minibatchSize;
+		}
+		m_queue.clear();
+		pthread_mutex_unlock(&m_mutex);
+	}
+
+	ChunkOrder GetOrder() {
+		pthread_mutex_lock(&m_mutex);
+		ChunkOrder order = m_order;
+		pthread_mutex_unlock(&m_mutex);
+		return order;
+	}
+
+	uint32_t GetChunkSize() {
+		return m_chunkSize;
+	}
+
+	// Copies count samples of feature, starting at sample firstSample, into out. The range must
+	// cross neither a chunk nor a minibatch.
+	void Read(uint32_t feature, uint32_t firstSample, uint32_t count, float* out) {
+		uint32_t chunk = firstSample/m_chunkSize;
+		uint32_t offset = firstSample%m_chunkSize;
+
+		pthread_mutex_lock(&m_mutex);
+		uint32_t slot = acquireSlot(feature, chunk, true);
+		while (!m_slots[slot].m_ready) {
+			pthread_cond_wait(&m_readyCond, &m_mutex);
+		}
+		enqueueReadAhead(feature, chunk, firstSample/m_minibatchSize);
+		pthread_mutex_unlock(&m_mutex);
+
+		memcpy(out, m_buffer + (size_t)slot*m_chunkSize + offset, count*sizeof(float));
+
+		pthread_mutex_lock(&m_mutex);
+		m_slots[slot].m_pinned--;
+		pthread_cond_broadcast(&m_readyCond);
+		pthread_mutex_unlock(&m_mutex);
+	}
+
+private:
+	typedef struct {
+		uint64_t m_key;
+		bool m_valid;
+		bool m_ready;
+		uint32_t m_pinned;
+		uint64_t m_lastUse;
+	} cache_slot;
+
+	int m_fd;
+	uint64_t m_columnsOffset;
+	uint64_t m_columnStride;
+	uint32_t m_numFeatures;
+	uint32_t m_numSamples;
+	uint32_t m_chunkSize;
+	uint32_t m_numChunks;
+	uint32_t m_numSlots;
+	uint32_t m_readAheadDepth;
+	ChunkOrder m_order;
+	uint32_t m_minibatchSize;
+
+	float* m_buffer;
+	cache_slot* m_slots;
+	uint64_t m_clock;
+	unordered_map<uint64_t, uint32_t> m_index;
+	deque<uint64_t> m_queue;
+
+	pthread_mutex_t m_mutex;
+	pthread_cond_t m_readyCond;
+	pthread_cond_t m_queueCond;
+	pthread_t m_readAheadThread;
+	bool m_stop;
+
+	uint64_t m_hits;
+	uint64_t m_misses;
+	uint64_t m_readAheads;
+
+	static inline uint64_t makeKey(uint32_t feature, uint32_t chunk) {
+		return ((uint64_t)feature << 32) | chunk;
+	}
+
+	// Called with m_mutex held. Returns a pinned slot for the chunk, loading it on a miss.
+	uint32_t acquireSlot(uint32_t feature, uint32_t chunk, bool countAccess) {
+		uint64_t key = makeKey(feature, chunk);
+		unordered_map<uint64_t, uint32_t>::iterator it = m_index.find(key);
+		if (it != m_index.end()) {
+			uint32_t slot = it->second;
+			m_slots[slot].m_pinned++;
+			m_slots[slot].m_lastUse = ++m_clock;
+			if (countAccess) {
+				m_hits++;
+			}
+			return slot;
+		}
+		if (countAccess) {
+			m_misses++;
+		}
+
+		uint32_t slot = evictSlot();
+		m_slots[slot].m_key = key;
+		m_slots[slot].m_valid = true;
+		m_slots[slot].m_ready = false;
+		m_slots[slot].m_pinned = 1;
+		m_slots[slot].m_lastUse = ++m_clock;
+		m_index[key] = slot;
+
+		pthread_mutex_unlock(&m_mutex);
+		loadChunk(feature, chunk, m_buffer + (size_t)slot*m_chunkSize);
+		pthread_mutex_lock(&m_mutex);
+
+		m_slots[slot].m_ready = true;
+		pthread_cond_broadcast(&m_readyCond);
+		return slot;
+	}
+
+	// Called with m_mutex held. Waits until some slot is neither pinned nor being loaded.
+	uint32_t evictSlot() {
+		while (true) {
+			uint32_t victim = m_numSlots;
+			for (uint32_t s = 0; s < m_numSlots; s++) {
+				if (!m_slots[s].m_valid) {
+					return s;
+				}
+				if (m_slots[s].m_pinned == 0 && m_slots[s].m_ready) {
+					if (victim == m_numSlots || m_slots[s].m_lastUse < m_slots[victim].m_lastUse) {
+						victim = s;
+					}
+				}
+			}
+			if (victim < m_numSlots) {
+				m_index.erase(m_slots[victim].m_key);
+				m_slots[victim].m_valid = false;
+				return victim;
+			}
+			pthread_cond_wait(&m_readyCond, &m_mutex);
+		}
+	}
+
+	void loadChunk(uint32_t feature, uint32_t chunk, float* destination) {
+		uint32_t count = m_chunkSize;
+		if ((chunk+1)*m_chunkSize > m_numSamples) {
+			count = m_numSamples - chunk*m_chunkSize;
+			memset(destination + count, 0, (m_chunkSize - count)*sizeof(float));
+		}
+		uint64_t offset = m_columnsOffset + feature*m_columnStride + (uint64_t)chunk*m_chunkSize*sizeof(float);
+		size_t bytesRead = 0;
+		while (bytesRead < count*sizeof(float)) {
+			ssize_t r = pread(m_fd, (char*)destination + bytesRead, count*sizeof(float) - bytesRead, offset + bytesRead);
+			if (r <= 0) {
+				cout << "ChunkCache: reading feature " << feature << ", chunk " << chunk << " failed" << endl;
+				exit(1);
+			}
+			bytesRead += r;
+		}
+		// The cache holds the chunk now, no need to keep it in the page cache as well. Pages shared
+		// with the neighbouring chunks stay, they are about to be read.
+		uint64_t dropBegin = (offset + CHUNK_CACHE_PAGE_SIZE-1)/CHUNK_CACHE_PAGE_SIZE*CHUNK_CACHE_PAGE_SIZE;
+		uint64_t dropEnd = (offset + count*sizeof(float))/CHUNK_CACHE_PAGE_SIZE*CHUNK_CACHE_PAGE_SIZE;
+		if (dropEnd > dropBegin) {
+			posix_fadvise(m_fd, dropBegin, dropEnd - dropBegin, POSIX_FADV_DONTNEED);
+		}
+	}
+
+	// Called with m_mutex held. The chunks a minibatch covers, the last may be partial.
+	uint32_t firstChunk(uint32_t minibatch) {
+		return ((uint64_t)minibatch*m_minibatchSize)/m_chunkSize;
+	}
+	uint32_t lastChunk(uint32_t minibatch) {
+		uint64_t lastSample = min((uint64_t)(minibatch+1)*m_minibatchSize, (uint64_t)m_numSamples) - 1;
+		return lastSample/m_chunkSize;
+	}
+
+	// Called with m_mutex held. chunk of feature was just read for minibatch.
+	void enqueueReadAhead(uint32_t feature, uint32_t chunk, uint32_t minibatch) {
+		uint32_t numMinibatches = m_numSamples/m_minibatchSize + (m_numSamples%m_minibatchSize > 0);
+		uint32_t f = feature;
+		uint32_t c = chunk;
+		uint32_t m = minibatch;
+		for (uint32_t k = 0; k < m_readAheadDepth; k++) {
+			if (m_order == minibatchMajor) {
+				if (c < lastChunk(m)) {
+					c++;
+				}
+				else {
+					if (++f == m_numFeatures) {
+						f = 0;
+						if (++m == numMinibatches) {
+							m = 0;
+						}
+					}
+					c = firstChunk(m);
+				}
+			}
+			else {
+				if (++c == m_numChunks) {
+					c = 0;
+					if (++f == m_numFeatures) {
+						f = 0;
+					}
+				}
+			}
+			uint64_t key = makeKey(f, c);
+			if (m_index.find(key) == m_index.end()) {
+				m_queue.push_back(key);
+			}
+		}
+		// Only the most recent requests are worth reading ahead
+		while (m_queue.size() > 2*m_readAheadDepth) {
+			m_queue.pop_front();
+		}
+		pthread_cond_signal(&m_queueCond);
+	}
+
+	static void* readAheadThread(void* args) {
+		ChunkCache* cache = (ChunkCache*)args;
+
+		pthread_mutex_lock(&cache->m_mutex);
+		while (true) {
+			while (cache->m_queue.empty() && !cache->m_stop) {
+				pthread_cond_wait(&cache->m_queueCond, &cache->m_mutex);
+			}
+			if (cache->m_stop) {
+				break;
+			}
+			uint64_t key = cache->m_queue.front();
+			cache->m_queue.pop_front();
+			if (cache->m_index.find(key) != cache->m_index.end()) {
+				continue;
+			}
+			uint32_t slot = cache->acquireSlot((uint32_t)(key >> 32), (uint32_t)key, false);
+			cache->m_slots[slot].m_pinned--;
+			cache->m_readAheads++;
+			pthread_cond_broadcast(&cache->m_readyCond);
+		}
+		pthread_mutex_unlock(&cache->m_mutex);
+
+		return nullptr;
+	}
+};
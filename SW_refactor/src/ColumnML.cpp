@@ -18,30 +18,115 @@
 
 using namespace std;
 
-void ColumnML::WriteLogregPredictions(char* fileName, float* x) {
+void ColumnML::WriteLogregPredictions(char* fileName, float* x, ColumnNormalization* normalization) {
 	ofstream ofs (fileName, ofstream::out);
+	float offset = 0;
+	float* rawX = x;
+	if (normalization != nullptr) {
+		rawX = (float*)aligned_alloc(64, m_cstore->m_numFeatures*sizeof(float));
+		offset = normalization->FoldIntoModel(x, rawX);
+	}
 	for(uint32_t i = 0; i < m_cstore->m_numSamples; i++) {
 		float dot = 0.0;
-		for (uint32_t j = 0; j < m_cstore->m_numFeatures; j++) {
-			if (m_cstore->m_samplesRange[j] > 0) {
-				dot += x[j]*((m_cstore->m_samples[j][i] - m_cstore->m_samplesMin[j])/m_cstore->m_samplesRange[j]);
-			}
-			else {
-				dot += x[j]*m_cstore->m_samples[j][i];
+		if (normalization != nullptr) {
+			dot = getDot(rawX, i) + offset;
+		}
+		else {
+			for (uint32_t j = 0; j < m_cstore->m_numFeatures; j++) {
+				if (m_cstore->m_samplesRange[j] > 0) {
+					dot += x[j]*((m_cstore->m_samples[j][i] - m_cstore->m_samplesMin[j])/m_cstore->m_samplesRange[j]);
+				}
+				else {
+					dot += x[j]*m_cstore->m_samples[j][i];
+				}
 			}
 		}
 		float prediction = 1/(1+exp(-dot));
 		ofs << prediction << endl;
 	}
+	if (rawX != x) {
+		free(rawX);
+	}
 	ofs.close();
 }
 
+float* ColumnML::getColumnwiseDots(float* x, AdditionalArguments* args) {
+	uint32_t numSamples = GetNumSamples(args);
+	if (m_cstore->IsSparse()) {
+		float* dots = (float*)aligned_alloc(64, numSamples*sizeof(float));
+		if (args->m_view != nullptr) {
+			// Accumulate the dots of all samples, then pick those of the view
+			float* storeDots = (float*)aligned_alloc(64, m_cstore->m_numSamples*sizeof(float));
+			memset(storeDots, 0, m_cstore->m_numSamples*sizeof(float));
+			for (uint32_t j = 0; j < m_cstore->m_numFeatures; j++) {
+				for (uint32_t k = 0; k < m_cstore->m_sparseNnz[j]; k++) {
+					storeDots[m_cstore->m_sparseRows[j][k]] += x[j]*m_cstore->m_sparseValues[j][k];
+				}
+			}
+			for (uint32_t i = 0; i < numSamples; i++) {
+				dots[i] = storeDots[args->m_view->GetSample(i)];
+			}
+			free(storeDots);
+			return dots;
+		}
+		memset(dots, 0, numSamples*sizeof(float));
+		for (uint32_t j = 0; j < m_cstore->m_numFeatures; j++) {
+			uint32_t* rows = m_cstore->m_sparseRows[j];
+			float* values = m_cstore->m_sparseValues[j];
+			for (uint32_t k = 0; k < m_cstore->m_sparseNnz[j]; k++) {
+				if (rows[k] >= args->m_firstSample && rows[k] < args->m_firstSample + args->m_numSamples) {
+					dots[rows[k] - args->m_firstSample] += x[j]*values[k];
+				}
+			}
+		}
+		return dots;
+	}
+	if (m_cstore->m_halfSamples != nullptr || m_cstore->m_quantizedSamples != nullptr || m_cstore->m_dictionaryCodes != nullptr || m_cstore->m_paxSamples != nullptr) {
+		float* dots = (float*)aligned_alloc(64, numSamples*sizeof(float));
+		memset(dots, 0, numSamples*sizeof(float));
+		for (uint32_t j = 0; j < m_cstore->m_numFeatures; j++) {
+			for (uint32_t i = 0; i < numSamples; i++) {
+				dots[i] += x[j]*m_cstore->GetSample(j, GetSampleIndex(args, i));
+			}
+		}
+		return dots;
+	}
+	if (!m_cstore->IsOutOfCore()) {
+		return nullptr;
+	}
+	// Column-wise, so that each chunk is read from the cache once. Consecutive samples of
+	// args are read in one go, a range is a single run.
+	float* dots = (float*)aligned_alloc(64, numSamples*sizeof(float));
+	float* column = (float*)aligned_alloc(64, numSamples*sizeof(float));
+	memset(dots, 0, numSamples*sizeof(float));
+	ChunkOrder solverOrder = m_cstore->GetReadAheadOrder();
+	m_cstore->SetReadAheadOrder(featureMajor);
+	for (uint32_t j = 0; j < m_cstore->m_numFeatures; j++) {
+		uint32_t i = 0;
+		while (i < numSamples) {
+			uint32_t runStart = i;
+			uint32_t firstSample = GetSampleIndex(args, runStart);
+			i++;
+			while (i < numSamples && GetSampleIndex(args, i) == firstSample + (i - runStart)) {
+				i++;
+			}
+			m_cstore->ReadColumn(j, firstSample, i - runStart, column + runStart);
+		}
+		for (uint32_t i = 0; i < numSamples; i++) {
+			dots[i] += x[j]*column[i];
+		}
+	}
+	m_cstore->SetReadAheadOrder(solverOrder);
+	free(column);
+	return dots;
+}
+
 float ColumnML::L2regularization(float* x, float lambda, AdditionalArguments* args) {
 	float regularizer = 0;
 	for (uint32_t j = 0; j < m_cstore->m_numFeatures; j++) {
 		regularizer += x[j]*x[j];
 	}
-	regularizer *= (lambda*0.5)/args->m_numSamples;
+	regularizer *= (lambda*0.5)/GetNumSamples(args);
 
 	return regularizer;
 }
@@ -58,8 +143,12 @@ float ColumnML::L1regularization(float* x, float lambda) {
 
 float ColumnML::L2svmLoss(float* x, float lambda, AdditionalArguments* args) {
 	float loss = 0;
-	for(uint32_t i = args->m_firstSample; i < args->m_firstSample + args->m_numSamples; i++) {
-		float dot = getDot(x, i);
+	float offset;
+	float* rawX = getRawModel(x, args, offset);
+	float* dots = getColumnwiseDots(rawX, args);
+	for(uint32_t k = 0; k < GetNumSamples(args); k++) {
+		uint32_t i = GetSampleIndex(args, k);
+		float dot = ((dots != nullptr) ? dots[k] : getDot(rawX, i)) + offset;
 		float temp = 1 - m_cstore->m_labels[i]*dot;
 		if (temp > 0) {
 			if (m_cstore->m_labels[i] > 0) {
@@ -70,16 +159,22 @@ float ColumnML::L2svmLoss(float* x, float lambda, AdditionalArguments* args) {
 			}
 		}
 	}
-	loss /= (float)(2*args->m_numSamples);
+	loss /= (float)(2*GetNumSamples(args));
 	loss += L1regularization(x, lambda);
 
+	free(dots);
+	freeRawModel(rawX, x);
 	return loss;
 }
 
 float ColumnML::LogregLoss(float* x, float lambda, AdditionalArguments* args) {
 	float loss = 0;
-	for(uint32_t i = args->m_firstSample; i < args->m_firstSample + args->m_numSamples; i++) {
-		float dot = getDot(x, i);
+	float offset;
+	float* rawX = getRawModel(x, args, offset);
+	float* dots = getColumnwiseDots(rawX, args);
+	for(uint32_t k = 0; k < GetNumSamples(args); k++) {
+		uint32_t i = GetSampleIndex(args, k);
+		float dot = ((dots != nullptr) ? dots[k] : getDot(rawX, i)) + offset;
 		float prediction = 1.0/(1.0+exp(-dot));
 
 		float positiveLoss = log(prediction);
@@ -105,53 +200,75 @@ float ColumnML::LogregLoss(float* x, float lambda, AdditionalArguments* args) {
 			cout << "label: " << m_cstore->m_labels[i] << endl;
 			cout << "log(prediction): " << log(prediction) << endl;
 			cout << "log(1 - prediction): " << log(1 - prediction) << endl;
+			free(dots);
+			freeRawModel(rawX, x);
 			return 0;
 		}
 	}
 
-	loss /= (float)args->m_numSamples;
+	loss /= (float)GetNumSamples(args);
 	loss = -loss;
 
 	// cout << "LogregLoss without L1 penalty: " << loss << endl;
 
 	loss += L1regularization(x, lambda);
 
+	free(dots);
+	freeRawModel(rawX, x);
 	return loss;
 }
 
 float ColumnML::LinregLoss(float* x, float lambda, AdditionalArguments* args) {
 	float loss = 0;
-	for(uint32_t i = args->m_firstSample; i < args->m_firstSample + args->m_numSamples; i++) {
-		float dot = getDot(x, i);
+	float offset;
+	float* rawX = getRawModel(x, args, offset);
+	float* dots = getColumnwiseDots(rawX, args);
+	for(uint32_t k = 0; k < GetNumSamples(args); k++) {
+		uint32_t i = GetSampleIndex(args, k);
+		float dot = ((dots != nullptr) ? dots[k] : getDot(rawX, i)) + offset;
 		loss += (dot - m_cstore->m_labels[i])*(dot - m_cstore->m_labels[i]);
 	}
-	loss /= (float)(2*args->m_numSamples);
+	loss /= (float)(2*GetNumSamples(args));
 	loss += L1regularization(x, lambda);
 
+	free(dots);
+	freeRawModel(rawX, x);
 	return loss;
 }
 
 uint32_t ColumnML::LogregAccuracy(float* x, AdditionalArguments* args) {
 	uint32_t corrects = 0;
-	for(uint32_t i = args->m_firstSample; i < args->m_firstSample + args->m_numSamples; i++) {
-		float dot = getDot(x, i);
+	float offset;
+	float* rawX = getRawModel(x, args, offset);
+	float* dots = getColumnwiseDots(rawX, args);
+	for(uint32_t k = 0; k < GetNumSamples(args); k++) {
+		uint32_t i = GetSampleIndex(args, k);
+		float dot = ((dots != nullptr) ? dots[k] : getDot(rawX, i)) + offset;
 		float prediction = 1/(1+exp(-dot));
 		if ( (prediction > 0.5 && m_cstore->m_labels[i] == 1.0) || (prediction < 0.5 && m_cstore->m_labels[i] == 0) ) {
 			corrects++;
 		}
 	}
 
+	free(dots);
+	freeRawModel(rawX, x);
 	return corrects;
 }
 
 uint32_t ColumnML::LinregAccuracy(float* x, AdditionalArguments* args) {
 	uint32_t corrects = 0;
-	for(uint32_t i = args->m_firstSample; i < args->m_firstSample + args->m_numSamples; i++) {
-		float dot = getDot(x, i);
+	float offset;
+	float* rawX = getRawModel(x, args, offset);
+	float* dots = getColumnwiseDots(rawX, args);
+	for(uint32_t k = 0; k < GetNumSamples(args); k++) {
+		uint32_t i = GetSampleIndex(args, k);
+		float dot = ((dots != nullptr) ? dots[k] : getDot(rawX, i)) + offset;
 		if ( (dot > args->m_decisionBoundary && m_cstore->m_labels[i] == args->m_trueLabel) || (dot < args->m_decisionBoundary && m_cstore->m_labels[i] == args->m_falseLabel) ) {
 			corrects++;
 		}
 	}
+	free(dots);
+	freeRawModel(rawX, x);
 	return corrects;
 }
 
@@ -164,22 +281,27 @@ void ColumnML::SGD(
 	float lambda, 
 	AdditionalArguments* args) 
 {
+	if (m_cstore->m_samples == nullptr) {
+		cout << "SGD needs the dense samples in memory!" << endl;
+		exit(1);
+	}
+	CheckNoNormalization(args, "SGD");
 	float* x = (float*)aligned_alloc(64, m_cstore->m_numFeatures*sizeof(float));
 	memset(x, 0, m_cstore->m_numFeatures*sizeof(float));
 	float* gradient = (float*)aligned_alloc(64, m_cstore->m_numFeatures*sizeof(float));
 	memset(gradient, 0, m_cstore->m_numFeatures*sizeof(float));
 
 	cout << "SGD ---------------------------------------" << endl;
-	uint32_t numMinibatches = args->m_numSamples/minibatchSize;
+	uint32_t numMinibatches = GetNumSamples(args)/minibatchSize;
 	cout << "numMinibatches: " << numMinibatches << endl;
-	uint32_t rest = args->m_numSamples - numMinibatches*minibatchSize;
+	uint32_t rest = GetNumSamples(args) - numMinibatches*minibatchSize;
 	cout << "rest: " << rest << endl;
 
 #ifdef PRINT_LOSS
 	cout << "Initial loss: " << Loss(type, x, lambda, args) << endl;
 #endif
 #ifdef PRINT_ACCURACY
-	cout << "Initial accuracy: " << Accuracy(type, x, args) << " corrects out of " << args->m_numSamples << endl;
+	cout << "Initial accuracy: " << Accuracy(type, x, args) << " corrects out of " << GetNumSamples(args) << endl;
 #endif
 
 	float scaledStepSize = stepSize/minibatchSize;
@@ -197,7 +319,7 @@ void ColumnML::SGD(
 			uint32_t m = k;
 #endif
 			for (uint32_t i = 0; i < minibatchSize; i++) {
-				updateGradient(type, gradient, x, m*minibatchSize + i, args);
+				updateGradient(type, gradient, x, GetSampleIndex(args, m*minibatchSize + i), args);
 			}
 			for (uint32_t j = 0; j < m_cstore->m_numFeatures; j++) {
 				float regularizer = (x[j] < 0) ? -scaledLambda : scaledLambda;
@@ -227,7 +349,7 @@ void ColumnML::SGD(
 			cout << Loss(type, x, lambda, args) << endl;
 #endif
 #ifdef PRINT_ACCURACY
-			cout << Accuracy(type, x, args) << " corrects out of " << args->m_numSamples << endl;
+			cout << Accuracy(type, x, args) << " corrects out of " << GetNumSamples(args) << endl;
 #endif
 		}
 	}
@@ -236,65 +358,47 @@ void ColumnML::SGD(
 	free(gradient);
 }
 
-static inline void CopySample(float* toSamples, float* fromSamples, uint32_t toIndex, uint32_t fromIndex, uint32_t numFeatures) {
+static inline void CopySample(float* toSamples, float** fromColumns, uint32_t toIndex, uint32_t fromIndex, uint32_t numFeatures) {
 	for (uint32_t j = 0; j < numFeatures; j++) {
-		toSamples[toIndex*numFeatures + j] = fromSamples[fromIndex*numFeatures + j];
+		toSamples[toIndex*numFeatures + j] = fromColumns[j][fromIndex];
 	}
 }
 
-static void SortByBinaryLabel(float*& samples, float*& labels, uint32_t numSamples, uint32_t numFeatures) {
-
+// Stable, samples labeled 0 first
+static void SortByBinaryLabel(uint32_t* sampleIndexes, uint32_t numSamples, float* labels) {
+	uint32_t* tempIndexes = (uint32_t*)malloc(numSamples*sizeof(uint32_t));
 	uint32_t zeroCount = 0;
 	for (uint32_t i = 0; i < numSamples; i++) {
-		zeroCount += (labels[i] == 0.0) ? 1 : 0;
+		zeroCount += (labels[sampleIndexes[i]] == 0.0) ? 1 : 0;
 	}
 
-	float* tempSamples = (float*)aligned_alloc(64, numSamples*numFeatures*sizeof(float));
-	float* tempLabels = (float*)aligned_alloc(64, numSamples*sizeof(float));
-
 	uint32_t zeroIndex = 0;
 	uint32_t oneIndex = zeroCount;
 	for (uint32_t i = 0; i < numSamples; i++) {
-		if (labels[i] == 0.0) {
-			CopySample(tempSamples, samples, zeroIndex, i, numFeatures);
-			tempLabels[zeroIndex] = labels[i];
-			zeroIndex++;
+		if (labels[sampleIndexes[i]] == 0.0) {
+			tempIndexes[zeroIndex++] = sampleIndexes[i];
 		}
 		else {
-			CopySample(tempSamples, samples, oneIndex, i, numFeatures);
-			tempLabels[oneIndex] = labels[i];
-			oneIndex++;
+			tempIndexes[oneIndex++] = sampleIndexes[i];
 		}
 	}
-
-	free(samples);
-	free(labels);
-
-	samples = tempSamples;
-	labels = tempLabels;
+	memcpy(sampleIndexes, tempIndexes, numSamples*sizeof(uint32_t));
+	free(tempIndexes);
 }
 
-static void SortByFeature(float*& samples, float*& labels, uint32_t numSamples, uint32_t numFeatures, uint32_t whichFeature) {
+static void SortByFeature(uint32_t* sampleIndexes, uint32_t numSamples, float* feature) {
 	tuple_t* tuples = (tuple_t*)aligned_alloc(64, numSamples*sizeof(tuple_t));
 	for (uint32_t i = 0; i < numSamples; i++) {
-		tuples[i].index = i;
-		tuples[i].feature = samples[i*numFeatures + whichFeature];
+		tuples[i].index = sampleIndexes[i];
+		tuples[i].feature = feature[sampleIndexes[i]];
 	}
 
 	quicksort(tuples, 0, numSamples-1);
 
-	float* tempSamples = (float*)aligned_alloc(64, numSamples*numFeatures*sizeof(float));
-	float* tempLabels = (float*)aligned_alloc(64, numSamples*sizeof(float));
 	for (uint32_t i = 0; i < numSamples; i++) {
-		CopySample(tempSamples, samples, tuples[i].index, i, numFeatures);
-		tempLabels[tuples[i].index] = labels[i];
+		sampleIndexes[i] = tuples[i].index;
 	}
-
-	free(samples);
-	free(labels);
-
-	samples = tempSamples;
-	labels = tempLabels;
+	free(tuples);
 }
 
 static void ShuffleRange(uint32_t* base, uint32_t count, bool shuffle) {
@@ -327,42 +431,50 @@ void ColumnML::blockwise_SGD(
 	bool shuffle,
 	AdditionalArguments* args)
 {
+	if (m_cstore->m_samples == nullptr) {
+		cout << "blockwise_SGD needs the dense samples in memory!" << endl;
+		exit(1);
+	}
+	CheckNoNormalization(args, "blockwise_SGD");
 	srand(3);
 
-	uint32_t totalNumSamples = args->m_numSamples;
+	uint32_t totalNumSamples = GetNumSamples(args);
 	uint32_t trainNumSamples = 0.7*totalNumSamples;
 	uint32_t testNumSamples = 0.3*totalNumSamples;
 
 	cout << "trainNumSamples: " << trainNumSamples << endl;
 	cout << "testNumSamples: " << testNumSamples << endl;
 
-	args->m_numSamples = trainNumSamples;
+	// The first 70% of the samples in args train, the next 30% test
+	uint32_t* sampleOrder = (uint32_t*)malloc((totalNumSamples > 0 ? totalNumSamples : 1)*sizeof(uint32_t));
+	for (uint32_t i = 0; i < totalNumSamples; i++) {
+		sampleOrder[i] = GetSampleIndex(args, i);
+	}
+	DatasetView* trainView = DatasetView::CreateIndexList(sampleOrder, trainNumSamples);
+	DatasetView* testView = DatasetView::CreateIndexList(sampleOrder + trainNumSamples, testNumSamples);
+	AdditionalArguments trainArgs = *args;
+	trainArgs.m_view = trainView;
+	AdditionalArguments testArgs = *args;
+	testArgs.m_view = testView;
 
 	float* x = (float*)aligned_alloc(64, m_cstore->m_numFeatures*sizeof(float));
 	memset(x, 0, m_cstore->m_numFeatures*sizeof(float));
 	float* gradient = (float*)aligned_alloc(64, m_cstore->m_numFeatures*sizeof(float));
 	memset(gradient, 0, m_cstore->m_numFeatures*sizeof(float));
 
-	float* samples = (float*)aligned_alloc(64, args->m_numSamples*m_cstore->m_numFeatures*sizeof(float));
-	float* labels = (float*)aligned_alloc(64, args->m_numSamples*sizeof(float));
-	for (uint32_t i = 0; i < args->m_numSamples; i++) {
-		for (uint32_t j = 0; j < m_cstore->m_numFeatures; j++) {
-			samples[i*m_cstore->m_numFeatures + j] = m_cstore->m_samples[j][i];
-		}
-		labels[i] = m_cstore->m_labels[i];
-	}
+	// Blocks are cut from the training samples in this order
 	if (sortByLabelOrFeature == 'f') {
-		SortByFeature(samples, labels, args->m_numSamples, m_cstore->m_numFeatures, 0);
+		SortByFeature(sampleOrder, trainNumSamples, m_cstore->m_samples[0]);
 	}
 	else if (sortByLabelOrFeature == 'l') {
-		SortByBinaryLabel(samples, labels, args->m_numSamples, m_cstore->m_numFeatures);
+		SortByBinaryLabel(sampleOrder, trainNumSamples, m_cstore->m_labels);
 	}
 	
 
 	cout << "AVX_SGD ---------------------------------------" << endl;
-	uint32_t numBlocks = args->m_numSamples/blockSize;
+	uint32_t numBlocks = trainNumSamples/blockSize;
 	cout << "numBlocks: " << numBlocks << endl;
-	uint32_t rest = args->m_numSamples - numBlocks*blockSize;
+	uint32_t rest = trainNumSamples - numBlocks*blockSize;
 	cout << "rest: " << rest << endl;
 
 	cout << "numBlocksAtATime: " << numBlocksAtATime << endl;
@@ -370,13 +482,9 @@ void ColumnML::blockwise_SGD(
 	cout << "restOfTheBlocks: " << restOfTheBlocks << endl;
 
 
-	float loss = Loss(type, x, lambda, args);
-	float trainAccuracy = Accuracy(type, x, args)/(float)trainNumSamples;
-	args->m_firstSample = trainNumSamples;
-	args->m_numSamples = testNumSamples;
-	float testAccuracy = Accuracy(type, x, args)/(float)testNumSamples;
-	args->m_firstSample = 0;
-	args->m_numSamples = trainNumSamples;
+	float loss = Loss(type, x, lambda, &trainArgs);
+	float trainAccuracy = Accuracy(type, x, &trainArgs)/(float)trainNumSamples;
+	float testAccuracy = Accuracy(type, x, &testArgs)/(float)testNumSamples;
 	cout << loss << "   \t" << trainAccuracy << "   \t" << testAccuracy << endl;
 	if (lossHistory != nullptr) {
 		lossHistory[0] = loss;
@@ -416,8 +524,8 @@ void ColumnML::blockwise_SGD(
 			for (uint32_t m = 0; m < numBlocksAtATime; m++) {
 				uint32_t blockIndex = blockIndexes[countBlocks++];
 				for (uint32_t i = 0; i < blockSize; i++) {
-					CopySample(subSamples, samples, m*blockSize+i, blockIndex*blockSize+i, m_cstore->m_numFeatures);
-					subLabels[m*blockSize+i] = labels[blockIndex*blockSize+i];
+					CopySample(subSamples, m_cstore->m_samples, m*blockSize+i, sampleOrder[blockIndex*blockSize+i], m_cstore->m_numFeatures);
+					subLabels[m*blockSize+i] = m_cstore->m_labels[sampleOrder[blockIndex*blockSize+i]];
 				}
 			}
 
@@ -445,8 +553,8 @@ void ColumnML::blockwise_SGD(
 			for (uint32_t m = 0; m < restOfTheBlocks; m++) {
 				uint32_t blockIndex = blockIndexes[countBlocks++];
 				for (uint32_t i = 0; i < blockSize; i++) {
-					CopySample(subSamples, samples, m*blockSize+i, blockIndex*blockSize+i, m_cstore->m_numFeatures);
-					subLabels[m*blockSize+i] = labels[blockIndex*blockSize+i];
+					CopySample(subSamples, m_cstore->m_samples, m*blockSize+i, sampleOrder[blockIndex*blockSize+i], m_cstore->m_numFeatures);
+					subLabels[m*blockSize+i] = m_cstore->m_labels[sampleOrder[blockIndex*blockSize+i]];
 				}
 			}
 
@@ -474,13 +582,9 @@ void ColumnML::blockwise_SGD(
 			}
 		}
 		else {
-			loss = Loss(type, x, lambda, args);
-			trainAccuracy = Accuracy(type, x, args)/(float)trainNumSamples;
-			args->m_firstSample = trainNumSamples;
-			args->m_numSamples = testNumSamples;
-			testAccuracy = Accuracy(type, x, args)/(float)testNumSamples;
-			args->m_firstSample = 0;
-			args->m_numSamples = trainNumSamples;
+			loss = Loss(type, x, lambda, &trainArgs);
+			trainAccuracy = Accuracy(type, x, &trainArgs)/(float)trainNumSamples;
+			testAccuracy = Accuracy(type, x, &testArgs)/(float)testNumSamples;
 			cout << loss << "   \t" << trainAccuracy << "   \t" << testAccuracy << endl;
 			if (lossHistory != nullptr) {
 				lossHistory[epoch+1] = loss;
@@ -496,8 +600,9 @@ void ColumnML::blockwise_SGD(
 
 	free(x);
 	free(gradient);
-	free(samples);
-	free(labels);
+	free(sampleOrder);
+	delete trainView;
+	delete testView;
 	free(subSamples);
 	free(subLabels);
 	free(blockIndexes);
@@ -514,22 +619,40 @@ void ColumnML::AVX_SGD(
 	float lambda, 
 	AdditionalArguments* args) 
 {
+	if (m_cstore->m_samples == nullptr && m_cstore->m_halfSamples == nullptr && m_cstore->m_quantizedSamples == nullptr && m_cstore->m_dictionaryCodes == nullptr && m_cstore->m_paxSamples == nullptr) {
+		cout << "AVX_SGD needs the dense samples in memory!" << endl;
+		exit(1);
+	}
+	if (m_cstore->m_samples == nullptr && minibatchSize%8 > 0) {
+		cout << "For PAX, reduced precision, quantized and dictionary encoded samples AVX_SGD needs minibatchSize%8 == 0!" << endl;
+		exit(1);
+	}
+	CheckMinibatchAlignment(args, minibatchSize, "AVX_SGD");
 	float* x = (float*)aligned_alloc(64, m_cstore->m_numFeatures*sizeof(float));
 	memset(x, 0, m_cstore->m_numFeatures*sizeof(float));
 	float* gradient = (float*)aligned_alloc(64, m_cstore->m_numFeatures*sizeof(float));
 	memset(gradient, 0, m_cstore->m_numFeatures*sizeof(float));
 
+	// With a ColumnNormalization the dots are taken with the model folded into rawX, and the
+	// gradient over the raw samples is mapped to the normalized ones feature by feature
+	ColumnNormalization* normalization = args->m_normalization;
+	float* rawX = x;
+	float offset = 0;
+	if (normalization != nullptr) {
+		rawX = (float*)aligned_alloc(64, m_cstore->m_numFeatures*sizeof(float));
+	}
+
 	cout << "AVX_SGD ---------------------------------------" << endl;
-	uint32_t numMinibatches = args->m_numSamples/minibatchSize;
+	uint32_t numMinibatches = GetNumSamples(args)/minibatchSize;
 	cout << "numMinibatches: " << numMinibatches << endl;
-	uint32_t rest = args->m_numSamples - numMinibatches*minibatchSize;
+	uint32_t rest = GetNumSamples(args) - numMinibatches*minibatchSize;
 	cout << "rest: " << rest << endl;
 
 #ifdef PRINT_LOSS
 	cout << "Initial loss: " << Loss(type, x, lambda, args) << endl;
 #endif
 #ifdef PRINT_ACCURACY
-	cout << "Initial accuracy: " << Accuracy(type, x, args) << " corrects out of " << args->m_numSamples << endl;
+	cout << "Initial accuracy: " << Accuracy(type, x, args) << " corrects out of " << GetNumSamples(args) << endl;
 #endif
 
 	__m256 AVX_ones = _mm256_set1_ps(1.0);
@@ -549,29 +672,40 @@ void ColumnML::AVX_SGD(
 #else
 			uint32_t m = k;
 #endif
-			uint32_t minibatchOffset = m*minibatchSize;
+			uint32_t minibatchOffset = GetMinibatchIndex(args, m, minibatchSize)*minibatchSize;
+			if (normalization != nullptr) {
+				offset = normalization->FoldIntoModel(x, rawX);
+			}
+			float errorSum = 0;
 
 			if (minibatchSize == 1) {
-				float dot = getDot(x, minibatchOffset);
+				float dot = getDot(rawX, minibatchOffset) + offset;
 				if (type == logreg) {
 					dot = 1/(1+exp(-dot));
 				}
 				dot = (dot-m_cstore->m_labels[minibatchOffset]);
 				for (uint32_t j = 0; j < m_cstore->m_numFeatures; j++) {
 					float regularizer = (x[j] < 0) ? -scaledLambda : scaledLambda;
+					float sample = m_cstore->m_samples[j][minibatchOffset];
+					if (normalization != nullptr) {
+						sample = normalization->m_scale[j]*sample + normalization->m_shift[j];
+					}
 					if (args->m_constantStepSize) {
-						x[j] -= scaledStepSize*dot*m_cstore->m_samples[j][minibatchOffset] + regularizer;
+						x[j] -= scaledStepSize*dot*sample + regularizer;
 					}
 					else {
 						regularizer /= ((float)(epoch+1));
-						x[j] -= scaledStepSize/(float)(epoch+1)*dot*m_cstore->m_samples[j][minibatchOffset] + regularizer;
+						x[j] -= scaledStepSize/(float)(epoch+1)*dot*sample + regularizer;
 					}
 				}
 			}
 			else {
 				if (minibatchSize%8 == 0) {
 					for (uint32_t i = 0; i < minibatchSize-(minibatchSize%8); i+=8) {
-						__m256 AVX_dot = AVX_verticalGetDot(x, minibatchOffset + i);
+						__m256 AVX_dot = AVX_verticalGetDot(rawX, minibatchOffset + i);
+						if (normalization != nullptr) {
+							AVX_dot = _mm256_add_ps(AVX_dot, _mm256_set1_ps(offset));
+						}
 						if (type == logreg) {
 							AVX_dot = _mm256_mul_ps(AVX_minusOnes, AVX_dot);
 							AVX_dot = exp256_ps(AVX_dot);
@@ -580,8 +714,13 @@ void ColumnML::AVX_SGD(
 						}
 						__m256 AVX_labels = _mm256_load_ps(m_cstore->m_labels + minibatchOffset + i);
 						AVX_dot = _mm256_sub_ps(AVX_dot, AVX_labels);
+						if (normalization != nullptr) {
+							float error[8];
+							_mm256_storeu_ps(error, AVX_dot);
+							errorSum += error[0] + error[1] + error[2] + error[3] + error[4] + error[5] + error[6] + error[7];
+						}
 						for (uint32_t j = 0; j < m_cstore->m_numFeatures; j++) {
-							__m256 AVX_samples = _mm256_load_ps(m_cstore->m_samples[j] + minibatchOffset + i);
+							__m256 AVX_samples = AVX_loadSamples(j, minibatchOffset + i);
 							__m256 AVX_gradient = _mm256_mul_ps(AVX_dot, AVX_samples);
 							float delta[8];
 							_mm256_store_ps(delta, AVX_gradient);
@@ -590,16 +729,20 @@ void ColumnML::AVX_SGD(
 					}
 				}
 				for (uint32_t i = minibatchSize-(minibatchSize%8); i < minibatchSize; i++) {
-					float dot = AVX_horizontalGetDot(x, minibatchOffset + i);
+					float dot = AVX_horizontalGetDot(rawX, minibatchOffset + i) + offset;
 					if (type == logreg) {
 						dot = 1/(1+exp(-dot));
 					}
 					dot = (dot-m_cstore->m_labels[minibatchOffset + i]);
+					errorSum += dot;
 					for (uint32_t j = 0; j < m_cstore->m_numFeatures; j++) {
 						gradient[j] += dot*m_cstore->m_samples[j][minibatchOffset + i];
 					}
 				}
 				for (uint32_t j = 0; j < m_cstore->m_numFeatures; j++) {
+					if (normalization != nullptr) {
+						gradient[j] = normalization->m_scale[j]*gradient[j] + normalization->m_shift[j]*errorSum;
+					}
 					float regularizer = (x[j] < 0) ? -scaledLambda : scaledLambda;
 					if (args->m_constantStepSize) {
 						x[j] -= scaledStepSize*gradient[j] + regularizer;
@@ -628,11 +771,14 @@ void ColumnML::AVX_SGD(
 			cout << Loss(type, x, lambda, args) << endl;
 #endif
 #ifdef PRINT_ACCURACY
-			cout << Accuracy(type, x, args) << " corrects out of " << args->m_numSamples << endl;
+			cout << Accuracy(type, x, args) << " corrects out of " << GetNumSamples(args) << endl;
 #endif
 		}
 	}
 
+	if (rawX != x) {
+		free(rawX);
+	}
 	free(x);
 	free(gradient);
 }
@@ -646,6 +792,11 @@ void ColumnML::AVXrowwise_SGD(
 	float lambda, 
 	AdditionalArguments* args) 
 {
+	if (m_cstore->m_samples == nullptr) {
+		cout << "AVXrowwise_SGD needs the dense samples in memory!" << endl;
+		exit(1);
+	}
+	CheckNoNormalization(args, "AVXrowwise_SGD");
 	if (minibatchSize != 1) {
 		cout << "For AVXrowwise_SGD minibatchSize must be 1!" << endl;
 		exit(1);
@@ -658,10 +809,10 @@ void ColumnML::AVXrowwise_SGD(
 	float* gradient = (float*)aligned_alloc(64, m_cstore->m_numFeatures*sizeof(float));
 	memset(gradient, 0, m_cstore->m_numFeatures*sizeof(float));
 
-	float* samples = (float*)aligned_alloc(64, args->m_numSamples*m_cstore->m_numFeatures*sizeof(float));
-	for (uint32_t i = 0; i < args->m_numSamples; i++) {
+	float* samples = (float*)aligned_alloc(64, GetNumSamples(args)*m_cstore->m_numFeatures*sizeof(float));
+	for (uint32_t i = 0; i < GetNumSamples(args); i++) {
 		for (uint32_t j = 0; j < m_cstore->m_numFeatures; j++) {
-			samples[i*m_cstore->m_numFeatures + j] = m_cstore->m_samples[j][i];
+			samples[i*m_cstore->m_numFeatures + j] = m_cstore->m_samples[j][GetSampleIndex(args, i)];
 		}
 	}
 
@@ -669,7 +820,7 @@ void ColumnML::AVXrowwise_SGD(
 	cout << "Initial loss: " << Loss(type, x, lambda, args) << endl;
 #endif
 #ifdef PRINT_ACCURACY
-	cout << "Initial accuracy: " << Accuracy(type, x, args) << " corrects out of " << args->m_numSamples << endl;
+	cout << "Initial accuracy: " << Accuracy(type, x, args) << " corrects out of " << GetNumSamples(args) << endl;
 #endif
 
 	__m256 AVX_ones = _mm256_set1_ps(1.0);
@@ -684,11 +835,11 @@ void ColumnML::AVXrowwise_SGD(
 
 		double start = get_time();
 
-		for (uint32_t k = 0; k < args->m_numSamples; k++) {
+		for (uint32_t k = 0; k < GetNumSamples(args); k++) {
 #ifdef SGD_SHUFFLE
 			uint32_t rand = 0;
 			_rdrand32_step(&rand);
-			uint32_t m = args->m_numSamples*((float)(rand-1)/(float)UINT_MAX);
+			uint32_t m = GetNumSamples(args)*((float)(rand-1)/(float)UINT_MAX);
 #else
 			uint32_t m = k;
 #endif
@@ -712,10 +863,10 @@ void ColumnML::AVXrowwise_SGD(
 				dot = 1/(1+exp(-dot));
 			}
 			if (args->m_constantStepSize) {
-				dot = scaledStepSize*(dot-m_cstore->m_labels[m]);
+				dot = scaledStepSize*(dot-m_cstore->m_labels[GetSampleIndex(args, m)]);
 			}
 			else {
-				dot = scaledStepSize/(float)(epoch+1)*(dot-m_cstore->m_labels[m]);
+				dot = scaledStepSize/(float)(epoch+1)*(dot-m_cstore->m_labels[GetSampleIndex(args, m)]);
 			}
 
 			if (m_cstore->m_numFeatures >= 8) {
@@ -741,7 +892,7 @@ void ColumnML::AVXrowwise_SGD(
 				if (!args->m_constantStepSize) {
 					regularizer /= (float)(epoch+1);
 				}
-				x[j] -= dot*m_cstore->m_samples[j][m] + regularizer;
+				x[j] -= dot*samples[m*m_cstore->m_numFeatures + j] + regularizer;
 			}
 		}
 
@@ -759,7 +910,7 @@ void ColumnML::AVXrowwise_SGD(
 			cout << Loss(type, x, lambda, args) << endl;
 #endif
 #ifdef PRINT_ACCURACY
-			cout << Accuracy(type, x, args) << " corrects out of " << args->m_numSamples << endl;
+			cout << Accuracy(type, x, args) << " corrects out of " << GetNumSamples(args) << endl;
 #endif
 		}
 	}
@@ -777,15 +928,23 @@ static inline void UpdateResidual(
 	uint32_t numMinibatchesAtATime,
 	uint32_t minibatchSize,
 	float* transformedColumn,
+	ColumnNormalization* normalization,
 	float* xFinal)
 {
+	// A normalized sample is scale*value + shift
+	float scaledX = xFinal[coordinate];
+	float shiftedX = 0;
+	if (normalization != nullptr) {
+		scaledX = xFinal[coordinate]*normalization->m_scale[coordinate];
+		shiftedX = xFinal[coordinate]*normalization->m_shift[coordinate];
+	}
 	for (uint32_t l = 0; l < numMinibatchesAtATime; l++) {
 		for (uint32_t i = 0; i < minibatchSize; i++) {
 			if (coordinate == 0) {
-				residual[minibatchIndex[l]*minibatchSize + i] = xFinal[coordinate]*transformedColumn[l*minibatchSize + i];
+				residual[minibatchIndex[l]*minibatchSize + i] = scaledX*transformedColumn[l*minibatchSize + i] + shiftedX;
 			}
 			else {
-				residual[minibatchIndex[l]*minibatchSize + i] += xFinal[coordinate]*transformedColumn[l*minibatchSize + i];
+				residual[minibatchIndex[l]*minibatchSize + i] = (residual[minibatchIndex[l]*minibatchSize + i] + shiftedX) + scaledX*transformedColumn[l*minibatchSize + i];
 			}
 		}
 	}
@@ -798,18 +957,21 @@ static inline void AVX_UpdateResidual(
 	uint32_t minibatchIndex,
 	uint32_t minibatchSize,
 	float* transformedColumn,
+	float scale,
+	float shift,
 	float* xFinal)
 {
+	__m256 AVX_shiftedX = _mm256_set1_ps(xFinal[coordinate]*shift);
 	for (uint32_t i = 0; i < minibatchSize; i+=8) {
 		__m256 AVX_residual = _mm256_load_ps(residual + minibatchIndex*minibatchSize + i);
-		__m256 AVX_xFinal = _mm256_set1_ps(xFinal[coordinate]);
+		__m256 AVX_xFinal = _mm256_set1_ps(xFinal[coordinate]*scale);
 		__m256 AVX_samples = _mm256_load_ps(transformedColumn + i);
 
 		if (coordinate == 0) {
-			AVX_residual = _mm256_mul_ps(AVX_xFinal, AVX_samples);
+			AVX_residual = _mm256_fmadd_ps(AVX_xFinal, AVX_samples, AVX_shiftedX);
 		}
 		else {
-			AVX_residual = _mm256_fmadd_ps(AVX_xFinal, AVX_samples, AVX_residual);
+			AVX_residual = _mm256_fmadd_ps(AVX_xFinal, AVX_samples, _mm256_add_ps(AVX_residual, AVX_shiftedX));
 		}
 
 		_mm256_store_ps(residual + minibatchIndex*minibatchSize + i, AVX_residual);
@@ -826,6 +988,7 @@ static inline void DoStep(
 	uint32_t minibatchSize,
 	ColumnStore* cstore,
 	float* transformedColumn,
+	ColumnNormalization* normalization,
 	float* x,
 	float scaledStepSize,
 	float scaledLambda,
@@ -836,35 +999,48 @@ static inline void DoStep(
 
 	timeStamp1 = get_time();
 	float gradient = 0;
+	float errorSum = 0;
 	for (uint32_t l = 0; l < numMinibatchesAtATime; l++) {
 		for (uint32_t i = 0; i < minibatchSize; i++) {
 			float dot = residual[minibatchIndex[l]*minibatchSize + i];
 			if (type == logreg) {
 				dot = 1/(1+exp(-dot));
 			}
-			gradient += (dot - cstore->m_labels[minibatchIndex[l]*minibatchSize + i])*transformedColumn[l*minibatchSize + i];							
+			float error = dot - cstore->m_labels[minibatchIndex[l]*minibatchSize + i];
+			gradient += error*transformedColumn[l*minibatchSize + i];
+			errorSum += error;
 		}
 	}
+	// The gradient over the normalized samples scale*value + shift
+	float scale = 1;
+	float shift = 0;
+	if (normalization != nullptr) {
+		scale = normalization->m_scale[coordinate];
+		shift = normalization->m_shift[coordinate];
+		gradient = scale*gradient + shift*errorSum;
+	}
 	timeStamp2 = get_time();
 	dotTime += (timeStamp2-timeStamp1);
 
 	float step = scaledStepSize*gradient;
 
-	if (x[minibatchIndex[0]*cstore->m_numFeatures + coordinate] - step > scaledLambda) {
+	if (x[coordinate] - step > scaledLambda) {
 		step += scaledLambda;
 	}
-	else if (x[minibatchIndex[0]*cstore->m_numFeatures + coordinate] - step < -scaledLambda) {
+	else if (x[coordinate] - step < -scaledLambda) {
 		step -= scaledLambda;
 	}
 	else {
-		step = x[minibatchIndex[0]*cstore->m_numFeatures + coordinate];
+		step = x[coordinate];
 	}
 
-	x[minibatchIndex[0]*cstore->m_numFeatures + coordinate] -= step;
+	x[coordinate] -= step;
 
+	float scaledStep = step*scale;
+	float shiftedStep = step*shift;
 	for (uint32_t l = 0; l < numMinibatchesAtATime; l++) {
 		for (uint32_t i = 0; i < minibatchSize; i++) {
-			residual[minibatchIndex[l]*minibatchSize + i] -= step*transformedColumn[l*minibatchSize + i];
+			residual[minibatchIndex[l]*minibatchSize + i] = (residual[minibatchIndex[l]*minibatchSize + i] - shiftedStep) - scaledStep*transformedColumn[l*minibatchSize + i];
 		}
 	}
 	timeStamp3 = get_time();
@@ -880,6 +1056,8 @@ static inline float AVX_GetStep(
 	uint32_t minibatchSize,
 	ColumnStore* cstore,
 	float* transformedColumn,
+	float scale,
+	float shift,
 	float scaledStepSize,
 	double &dotTime)
 {
@@ -889,6 +1067,7 @@ static inline float AVX_GetStep(
 
 	timeStamp1 = get_time();
 	__m256 AVX_gradient = _mm256_setzero_ps();
+	__m256 AVX_errorSum = _mm256_setzero_ps();
 	__m256 AVX_error;
 	for (uint32_t i = 0; i < minibatchSize; i+=8) {
 
@@ -905,6 +1084,7 @@ static inline float AVX_GetStep(
 
 		AVX_error = _mm256_sub_ps(AVX_residual, AVX_labels);
 		AVX_gradient = _mm256_fmadd_ps(AVX_samples, AVX_error, AVX_gradient);
+		AVX_errorSum = _mm256_add_ps(AVX_errorSum, AVX_error);
 	}
 
 	float gradientReduce[8];
@@ -918,6 +1098,14 @@ static inline float AVX_GetStep(
 						gradientReduce[6] + 
 						gradientReduce[7]);
 
+	// The gradient over the normalized samples scale*value + shift
+	if (shift != 0 || scale != 1) {
+		float errorReduce[8];
+		_mm256_store_ps(errorReduce, AVX_errorSum);
+		float errorSum = errorReduce[0] + errorReduce[1] + errorReduce[2] + errorReduce[3] + errorReduce[4] + errorReduce[5] + errorReduce[6] + errorReduce[7];
+		gradientReduce[0] = scale*gradientReduce[0] + shift*errorSum;
+	}
+
 	float step = scaledStepSize*gradientReduce[0];
 	
 	timeStamp2 = get_time();
@@ -932,9 +1120,12 @@ static inline void AVX_ApplyStep(
 	uint32_t minibatchIndex,
 	uint32_t minibatchSize,
 	float* transformedColumn,
+	float scale,
+	float shift,
 	double &residualUpdateTime)
 {
-	__m256 AVX_step = _mm256_set1_ps(step);
+	__m256 AVX_step = _mm256_set1_ps(step*scale);
+	__m256 AVX_shiftedStep = _mm256_set1_ps(step*shift);
 
 	double timeStamp1, timeStamp2;
 	timeStamp1 = get_time();
@@ -942,7 +1133,7 @@ static inline void AVX_ApplyStep(
 	for (uint32_t i = 0; i < minibatchSize; i+=8) {
 		__m256 AVX_samples = _mm256_load_ps(transformedColumn + i);
 		__m256 AVX_residual = _mm256_load_ps(residual + minibatchIndex*minibatchSize + i);
-		AVX_residual = _mm256_fmadd_ps(AVX_samples, AVX_step, AVX_residual);
+		AVX_residual = _mm256_fmadd_ps(AVX_samples, AVX_step, _mm256_add_ps(AVX_residual, AVX_shiftedStep));
 
 		_mm256_store_ps(residual + minibatchIndex*minibatchSize + i, AVX_residual);
 	}
@@ -950,191 +1141,1109 @@ static inline void AVX_ApplyStep(
 	timeStamp2 = get_time();
 	residualUpdateTime += (timeStamp2-timeStamp1);
 }
-#endif
 
-void ColumnML::SCD(
-	ModelType type, 
-	float* xHistory, 
-	uint32_t numEpochs, 
-	uint32_t minibatchSize, 
-	float stepSize, 
-	float lambda, 
-	uint32_t numMinibatchesAtATime, 
-	uint32_t residualUpdatePeriod, 
-	bool useEncrypted, 
-	bool useCompressed, 
-	uint32_t toIntegerScaler, 
-	AdditionalArguments* args)
+static inline float AVX_SparseGetStep(
+	ModelType type,
+	float* residual,
+	uint32_t coordinate,
+	uint32_t minibatchIndex,
+	ColumnStore* cstore,
+	float scaledStepSize,
+	double &dotTime)
 {
-	cout << "SCD ---------------------------------------" << endl;
-	uint32_t numMinibatches = args->m_numSamples/minibatchSize;
-	cout << "numMinibatches: " << numMinibatches << endl;
-	uint32_t rest = args->m_numSamples - numMinibatches*minibatchSize;
-	cout << "rest: " << rest << endl;
-
-	float* residual = (float*)aligned_alloc(64, args->m_numSamples*sizeof(float));
-	memset(residual, 0, args->m_numSamples*sizeof(float));
-	float* x = (float*)aligned_alloc(64, numMinibatches*m_cstore->m_numFeatures*sizeof(float));
-	memset(x, 0, numMinibatches*m_cstore->m_numFeatures*sizeof(float));
-	float* xFinal = (float*)aligned_alloc(64, m_cstore->m_numFeatures*sizeof(float));
-	memset(xFinal, 0, m_cstore->m_numFeatures*sizeof(float));
-	
-#ifdef PRINT_LOSS
-	cout << "Initial loss: " << Loss(type, xFinal, lambda, args) << endl;
-#endif
-#ifdef PRINT_ACCURACY
-	cout << "Initial accuracy: " << Accuracy(type, xFinal, args) << " corrects out of " << args->m_numSamples << endl;
-#endif
+	double timeStamp1, timeStamp2;
+	__m256 AVX_ones = _mm256_set1_ps(1.0);
+	__m256 AVX_minusOnes = _mm256_set1_ps(-1.0);
 
-	float* transformedColumn1 = nullptr;
-	float* transformedColumn2 = nullptr;
-	if (useEncrypted && useCompressed) {
-		transformedColumn1 = (float*)aligned_alloc(64, numMinibatchesAtATime*minibatchSize*sizeof(float));
-		transformedColumn2 = (float*)aligned_alloc(64, numMinibatchesAtATime*minibatchSize*sizeof(float));
-	}
-	else if ( numMinibatchesAtATime > 1 ) {
-		transformedColumn2 = (float*)aligned_alloc(64, numMinibatchesAtATime*minibatchSize*sizeof(float));
-	}
+	timeStamp1 = get_time();
+	uint32_t* rows = cstore->m_sparseRows[coordinate];
+	float* values = cstore->m_sparseValues[coordinate];
+	uint32_t begin = cstore->m_sparseSegments[coordinate][minibatchIndex];
+	uint32_t end = cstore->m_sparseSegments[coordinate][minibatchIndex+1];
 
-	float scaledStepSize = stepSize/minibatchSize;
-	float scaledLambda = stepSize*lambda;
-	uint32_t epoch_index = 0;
-	for(uint32_t epoch = 0; epoch < numEpochs + (numEpochs/residualUpdatePeriod); epoch++) {
+	// Zeros do not contribute to the gradient, only the residuals of the nonzero rows are gathered
+	__m256 AVX_gradient = _mm256_setzero_ps();
+	__m256 AVX_error;
+	uint32_t k = begin;
+	for (; k + 8 <= end; k+=8) {
+		__m256i AVX_rows = _mm256_loadu_si256((__m256i*)(rows + k));
+		__m256 AVX_samples = _mm256_loadu_ps(values + k);
+		__m256 AVX_labels = _mm256_i32gather_ps(cstore->m_labels, AVX_rows, 4);
+		__m256 AVX_residual = _mm256_i32gather_ps(residual, AVX_rows, 4);
 
-		double decryptionTime = 0;
-		double decompressionTime = 0;
-		double dotTime = 0;
-		double residualUpdateTime = 0;
-		double start = get_time();
+		if (type == logreg) {
+			AVX_residual = _mm256_mul_ps(AVX_minusOnes, AVX_residual);
+			AVX_residual = exp256_ps(AVX_residual);
+			AVX_residual = _mm256_add_ps(AVX_ones, AVX_residual);
+			AVX_residual = _mm256_div_ps(AVX_ones, AVX_residual);
+		}
 
-		for (uint32_t k = 0; k < numMinibatches/numMinibatchesAtATime; k++) {
+		AVX_error = _mm256_sub_ps(AVX_residual, AVX_labels);
+		AVX_gradient = _mm256_fmadd_ps(AVX_samples, AVX_error, AVX_gradient);
+	}
 
-			if (numMinibatchesAtATime > 1) {
-				uint32_t m[numMinibatchesAtATime];
-				for (uint32_t l = 0; l < numMinibatchesAtATime; l++) {
-					m[l] = l*(numMinibatches/numMinibatchesAtATime) + k;
-				}
-				for (uint32_t j = 0; j < m_cstore->m_numFeatures; j++) {
+	float gradientReduce[8];
+	_mm256_storeu_ps(gradientReduce, AVX_gradient);
+	float gradient = (gradientReduce[0] + 
+					gradientReduce[1] + 
+					gradientReduce[2] + 
+					gradientReduce[3] + 
+					gradientReduce[4] + 
+					gradientReduce[5] + 
+					gradientReduce[6] + 
+					gradientReduce[7]);
+	for (; k < end; k++) {
+		float dot = residual[rows[k]];
+		if (type == logreg) {
+			dot = 1/(1+exp(-dot));
+		}
+		gradient += values[k]*(dot - cstore->m_labels[rows[k]]);
+	}
 
-					m_cstore->ReturnDecompressedAndDecrypted(transformedColumn1, transformedColumn2, j, m, numMinibatchesAtATime, minibatchSize, useEncrypted, useCompressed, toIntegerScaler, decryptionTime, decompressionTime);
+	float step = scaledStepSize*gradient;
 
-					if ( (epoch+1)%(residualUpdatePeriod+1) == 0 ) {
-						UpdateResidual(residual, j, m, numMinibatchesAtATime, minibatchSize, transformedColumn2, xFinal);
-					}
-					else {
-						DoStep(type, residual, j, m, numMinibatchesAtATime, minibatchSize, m_cstore, transformedColumn2, x, scaledStepSize, scaledLambda, dotTime, residualUpdateTime);
-					}
-				}
-			}
-			else {
-				uint32_t m = k;
+	timeStamp2 = get_time();
+	dotTime += (timeStamp2-timeStamp1);
 
-				for (uint32_t j = 0; j < m_cstore->m_numFeatures; j++) {
+	return step;
+}
 
-					m_cstore->ReturnDecompressedAndDecrypted(transformedColumn1, transformedColumn2, j, &m, 1, minibatchSize, useEncrypted, useCompressed, toIntegerScaler, decryptionTime, decompressionTime);
+static inline void AVX_SparseApplyStep(
+	float step,
+	float* residual,
+	uint32_t coordinate,
+	uint32_t minibatchIndex,
+	ColumnStore* cstore,
+	double &residualUpdateTime)
+{
+	__m256 AVX_step = _mm256_set1_ps(step);
 
-					if ( (epoch+1)%(residualUpdatePeriod+1) == 0 ) {
-						UpdateResidual(residual, j, &m, 1, minibatchSize, transformedColumn2, xFinal);
-					}
-					else {
-						DoStep(type, residual, j, &m, 1, minibatchSize, m_cstore, transformedColumn2, x, scaledStepSize, scaledLambda, dotTime, residualUpdateTime);
-					}
-				}
-			}
-		}
+	double timeStamp1, timeStamp2;
+	timeStamp1 = get_time();
 
-		if ( (epoch+1)%(residualUpdatePeriod+1) == 0 ) {
-			cout << "--> PERFORMED RESIDUAL UPDATE !!!" << endl;
-		}
-		else {
-			double timeStamp1 = get_time();
-			GetAveragedX(numMinibatches, numMinibatchesAtATime, m_cstore, xFinal, x);
-			double end = get_time();
-#ifdef PRINT_TIMING
-			cout << "decryptionTime: " << decryptionTime << endl;
-			cout << "decompressionTime: " << decompressionTime << endl;
-			cout << "dotTime: " << dotTime << endl;
-			cout << "residualUpdateTime: " << residualUpdateTime << endl;
-			cout << "x_average_time: " << end-timeStamp1 << endl;
-			cout << "Time for one epoch: " << end-start << endl;
-#endif
-			if (xHistory != nullptr) {
-				for (uint32_t j = 0; j < m_cstore->m_numFeatures; j++) {
-					xHistory[epoch_index*m_cstore->m_numFeatures + j] = xFinal[j];
-				}
-				epoch_index++;
-			}
-			else {
-#ifdef PRINT_LOSS
-				cout << Loss(type, xFinal, lambda, args) << endl;
-#endif
-#ifdef PRINT_ACCURACY
-				cout << Accuracy(type, xFinal, args) << " corrects out of " << args->m_numSamples << endl;
-#endif
-			}
+	uint32_t* rows = cstore->m_sparseRows[coordinate];
+	float* values = cstore->m_sparseValues[coordinate];
+	uint32_t begin = cstore->m_sparseSegments[coordinate][minibatchIndex];
+	uint32_t end = cstore->m_sparseSegments[coordinate][minibatchIndex+1];
+
+	// Rows are unique within a column, so the lanes can be scattered back without conflicts
+	float scatter[8] __attribute__((aligned(32)));
+	uint32_t k = begin;
+	for (; k + 8 <= end; k+=8) {
+		__m256i AVX_rows = _mm256_loadu_si256((__m256i*)(rows + k));
+		__m256 AVX_samples = _mm256_loadu_ps(values + k);
+		__m256 AVX_residual = _mm256_i32gather_ps(residual, AVX_rows, 4);
+		AVX_residual = _mm256_fmadd_ps(AVX_samples, AVX_step, AVX_residual);
+		_mm256_store_ps(scatter, AVX_residual);
+		for (uint32_t l = 0; l < 8; l++) {
+			residual[rows[k+l]] = scatter[l];
 		}
 	}
-
-	if (useEncrypted && useCompressed) {
-		free(transformedColumn1);
-		free(transformedColumn2);
-	}
-	else if (numMinibatchesAtATime > 1) {
-		free(transformedColumn2);
+	for (; k < end; k++) {
+		residual[rows[k]] += step*values[k];
 	}
-	free(x);
-	free(xFinal);
-	free(residual);
+
+	timeStamp2 = get_time();
+	residualUpdateTime += (timeStamp2-timeStamp1);
 }
 
-#ifdef AVX2
-void ColumnML::AVX_SCD(
-		ModelType type,
-		float* xHistory, 
-		uint32_t numEpochs, 
-		uint32_t minibatchSize, 
-		float stepSize, 
-		float lambda, 
-		uint32_t residualUpdatePeriod, 
-		bool useEncrypted, 
-		bool useCompressed, 
-		uint32_t toIntegerScaler,
-		AdditionalArguments* args)
+static inline void AVX_SparseUpdateResidual(
+	float* residual,
+	uint32_t coordinate,
+	uint32_t minibatchIndex,
+	uint32_t minibatchSize,
+	ColumnStore* cstore,
+	float* xFinal)
 {
-	if (minibatchSize%8 > 0) {
-		cout << "For AVX minibatchSize%8 must be 0!" << endl;
-		exit(1);
+	if (coordinate == 0) {
+		memset(residual + minibatchIndex*minibatchSize, 0, minibatchSize*sizeof(float));
 	}
+	double residualUpdateTime = 0;
+	AVX_SparseApplyStep(xFinal[coordinate], residual, coordinate, minibatchIndex, cstore, residualUpdateTime);
+}
 
-	cout << "AVX_SCD ---------------------------------------" << endl;
-	uint32_t numMinibatches = args->m_numSamples/minibatchSize;
-	cout << "numMinibatches: " << numMinibatches << endl;
-	uint32_t rest = args->m_numSamples - numMinibatches*minibatchSize;
-	cout << "rest: " << rest << endl;
-
-	float* residual = (float*)aligned_alloc(64, args->m_numSamples*sizeof(float));
-	memset(residual, 0, args->m_numSamples*sizeof(float));
-	float* x = (float*)aligned_alloc(64, numMinibatches*m_cstore->m_numFeatures*sizeof(float));
-	memset(x, 0, numMinibatches*m_cstore->m_numFeatures*sizeof(float));
-	float* xFinal = (float*)aligned_alloc(64, m_cstore->m_numFeatures*sizeof(float));
-	memset(xFinal, 0, m_cstore->m_numFeatures*sizeof(float));
+static inline float AVX_HalfGetStep(
+	ModelType type,
+	float* residual,
+	uint32_t coordinate,
+	uint32_t minibatchIndex,
+	uint32_t minibatchSize,
+	ColumnStore* cstore,
+	float scaledStepSize,
+	double &dotTime)
+{
+	double timeStamp1, timeStamp2;
+	__m256 AVX_ones = _mm256_set1_ps(1.0);
+	__m256 AVX_minusOnes = _mm256_set1_ps(-1.0);
+	uint16_t* halfColumn = cstore->m_halfSamples[coordinate] + minibatchIndex*minibatchSize;
+	SamplesPrecision precision = cstore->m_samplesPrecision;
 
-#ifdef PRINT_LOSS
-	cout << "Initial loss: " << Loss(type, xFinal, lambda, args) << endl;
+	timeStamp1 = get_time();
+	__m256 AVX_gradient = _mm256_setzero_ps();
+	__m256 AVX_error;
+	for (uint32_t i = 0; i < minibatchSize; i+=8) {
+
+		__m256 AVX_samples = AVX_WidenSamples(halfColumn + i, precision);
+		__m256 AVX_labels = _mm256_load_ps(cstore->m_labels + minibatchIndex*minibatchSize + i);
+		__m256 AVX_residual = _mm256_load_ps(residual + minibatchIndex*minibatchSize + i);
+
+		if (type == logreg) {
+			AVX_residual = _mm256_mul_ps(AVX_minusOnes, AVX_residual);
+			AVX_residual = exp256_ps(AVX_residual);
+			AVX_residual = _mm256_add_ps(AVX_ones, AVX_residual);
+			AVX_residual = _mm256_div_ps(AVX_ones, AVX_residual);
+		}
+
+		AVX_error = _mm256_sub_ps(AVX_residual, AVX_labels);
+		AVX_gradient = _mm256_fmadd_ps(AVX_samples, AVX_error, AVX_gradient);
+	}
+
+	float gradientReduce[8];
+	_mm256_storeu_ps(gradientReduce, AVX_gradient);
+	gradientReduce[0] = (gradientReduce[0] + 
+						gradientReduce[1] + 
+						gradientReduce[2] + 
+						gradientReduce[3] + 
+						gradientReduce[4] + 
+						gradientReduce[5] + 
+						gradientReduce[6] + 
+						gradientReduce[7]);
+
+	float step = scaledStepSize*gradientReduce[0];
+	
+	timeStamp2 = get_time();
+	dotTime += (timeStamp2-timeStamp1);
+
+	return step;
+}
+
+static inline void AVX_HalfApplyStep(
+	float step,
+	float* residual,
+	uint32_t coordinate,
+	uint32_t minibatchIndex,
+	uint32_t minibatchSize,
+	ColumnStore* cstore,
+	double &residualUpdateTime)
+{
+	__m256 AVX_step = _mm256_set1_ps(step);
+	uint16_t* halfColumn = cstore->m_halfSamples[coordinate] + minibatchIndex*minibatchSize;
+	SamplesPrecision precision = cstore->m_samplesPrecision;
+
+	double timeStamp1, timeStamp2;
+	timeStamp1 = get_time();
+
+	for (uint32_t i = 0; i < minibatchSize; i+=8) {
+		__m256 AVX_samples = AVX_WidenSamples(halfColumn + i, precision);
+		__m256 AVX_residual = _mm256_load_ps(residual + minibatchIndex*minibatchSize + i);
+		AVX_residual = _mm256_fmadd_ps(AVX_samples, AVX_step, AVX_residual);
+
+		_mm256_store_ps(residual + minibatchIndex*minibatchSize + i, AVX_residual);
+	}
+
+	timeStamp2 = get_time();
+	residualUpdateTime += (timeStamp2-timeStamp1);
+}
+
+static inline void AVX_HalfUpdateResidual(
+	float* residual,
+	uint32_t coordinate,
+	uint32_t minibatchIndex,
+	uint32_t minibatchSize,
+	ColumnStore* cstore,
+	float* xFinal)
+{
+	uint16_t* halfColumn = cstore->m_halfSamples[coordinate] + minibatchIndex*minibatchSize;
+	SamplesPrecision precision = cstore->m_samplesPrecision;
+	__m256 AVX_xFinal = _mm256_set1_ps(xFinal[coordinate]);
+
+	for (uint32_t i = 0; i < minibatchSize; i+=8) {
+		__m256 AVX_residual = _mm256_load_ps(residual + minibatchIndex*minibatchSize + i);
+		__m256 AVX_samples = AVX_WidenSamples(halfColumn + i, precision);
+
+		if (coordinate == 0) {
+			AVX_residual = _mm256_mul_ps(AVX_xFinal, AVX_samples);
+		}
+		else {
+			AVX_residual = _mm256_fmadd_ps(AVX_xFinal, AVX_samples, AVX_residual);
+		}
+
+		_mm256_store_ps(residual + minibatchIndex*minibatchSize + i, AVX_residual);
+	}
+}
+
+// Quantized kernels: value = min + level*scale, so the scale and min are applied once per
+// minibatch instead of per sample: sum(value*error) = scale*sum(level*error) + min*sum(error)
+static inline float AVX_QuantizedGetStep(
+	ModelType type,
+	float* residual,
+	uint32_t coordinate,
+	uint32_t minibatchIndex,
+	uint32_t minibatchSize,
+	ColumnStore* cstore,
+	float scaledStepSize,
+	double &dotTime)
+{
+	double timeStamp1, timeStamp2;
+	__m256 AVX_ones = _mm256_set1_ps(1.0);
+	__m256 AVX_minusOnes = _mm256_set1_ps(-1.0);
+	uint8_t* quantizedColumn = cstore->m_quantizedSamples[coordinate];
+	uint32_t numBits = cstore->m_quantizedBits;
+
+	timeStamp1 = get_time();
+	__m256 AVX_levelGradient = _mm256_setzero_ps();
+	__m256 AVX_errorSum = _mm256_setzero_ps();
+	__m256 AVX_error;
+	for (uint32_t i = 0; i < minibatchSize; i+=8) {
+
+		__m256 AVX_levels = _mm256_cvtepi32_ps(AVX_UnpackQuantized(quantizedColumn, minibatchIndex*minibatchSize + i, numBits));
+		__m256 AVX_labels = _mm256_load_ps(cstore->m_labels + minibatchIndex*minibatchSize + i);
+		__m256 AVX_residual = _mm256_load_ps(residual + minibatchIndex*minibatchSize + i);
+
+		if (type == logreg) {
+			AVX_residual = _mm256_mul_ps(AVX_minusOnes, AVX_residual);
+			AVX_residual = exp256_ps(AVX_residual);
+			AVX_residual = _mm256_add_ps(AVX_ones, AVX_residual);
+			AVX_residual = _mm256_div_ps(AVX_ones, AVX_residual);
+		}
+
+		AVX_error = _mm256_sub_ps(AVX_residual, AVX_labels);
+		AVX_levelGradient = _mm256_fmadd_ps(AVX_levels, AVX_error, AVX_levelGradient);
+		AVX_errorSum = _mm256_add_ps(AVX_error, AVX_errorSum);
+	}
+
+	float levelGradient[8];
+	float errorSum[8];
+	_mm256_storeu_ps(levelGradient, AVX_levelGradient);
+	_mm256_storeu_ps(errorSum, AVX_errorSum);
+	float gradient = 0;
+	for (uint32_t k = 0; k < 8; k++) {
+		gradient += cstore->m_quantizedScale[coordinate]*levelGradient[k] + cstore->m_quantizedMin[coordinate]*errorSum[k];
+	}
+
+	float step = scaledStepSize*gradient;
+	
+	timeStamp2 = get_time();
+	dotTime += (timeStamp2-timeStamp1);
+
+	return step;
+}
+
+static inline void AVX_QuantizedApplyStep(
+	float step,
+	float* residual,
+	uint32_t coordinate,
+	uint32_t minibatchIndex,
+	uint32_t minibatchSize,
+	ColumnStore* cstore,
+	double &residualUpdateTime)
+{
+	// residual += step*(min + level*scale)
+	__m256 AVX_stepScale = _mm256_set1_ps(step*cstore->m_quantizedScale[coordinate]);
+	__m256 AVX_stepMin = _mm256_set1_ps(step*cstore->m_quantizedMin[coordinate]);
+	uint8_t* quantizedColumn = cstore->m_quantizedSamples[coordinate];
+	uint32_t numBits = cstore->m_quantizedBits;
+
+	double timeStamp1, timeStamp2;
+	timeStamp1 = get_time();
+
+	for (uint32_t i = 0; i < minibatchSize; i+=8) {
+		__m256 AVX_levels = _mm256_cvtepi32_ps(AVX_UnpackQuantized(quantizedColumn, minibatchIndex*minibatchSize + i, numBits));
+		__m256 AVX_residual = _mm256_load_ps(residual + minibatchIndex*minibatchSize + i);
+		AVX_residual = _mm256_add_ps(AVX_residual, AVX_stepMin);
+		AVX_residual = _mm256_fmadd_ps(AVX_levels, AVX_stepScale, AVX_residual);
+
+		_mm256_store_ps(residual + minibatchIndex*minibatchSize + i, AVX_residual);
+	}
+
+	timeStamp2 = get_time();
+	residualUpdateTime += (timeStamp2-timeStamp1);
+}
+
+static inline void AVX_QuantizedUpdateResidual(
+	float* residual,
+	uint32_t coordinate,
+	uint32_t minibatchIndex,
+	uint32_t minibatchSize,
+	ColumnStore* cstore,
+	float* xFinal)
+{
+	if (coordinate == 0) {
+		memset(residual + minibatchIndex*minibatchSize, 0, minibatchSize*sizeof(float));
+	}
+	double residualUpdateTime = 0;
+	AVX_QuantizedApplyStep(xFinal[coordinate], residual, coordinate, minibatchIndex, minibatchSize, cstore, residualUpdateTime);
+}
+
+// prediction - label of 8 samples, the error the gradients are taken over
+static inline __m256 AVX_LoadError(ModelType type, float* residual, float* labels) {
+	__m256 AVX_residual = _mm256_load_ps(residual);
+	if (type == logreg) {
+		AVX_residual = _mm256_mul_ps(_mm256_set1_ps(-1.0), AVX_residual);
+		AVX_residual = exp256_ps(AVX_residual);
+		AVX_residual = _mm256_add_ps(_mm256_set1_ps(1.0), AVX_residual);
+		AVX_residual = _mm256_div_ps(_mm256_set1_ps(1.0), AVX_residual);
+	}
+	return _mm256_sub_ps(AVX_residual, _mm256_load_ps(labels));
+}
+
+// Dictionary kernels: the values, with a ColumnNormalization scale*value + shift, are computed once
+// per dictionary entry. With two entries the gradient is taken over the codes only,
+// value0*sum(error) + (value1 - value0)*sum(error with code 1). Larger dictionaries are looked up
+// per sample, from a register up to 8 entries and with a gather beyond; summing the errors per
+// entry first was slower there, as it has to scatter them one by one.
+static inline float AVX_DictionaryGetStep(
+	ModelType type,
+	float* residual,
+	uint32_t coordinate,
+	uint32_t minibatchIndex,
+	uint32_t minibatchSize,
+	ColumnStore* cstore,
+	float scale,
+	float shift,
+	float scaledStepSize,
+	double &dotTime)
+{
+	double timeStamp1, timeStamp2;
+	uint8_t* codes = cstore->m_dictionaryCodes[coordinate] + minibatchIndex*minibatchSize;
+	float* values = cstore->m_dictionaryValues[coordinate];
+	uint32_t dictionarySize = cstore->m_dictionarySizes[coordinate];
+	float* minibatchResidual = residual + minibatchIndex*minibatchSize;
+	float* minibatchLabels = cstore->m_labels + minibatchIndex*minibatchSize;
+
+	timeStamp1 = get_time();
+	__m256 AVX_gradient;
+	// sum_i value[code_i]*error_i is computed as sum_v value_v*(sum of the errors with code v) only
+	// for two values. Every further value costs a compare, mask and add per 8 samples, which is
+	// even with the single permute lookup below at 3 values and up to 2.3x slower at 8.
+	if (dictionarySize <= 2) {
+		// Two values, e.g. one-hot: value0*sum(error) + (value1 - value0)*sum(error with code 1)
+		__m256 AVX_errorSum = _mm256_setzero_ps();
+		__m256 AVX_codeErrorSum = _mm256_setzero_ps();
+		for (uint32_t i = 0; i < minibatchSize; i+=8) {
+			__m256 AVX_error = AVX_LoadError(type, minibatchResidual + i, minibatchLabels + i);
+			__m256i AVX_codes = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i*)(codes + i)));
+			__m256 AVX_mask = _mm256_castsi256_ps(_mm256_cmpeq_epi32(AVX_codes, _mm256_set1_epi32(1)));
+			AVX_errorSum = _mm256_add_ps(AVX_errorSum, AVX_error);
+			AVX_codeErrorSum = _mm256_add_ps(AVX_codeErrorSum, _mm256_and_ps(AVX_mask, AVX_error));
+		}
+		float value0 = scale*values[0] + shift;
+		float value1 = scale*values[1] + shift;
+		AVX_gradient = _mm256_fmadd_ps(_mm256_set1_ps(value1 - value0), AVX_codeErrorSum, _mm256_mul_ps(_mm256_set1_ps(value0), AVX_errorSum));
+	}
+	else if (dictionarySize <= 8) {
+		// The dictionary fits one register, the values are padded to 8
+		__m256 AVX_table = _mm256_fmadd_ps(_mm256_set1_ps(scale), _mm256_load_ps(values), _mm256_set1_ps(shift));
+		AVX_gradient = _mm256_setzero_ps();
+		for (uint32_t i = 0; i < minibatchSize; i+=8) {
+			__m256 AVX_error = AVX_LoadError(type, minibatchResidual + i, minibatchLabels + i);
+			__m256i AVX_codes = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i*)(codes + i)));
+			AVX_gradient = _mm256_fmadd_ps(_mm256_permutevar8x32_ps(AVX_table, AVX_codes), AVX_error, AVX_gradient);
+		}
+	}
+	else {
+		float table[DICTIONARY_MAX_SIZE] __attribute__((aligned(32)));
+		for (uint32_t c = 0; c < dictionarySize; c++) {
+			table[c] = scale*values[c] + shift;
+		}
+		AVX_gradient = _mm256_setzero_ps();
+		for (uint32_t i = 0; i < minibatchSize; i+=8) {
+			__m256 AVX_error = AVX_LoadError(type, minibatchResidual + i, minibatchLabels + i);
+			__m256i AVX_codes = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i*)(codes + i)));
+			AVX_gradient = _mm256_fmadd_ps(_mm256_i32gather_ps(table, AVX_codes, 4), AVX_error, AVX_gradient);
+		}
+	}
+
+	float gradientReduce[8];
+	_mm256_storeu_ps(gradientReduce, AVX_gradient);
+	float gradient = 0;
+	for (uint32_t k = 0; k < 8; k++) {
+		gradient += gradientReduce[k];
+	}
+
+	float step = scaledStepSize*gradient;
+
+	timeStamp2 = get_time();
+	dotTime += (timeStamp2-timeStamp1);
+
+	return step;
+}
+
+static inline void AVX_DictionaryApplyStep(
+	float step,
+	float* residual,
+	uint32_t coordinate,
+	uint32_t minibatchIndex,
+	uint32_t minibatchSize,
+	ColumnStore* cstore,
+	float scale,
+	float shift,
+	double &residualUpdateTime)
+{
+	// residual += table[code], table[c] = step*(scale*value_c + shift)
+	uint8_t* codes = cstore->m_dictionaryCodes[coordinate] + minibatchIndex*minibatchSize;
+	float* values = cstore->m_dictionaryValues[coordinate];
+	uint32_t dictionarySize = cstore->m_dictionarySizes[coordinate];
+	float* minibatchResidual = residual + minibatchIndex*minibatchSize;
+
+	double timeStamp1, timeStamp2;
+	timeStamp1 = get_time();
+
+	if (dictionarySize <= 8) {
+		// The table fits one register, the values are padded to 8
+		__m256 AVX_table = _mm256_mul_ps(_mm256_set1_ps(step), _mm256_fmadd_ps(_mm256_set1_ps(scale), _mm256_load_ps(values), _mm256_set1_ps(shift)));
+		for (uint32_t i = 0; i < minibatchSize; i+=8) {
+			__m256i AVX_codes = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i*)(codes + i)));
+			__m256 AVX_residual = _mm256_load_ps(minibatchResidual + i);
+			AVX_residual = _mm256_add_ps(AVX_residual, _mm256_permutevar8x32_ps(AVX_table, AVX_codes));
+			_mm256_store_ps(minibatchResidual + i, AVX_residual);
+		}
+	}
+	else {
+		float table[DICTIONARY_MAX_SIZE] __attribute__((aligned(32)));
+		for (uint32_t c = 0; c < dictionarySize; c++) {
+			table[c] = step*(scale*values[c] + shift);
+		}
+		for (uint32_t i = 0; i < minibatchSize; i+=8) {
+			__m256i AVX_codes = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i*)(codes + i)));
+			__m256 AVX_residual = _mm256_load_ps(minibatchResidual + i);
+			AVX_residual = _mm256_add_ps(AVX_residual, _mm256_i32gather_ps(table, AVX_codes, 4));
+			_mm256_store_ps(minibatchResidual + i, AVX_residual);
+		}
+	}
+
+	timeStamp2 = get_time();
+	residualUpdateTime += (timeStamp2-timeStamp1);
+}
+
+static inline void AVX_DictionaryUpdateResidual(
+	float* residual,
+	uint32_t coordinate,
+	uint32_t minibatchIndex,
+	uint32_t minibatchSize,
+	ColumnStore* cstore,
+	float scale,
+	float shift,
+	float* xFinal)
+{
+	if (coordinate == 0) {
+		memset(residual + minibatchIndex*minibatchSize, 0, minibatchSize*sizeof(float));
+	}
+	double residualUpdateTime = 0;
+	AVX_DictionaryApplyStep(xFinal[coordinate], residual, coordinate, minibatchIndex, minibatchSize, cstore, scale, shift, residualUpdateTime);
+}
+
+// Run-length kernels: a run of value v contributes v*sum(error) to the gradient and step*v to the
+// residual, so the column itself is never read. Runs start anywhere, the blocks of 8 samples a run
+// only partly covers are masked.
+static inline __m256 AVX_RunMask(uint32_t i, uint32_t begin, uint32_t end) {
+	__m256i AVX_indexes = _mm256_add_epi32(_mm256_set1_epi32(i), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	__m256i AVX_afterBegin = _mm256_cmpgt_epi32(AVX_indexes, _mm256_set1_epi32((int32_t)begin - 1));
+	__m256i AVX_beforeEnd = _mm256_cmpgt_epi32(_mm256_set1_epi32(end), AVX_indexes);
+	return _mm256_castsi256_ps(_mm256_and_si256(AVX_afterBegin, AVX_beforeEnd));
+}
+
+// The first run of column coordinate that reaches into the samples from firstSample on
+static inline uint32_t FindRun(ColumnStore* cstore, uint32_t coordinate, uint32_t firstSample) {
+	uint32_t* starts = cstore->m_runStarts[coordinate];
+	return (uint32_t)(upper_bound(starts, starts + cstore->m_numRuns[coordinate], firstSample) - starts) - 1;
+}
+
+static inline float AVX_RunGetStep(
+	ModelType type,
+	float* residual,
+	uint32_t coordinate,
+	uint32_t minibatchIndex,
+	uint32_t minibatchSize,
+	ColumnStore* cstore,
+	float scale,
+	float shift,
+	float scaledStepSize,
+	double &dotTime)
+{
+	double timeStamp1, timeStamp2;
+	uint32_t* starts = cstore->m_runStarts[coordinate];
+	float* values = cstore->m_runValues[coordinate];
+	uint32_t firstSample = minibatchIndex*minibatchSize;
+	uint32_t lastSample = firstSample + minibatchSize;
+
+	timeStamp1 = get_time();
+	float gradient = 0;
+	for (uint32_t r = FindRun(cstore, coordinate, firstSample); starts[r] < lastSample; r++) {
+		uint32_t begin = (starts[r] > firstSample) ? starts[r] : firstSample;
+		uint32_t end = (starts[r+1] < lastSample) ? starts[r+1] : lastSample;
+		__m256 AVX_errorSum = _mm256_setzero_ps();
+		for (uint32_t i = begin - (begin - firstSample)%8; i < end; i+=8) {
+			__m256 AVX_error = AVX_LoadError(type, residual + i, cstore->m_labels + i);
+			if (i < begin || i + 8 > end) {
+				AVX_error = _mm256_and_ps(AVX_RunMask(i, begin, end), AVX_error);
+			}
+			AVX_errorSum = _mm256_add_ps(AVX_errorSum, AVX_error);
+		}
+		float errorReduce[8];
+		_mm256_storeu_ps(errorReduce, AVX_errorSum);
+		float errorSum = errorReduce[0] + errorReduce[1] + errorReduce[2] + errorReduce[3] + errorReduce[4] + errorReduce[5] + errorReduce[6] + errorReduce[7];
+		gradient += (scale*values[r] + shift)*errorSum;
+	}
+
+	float step = scaledStepSize*gradient;
+
+	timeStamp2 = get_time();
+	dotTime += (timeStamp2-timeStamp1);
+
+	return step;
+}
+
+static inline void AVX_RunApplyStep(
+	float step,
+	float* residual,
+	uint32_t coordinate,
+	uint32_t minibatchIndex,
+	uint32_t minibatchSize,
+	ColumnStore* cstore,
+	float scale,
+	float shift,
+	double &residualUpdateTime)
+{
+	uint32_t* starts = cstore->m_runStarts[coordinate];
+	float* values = cstore->m_runValues[coordinate];
+	uint32_t firstSample = minibatchIndex*minibatchSize;
+	uint32_t lastSample = firstSample + minibatchSize;
+
+	double timeStamp1, timeStamp2;
+	timeStamp1 = get_time();
+
+	for (uint32_t r = FindRun(cstore, coordinate, firstSample); starts[r] < lastSample; r++) {
+		uint32_t begin = (starts[r] > firstSample) ? starts[r] : firstSample;
+		uint32_t end = (starts[r+1] < lastSample) ? starts[r+1] : lastSample;
+		__m256 AVX_step = _mm256_set1_ps(step*(scale*values[r] + shift));
+		for (uint32_t i = begin - (begin - firstSample)%8; i < end; i+=8) {
+			__m256 AVX_update = AVX_step;
+			if (i < begin || i + 8 > end) {
+				AVX_update = _mm256_and_ps(AVX_RunMask(i, begin, end), AVX_step);
+			}
+			_mm256_store_ps(residual + i, _mm256_add_ps(_mm256_load_ps(residual + i), AVX_update));
+		}
+	}
+
+	timeStamp2 = get_time();
+	residualUpdateTime += (timeStamp2-timeStamp1);
+}
+
+static inline void AVX_RunUpdateResidual(
+	float* residual,
+	uint32_t coordinate,
+	uint32_t minibatchIndex,
+	uint32_t minibatchSize,
+	ColumnStore* cstore,
+	float scale,
+	float shift,
+	float* xFinal)
+{
+	if (coordinate == 0) {
+		memset(residual + minibatchIndex*minibatchSize, 0, minibatchSize*sizeof(float));
+	}
+	double residualUpdateTime = 0;
+	AVX_RunApplyStep(xFinal[coordinate], residual, coordinate, minibatchIndex, minibatchSize, cstore, scale, shift, residualUpdateTime);
+}
+
+// The dense kernels over compressed columns. Instead of decompressing the whole minibatch first,
+// the lines are decoded COMPRESSED_CHUNK_SIZE samples ahead of where the gradient is, so the
+// values are read back from L1 right after being written. The decoded minibatch is left in
+// transformedColumn for AVX_ApplyStep. The results are the same as the dense kernels over the
+// decompressed column.
+static inline float AVX_CompressedGetStep(
+	ModelType type,
+	float* residual,
+	uint32_t coordinate,
+	uint32_t minibatchIndex,
+	uint32_t minibatchSize,
+	ColumnStore* cstore,
+	float* transformedColumn,
+	uint32_t toIntegerScaler,
+	float scale,
+	float shift,
+	float scaledStepSize,
+	double &dotTime)
+{
+	double timeStamp1, timeStamp2;
+	__m256 AVX_ones = _mm256_set1_ps(1.0);
+	__m256 AVX_minusOnes = _mm256_set1_ps(-1.0);
+	__m256 AVX_reciprocal = _mm256_set1_ps(1.0f/((float)(1 << toIntegerScaler)));
+
+	timeStamp1 = get_time();
+	const uint32_t* compressedColumn = cstore->GetCompressedMinibatch(coordinate, minibatchIndex);
+	CompressionCodec codec = cstore->m_compressedCodecs[coordinate];
+	uint32_t numDecoded = 0;
+	__m256 AVX_gradient = _mm256_setzero_ps();
+	__m256 AVX_errorSum = _mm256_setzero_ps();
+	__m256 AVX_error;
+	for (uint32_t i = 0; i < minibatchSize; i+=8) {
+		if (numDecoded < i + 8) {
+			while (numDecoded < i + COMPRESSED_CHUNK_SIZE && numDecoded < minibatchSize) {
+				numDecoded += AVX_DecompressBlockTo(compressedColumn, codec, AVX_reciprocal, transformedColumn + numDecoded);
+			}
+		}
+
+		__m256 AVX_samples = _mm256_loadu_ps(transformedColumn + i);
+		__m256 AVX_labels = _mm256_load_ps(cstore->m_labels + minibatchIndex*minibatchSize + i);
+		__m256 AVX_residual = _mm256_load_ps(residual + minibatchIndex*minibatchSize + i);
+
+		if (type == logreg) {
+			AVX_residual = _mm256_mul_ps(AVX_minusOnes, AVX_residual);
+			AVX_residual = exp256_ps(AVX_residual);
+			AVX_residual = _mm256_add_ps(AVX_ones, AVX_residual);
+			AVX_residual = _mm256_div_ps(AVX_ones, AVX_residual);
+		}
+
+		AVX_error = _mm256_sub_ps(AVX_residual, AVX_labels);
+		AVX_gradient = _mm256_fmadd_ps(AVX_samples, AVX_error, AVX_gradient);
+		AVX_errorSum = _mm256_add_ps(AVX_errorSum, AVX_error);
+	}
+
+	float gradientReduce[8];
+	_mm256_store_ps(gradientReduce, AVX_gradient);
+	gradientReduce[0] = (gradientReduce[0] + 
+						gradientReduce[1] + 
+						gradientReduce[2] + 
+						gradientReduce[3] + 
+						gradientReduce[4] + 
+						gradientReduce[5] + 
+						gradientReduce[6] + 
+						gradientReduce[7]);
+
+	// The gradient over the normalized samples scale*value + shift
+	if (shift != 0 || scale != 1) {
+		float errorReduce[8];
+		_mm256_store_ps(errorReduce, AVX_errorSum);
+		float errorSum = errorReduce[0] + errorReduce[1] + errorReduce[2] + errorReduce[3] + errorReduce[4] + errorReduce[5] + errorReduce[6] + errorReduce[7];
+		gradientReduce[0] = scale*gradientReduce[0] + shift*errorSum;
+	}
+
+	float step = scaledStepSize*gradientReduce[0];
+	
+	timeStamp2 = get_time();
+	dotTime += (timeStamp2-timeStamp1);
+
+	return step;
+}
+
+static inline void AVX_CompressedUpdateResidual(
+	float* residual,
+	uint32_t coordinate,
+	uint32_t minibatchIndex,
+	uint32_t minibatchSize,
+	ColumnStore* cstore,
+	float* transformedColumn,
+	uint32_t toIntegerScaler,
+	float scale,
+	float shift,
+	float* xFinal)
+{
+	__m256 AVX_reciprocal = _mm256_set1_ps(1.0f/((float)(1 << toIntegerScaler)));
+	__m256 AVX_shiftedX = _mm256_set1_ps(xFinal[coordinate]*shift);
+	const uint32_t* compressedColumn = cstore->GetCompressedMinibatch(coordinate, minibatchIndex);
+	CompressionCodec codec = cstore->m_compressedCodecs[coordinate];
+	uint32_t numDecoded = 0;
+	for (uint32_t i = 0; i < minibatchSize; i+=8) {
+		if (numDecoded < i + 8) {
+			while (numDecoded < i + COMPRESSED_CHUNK_SIZE && numDecoded < minibatchSize) {
+				numDecoded += AVX_DecompressBlockTo(compressedColumn, codec, AVX_reciprocal, transformedColumn + numDecoded);
+			}
+		}
+
+		__m256 AVX_residual = _mm256_load_ps(residual + minibatchIndex*minibatchSize + i);
+		__m256 AVX_xFinal = _mm256_set1_ps(xFinal[coordinate]*scale);
+		__m256 AVX_samples = _mm256_loadu_ps(transformedColumn + i);
+
+		if (coordinate == 0) {
+			AVX_residual = _mm256_fmadd_ps(AVX_xFinal, AVX_samples, AVX_shiftedX);
+		}
+		else {
+			AVX_residual = _mm256_fmadd_ps(AVX_xFinal, AVX_samples, _mm256_add_ps(AVX_residual, AVX_shiftedX));
+		}
+
+		_mm256_store_ps(residual + minibatchIndex*minibatchSize + i, AVX_residual);
+	}
+}
+
+// Selects what the per-column kernels read: the column returned by ReturnDecompressedAndDecrypted,
+// or the compressed, sparse or reduced precision columns of the store in place
+static inline ColumnKernel SelectColumnKernel(ColumnStore* cstore, bool useEncrypted, bool useCompressed) {
+	if (useCompressed && !useEncrypted) {
+		return compressedKernel;
+	}
+	if (useEncrypted) {
+		return denseKernel;
+	}
+	if (cstore->IsSparse()) {
+		return sparseKernel;
+	}
+	if (cstore->m_halfSamples != nullptr) {
+		return halfKernel;
+	}
+	if (cstore->m_quantizedSamples != nullptr) {
+		return quantizedKernel;
+	}
+	if (cstore->m_dictionaryCodes != nullptr) {
+		return dictionaryKernel;
+	}
+	return denseKernel;
+}
+
+// Per-column kernels, dispatched on the representation the store holds. Only the dense, dictionary
+// and compressed kernels apply a ColumnNormalization, see CheckNoNormalization. Columns of a
+// dictionary encoded store that have no codes go to the dense kernels. Run-length columns go to
+// the run kernels whatever the representation, the callers skip ReturnDecompressedAndDecrypted for them.
+static inline float AVX_ColumnGetStep(
+	ColumnKernel kernel,
+	ModelType type,
+	float* residual,
+	uint32_t coordinate,
+	uint32_t minibatchIndex,
+	uint32_t minibatchSize,
+	ColumnStore* cstore,
+	float* transformedColumn,
+	ColumnNormalization* normalization,
+	uint32_t toIntegerScaler,
+	float scaledStepSize,
+	double &dotTime)
+{
+	if (cstore->IsRunColumn(coordinate)) {
+		if (normalization != nullptr) {
+			return AVX_RunGetStep(type, residual, coordinate, minibatchIndex, minibatchSize, cstore, normalization->m_scale[coordinate], normalization->m_shift[coordinate], scaledStepSize, dotTime);
+		}
+		return AVX_RunGetStep(type, residual, coordinate, minibatchIndex, minibatchSize, cstore, 1, 0, scaledStepSize, dotTime);
+	}
+	if (kernel == compressedKernel) {
+		if (normalization != nullptr) {
+			return AVX_CompressedGetStep(type, residual, coordinate, minibatchIndex, minibatchSize, cstore, transformedColumn, toIntegerScaler, normalization->m_scale[coordinate], normalization->m_shift[coordinate], scaledStepSize, dotTime);
+		}
+		return AVX_CompressedGetStep(type, residual, coordinate, minibatchIndex, minibatchSize, cstore, transformedColumn, toIntegerScaler, 1, 0, scaledStepSize, dotTime);
+	}
+	if (kernel == sparseKernel) {
+		return AVX_SparseGetStep(type, residual, coordinate, minibatchIndex, cstore, scaledStepSize, dotTime);
+	}
+	if (kernel == halfKernel) {
+		return AVX_HalfGetStep(type, residual, coordinate, minibatchIndex, minibatchSize, cstore, scaledStepSize, dotTime);
+	}
+	if (kernel == quantizedKernel) {
+		return AVX_QuantizedGetStep(type, residual, coordinate, minibatchIndex, minibatchSize, cstore, scaledStepSize, dotTime);
+	}
+	if (kernel == dictionaryKernel && cstore->m_dictionaryCodes[coordinate] != nullptr) {
+		if (normalization != nullptr) {
+			return AVX_DictionaryGetStep(type, residual, coordinate, minibatchIndex, minibatchSize, cstore, normalization->m_scale[coordinate], normalization->m_shift[coordinate], scaledStepSize, dotTime);
+		}
+		return AVX_DictionaryGetStep(type, residual, coordinate, minibatchIndex, minibatchSize, cstore, 1, 0, scaledStepSize, dotTime);
+	}
+	if (normalization != nullptr) {
+		return AVX_GetStep(type, residual, coordinate, minibatchIndex, minibatchSize, cstore, transformedColumn, normalization->m_scale[coordinate], normalization->m_shift[coordinate], scaledStepSize, dotTime);
+	}
+	return AVX_GetStep(type, residual, coordinate, minibatchIndex, minibatchSize, cstore, transformedColumn, 1, 0, scaledStepSize, dotTime);
+}
+
+static inline void AVX_ColumnApplyStep(
+	ColumnKernel kernel,
+	float step,
+	float* residual,
+	uint32_t coordinate,
+	uint32_t minibatchIndex,
+	uint32_t minibatchSize,
+	ColumnStore* cstore,
+	float* transformedColumn,
+	ColumnNormalization* normalization,
+	double &residualUpdateTime)
+{
+	if (cstore->IsRunColumn(coordinate)) {
+		if (normalization != nullptr) {
+			AVX_RunApplyStep(step, residual, coordinate, minibatchIndex, minibatchSize, cstore, normalization->m_scale[coordinate], normalization->m_shift[coordinate], residualUpdateTime);
+			return;
+		}
+		AVX_RunApplyStep(step, residual, coordinate, minibatchIndex, minibatchSize, cstore, 1, 0, residualUpdateTime);
+		return;
+	}
+	if (kernel == sparseKernel) {
+		AVX_SparseApplyStep(step, residual, coordinate, minibatchIndex, cstore, residualUpdateTime);
+		return;
+	}
+	if (kernel == halfKernel) {
+		AVX_HalfApplyStep(step, residual, coordinate, minibatchIndex, minibatchSize, cstore, residualUpdateTime);
+		return;
+	}
+	if (kernel == quantizedKernel) {
+		AVX_QuantizedApplyStep(step, residual, coordinate, minibatchIndex, minibatchSize, cstore, residualUpdateTime);
+		return;
+	}
+	if (kernel == dictionaryKernel && cstore->m_dictionaryCodes[coordinate] != nullptr) {
+		if (normalization != nullptr) {
+			AVX_DictionaryApplyStep(step, residual, coordinate, minibatchIndex, minibatchSize, cstore, normalization->m_scale[coordinate], normalization->m_shift[coordinate], residualUpdateTime);
+			return;
+		}
+		AVX_DictionaryApplyStep(step, residual, coordinate, minibatchIndex, minibatchSize, cstore, 1, 0, residualUpdateTime);
+		return;
+	}
+	// Compressed columns as well, AVX_CompressedGetStep left the decoded minibatch in transformedColumn
+	if (normalization != nullptr) {
+		AVX_ApplyStep(step, residual, minibatchIndex, minibatchSize, transformedColumn, normalization->m_scale[coordinate], normalization->m_shift[coordinate], residualUpdateTime);
+		return;
+	}
+	AVX_ApplyStep(step, residual, minibatchIndex, minibatchSize, transformedColumn, 1, 0, residualUpdateTime);
+}
+
+static inline void AVX_ColumnUpdateResidual(
+	ColumnKernel kernel,
+	float* residual,
+	uint32_t coordinate,
+	uint32_t minibatchIndex,
+	uint32_t minibatchSize,
+	ColumnStore* cstore,
+	float* transformedColumn,
+	ColumnNormalization* normalization,
+	uint32_t toIntegerScaler,
+	float* xFinal)
+{
+	if (cstore->IsRunColumn(coordinate)) {
+		if (normalization != nullptr) {
+			AVX_RunUpdateResidual(residual, coordinate, minibatchIndex, minibatchSize, cstore, normalization->m_scale[coordinate], normalization->m_shift[coordinate], xFinal);
+			return;
+		}
+		AVX_RunUpdateResidual(residual, coordinate, minibatchIndex, minibatchSize, cstore, 1, 0, xFinal);
+		return;
+	}
+	if (kernel == compressedKernel) {
+		if (normalization != nullptr) {
+			AVX_CompressedUpdateResidual(residual, coordinate, minibatchIndex, minibatchSize, cstore, transformedColumn, toIntegerScaler, normalization->m_scale[coordinate], normalization->m_shift[coordinate], xFinal);
+			return;
+		}
+		AVX_CompressedUpdateResidual(residual, coordinate, minibatchIndex, minibatchSize, cstore, transformedColumn, toIntegerScaler, 1, 0, xFinal);
+		return;
+	}
+	if (kernel == sparseKernel) {
+		AVX_SparseUpdateResidual(residual, coordinate, minibatchIndex, minibatchSize, cstore, xFinal);
+		return;
+	}
+	if (kernel == halfKernel) {
+		AVX_HalfUpdateResidual(residual, coordinate, minibatchIndex, minibatchSize, cstore, xFinal);
+		return;
+	}
+	if (kernel == quantizedKernel) {
+		AVX_QuantizedUpdateResidual(residual, coordinate, minibatchIndex, minibatchSize, cstore, xFinal);
+		return;
+	}
+	if (kernel == dictionaryKernel && cstore->m_dictionaryCodes[coordinate] != nullptr) {
+		if (normalization != nullptr) {
+			AVX_DictionaryUpdateResidual(residual, coordinate, minibatchIndex, minibatchSize, cstore, normalization->m_scale[coordinate], normalization->m_shift[coordinate], xFinal);
+			return;
+		}
+		AVX_DictionaryUpdateResidual(residual, coordinate, minibatchIndex, minibatchSize, cstore, 1, 0, xFinal);
+		return;
+	}
+	if (normalization != nullptr) {
+		AVX_UpdateResidual(residual, coordinate, minibatchIndex, minibatchSize, transformedColumn, normalization->m_scale[coordinate], normalization->m_shift[coordinate], xFinal);
+		return;
+	}
+	AVX_UpdateResidual(residual, coordinate, minibatchIndex, minibatchSize, transformedColumn, 1, 0, xFinal);
+}
+#endif
+
+void ColumnML::SCD(
+	ModelType type, 
+	float* xHistory, 
+	uint32_t numEpochs, 
+	uint32_t minibatchSize, 
+	float stepSize, 
+	float lambda, 
+	uint32_t numMinibatchesAtATime, 
+	uint32_t residualUpdatePeriod, 
+	bool useEncrypted, 
+	bool useCompressed, 
+	uint32_t toIntegerScaler, 
+	AdditionalArguments* args)
+{
+	if (m_cstore->IsSparse() || m_cstore->m_halfSamples != nullptr || m_cstore->m_quantizedSamples != nullptr || m_cstore->m_dictionaryCodes != nullptr) {
+		cout << "For sparse, reduced precision, quantized and dictionary encoded samples use AVX_SCD or AVXmulti_SCD!" << endl;
+		exit(1);
+	}
+	m_cstore->CheckLayoutMinibatchSize(minibatchSize);
+	CheckMinibatchAlignment(args, minibatchSize, "SCD");
+	cout << "SCD ---------------------------------------" << endl;
+	uint32_t numMinibatches = GetNumSamples(args)/minibatchSize;
+	cout << "numMinibatches: " << numMinibatches << endl;
+	uint32_t rest = GetNumSamples(args) - numMinibatches*minibatchSize;
+	cout << "rest: " << rest << endl;
+
+	// Indexed like the samples of the store
+	uint32_t residualSize = GetResidualSize(args, m_cstore->m_numSamples);
+	float* residual = m_scratchPools[0].Get(scratchResidual, residualSize);
+	memset(residual, 0, residualSize*sizeof(float));
+	float* x = m_scratchPools[0].Get(scratchX, numMinibatches*m_cstore->m_numFeatures);
+	memset(x, 0, numMinibatches*m_cstore->m_numFeatures*sizeof(float));
+	float* xFinal = m_scratchPools[0].Get(scratchXFinal, m_cstore->m_numFeatures);
+	memset(xFinal, 0, m_cstore->m_numFeatures*sizeof(float));
+	
+#ifdef PRINT_LOSS
+	cout << "Initial loss: " << Loss(type, xFinal, lambda, args) << endl;
+#endif
+#ifdef PRINT_ACCURACY
+	cout << "Initial accuracy: " << Accuracy(type, xFinal, args) << " corrects out of " << GetNumSamples(args) << endl;
+#endif
+
+	float* transformedColumn1 = nullptr;
+	float* transformedColumn2 = nullptr;
+	if (useEncrypted && useCompressed) {
+		// A decrypted compressed minibatch can take more words than it has samples
+		transformedColumn1 = m_scratchPools[0].Get(scratchColumn1, (numMinibatchesAtATime-1)*minibatchSize + MaxCompressedMinibatchWords(minibatchSize));
+		transformedColumn2 = m_scratchPools[0].Get(scratchColumn2, numMinibatchesAtATime*minibatchSize);
+	}
+	else if ( numMinibatchesAtATime > 1 || m_cstore->IsOutOfCore() ) {
+		transformedColumn2 = m_scratchPools[0].Get(scratchColumn2, numMinibatchesAtATime*minibatchSize);
+	}
+	m_cstore->SetReadAheadOrder(minibatchMajor, minibatchSize);
+
+	float scaledStepSize = stepSize/minibatchSize;
+	float scaledLambda = stepSize*lambda;
+	uint32_t epoch_index = 0;
+	for(uint32_t epoch = 0; epoch < numEpochs + (numEpochs/residualUpdatePeriod); epoch++) {
+
+		double decryptionTime = 0;
+		double decompressionTime = 0;
+		double dotTime = 0;
+		double residualUpdateTime = 0;
+		double start = get_time();
+
+		for (uint32_t k = 0; k < numMinibatches/numMinibatchesAtATime; k++) {
+
+			if (numMinibatchesAtATime > 1) {
+				uint32_t m[numMinibatchesAtATime];
+				for (uint32_t l = 0; l < numMinibatchesAtATime; l++) {
+					m[l] = GetMinibatchIndex(args, l*(numMinibatches/numMinibatchesAtATime) + k, minibatchSize);
+				}
+				for (uint32_t j = 0; j < m_cstore->m_numFeatures; j++) {
+
+					m_cstore->ReturnDecompressedAndDecrypted(transformedColumn1, transformedColumn2, j, m, numMinibatchesAtATime, minibatchSize, useEncrypted, useCompressed, toIntegerScaler, decryptionTime, decompressionTime);
+
+					if ( (epoch+1)%(residualUpdatePeriod+1) == 0 ) {
+						UpdateResidual(residual, j, m, numMinibatchesAtATime, minibatchSize, transformedColumn2, args->m_normalization, xFinal);
+					}
+					else {
+						DoStep(type, residual, j, m, numMinibatchesAtATime, minibatchSize, m_cstore, transformedColumn2, args->m_normalization, x + k*m_cstore->m_numFeatures, scaledStepSize, scaledLambda, dotTime, residualUpdateTime);
+					}
+				}
+			}
+			else {
+				uint32_t m = GetMinibatchIndex(args, k, minibatchSize);
+
+				for (uint32_t j = 0; j < m_cstore->m_numFeatures; j++) {
+
+					m_cstore->ReturnDecompressedAndDecrypted(transformedColumn1, transformedColumn2, j, &m, 1, minibatchSize, useEncrypted, useCompressed, toIntegerScaler, decryptionTime, decompressionTime);
+
+					if ( (epoch+1)%(residualUpdatePeriod+1) == 0 ) {
+						UpdateResidual(residual, j, &m, 1, minibatchSize, transformedColumn2, args->m_normalization, xFinal);
+					}
+					else {
+						DoStep(type, residual, j, &m, 1, minibatchSize, m_cstore, transformedColumn2, args->m_normalization, x + k*m_cstore->m_numFeatures, scaledStepSize, scaledLambda, dotTime, residualUpdateTime);
+					}
+				}
+			}
+		}
+
+		if ( (epoch+1)%(residualUpdatePeriod+1) == 0 ) {
+			cout << "--> PERFORMED RESIDUAL UPDATE !!!" << endl;
+		}
+		else {
+			double timeStamp1 = get_time();
+			GetAveragedX(numMinibatches, numMinibatchesAtATime, m_cstore, xFinal, x);
+			double end = get_time();
+#ifdef PRINT_TIMING
+			cout << "decryptionTime: " << decryptionTime << endl;
+			cout << "decompressionTime: " << decompressionTime << endl;
+			cout << "dotTime: " << dotTime << endl;
+			cout << "residualUpdateTime: " << residualUpdateTime << endl;
+			cout << "x_average_time: " << end-timeStamp1 << endl;
+			cout << "Time for one epoch: " << end-start << endl;
+#endif
+			if (xHistory != nullptr) {
+				for (uint32_t j = 0; j < m_cstore->m_numFeatures; j++) {
+					xHistory[epoch_index*m_cstore->m_numFeatures + j] = xFinal[j];
+				}
+				epoch_index++;
+			}
+			else {
+#ifdef PRINT_LOSS
+				cout << Loss(type, xFinal, lambda, args) << endl;
+#endif
+#ifdef PRINT_ACCURACY
+				cout << Accuracy(type, xFinal, args) << " corrects out of " << GetNumSamples(args) << endl;
+#endif
+			}
+		}
+	}
+}
+
+#ifdef AVX2
+void ColumnML::AVX_SCD(
+		ModelType type,
+		float* xHistory, 
+		uint32_t numEpochs, 
+		uint32_t minibatchSize, 
+		float stepSize, 
+		float lambda, 
+		uint32_t residualUpdatePeriod, 
+		bool useEncrypted, 
+		bool useCompressed, 
+		uint32_t toIntegerScaler,
+		AdditionalArguments* args)
+{
+	if (minibatchSize%8 > 0) {
+		cout << "For AVX minibatchSize%8 must be 0!" << endl;
+		exit(1);
+	}
+
+	if (m_cstore->IsSparse() && (useEncrypted || useCompressed)) {
+		cout << "Sparse samples can not be used compressed or encrypted!" << endl;
+		exit(1);
+	}
+	m_cstore->SetSparseMinibatchSize(minibatchSize);
+	m_cstore->CheckLayoutMinibatchSize(minibatchSize);
+	CheckMinibatchAlignment(args, minibatchSize, "AVX_SCD");
+	CheckRunColumns(m_cstore, useCompressed, "AVX_SCD");
+	ColumnKernel kernel = SelectColumnKernel(m_cstore, useEncrypted, useCompressed);
+	if (kernel != denseKernel && kernel != dictionaryKernel && kernel != compressedKernel) {
+		CheckNoNormalization(args, "AVX_SCD on sparse, reduced precision or quantized samples");
+	}
+
+	cout << "AVX_SCD ---------------------------------------" << endl;
+	uint32_t numMinibatches = GetNumSamples(args)/minibatchSize;
+	cout << "numMinibatches: " << numMinibatches << endl;
+	uint32_t rest = GetNumSamples(args) - numMinibatches*minibatchSize;
+	cout << "rest: " << rest << endl;
+
+	// Indexed like the samples of the store
+	uint32_t residualSize = GetResidualSize(args, m_cstore->m_numSamples);
+	float* residual = m_scratchPools[0].Get(scratchResidual, residualSize);
+	memset(residual, 0, residualSize*sizeof(float));
+	float* x = m_scratchPools[0].Get(scratchX, numMinibatches*m_cstore->m_numFeatures);
+	memset(x, 0, numMinibatches*m_cstore->m_numFeatures*sizeof(float));
+	float* xFinal = m_scratchPools[0].Get(scratchXFinal, m_cstore->m_numFeatures);
+	memset(xFinal, 0, m_cstore->m_numFeatures*sizeof(float));
+
+#ifdef PRINT_LOSS
+	cout << "Initial loss: " << Loss(type, xFinal, lambda, args) << endl;
 #endif
 #ifdef PRINT_ACCURACY
-	cout << "Initial accuracy: " << Accuracy(type, xFinal, args) << " corrects out of " << args->m_numSamples << endl;
+	cout << "Initial accuracy: " << Accuracy(type, xFinal, args) << " corrects out of " << GetNumSamples(args) << endl;
 #endif
 
 	float* transformedColumn1 = nullptr;
 	float* transformedColumn2 = nullptr;
 	if (useEncrypted && useCompressed) {
-		transformedColumn1 = (float*)aligned_alloc(64, minibatchSize*sizeof(float));
-		transformedColumn2 = (float*)aligned_alloc(64, minibatchSize*sizeof(float));
+		transformedColumn1 = m_scratchPools[0].Get(scratchColumn1, MaxCompressedMinibatchWords(minibatchSize));
+		transformedColumn2 = m_scratchPools[0].Get(scratchColumn2, minibatchSize);
 	}
-	else if (useEncrypted || useCompressed) {
-		transformedColumn2 = (float*)aligned_alloc(64, minibatchSize*sizeof(float));
+	else if (useEncrypted || useCompressed || m_cstore->IsOutOfCore()) {
+		transformedColumn2 = m_scratchPools[0].Get(scratchColumn2, minibatchSize);
 	}
+	m_cstore->SetReadAheadOrder(minibatchMajor, minibatchSize);
 
 	float scaledStepSize = -stepSize/(float)minibatchSize;
 	float scaledLambda = -stepSize*lambda;
@@ -1152,7 +2261,8 @@ void ColumnML::AVX_SCD(
 		__m256 AVX_samples;
 		__m256 AVX_labels;
 
-		for (uint32_t m = 0; m < numMinibatches; m++) {
+		for (uint32_t k = 0; k < numMinibatches; k++) {
+			uint32_t m = GetMinibatchIndex(args, k, minibatchSize);
 			for (uint32_t j = 0; j < m_cstore->m_numFeatures; j++) {
 
 #ifdef SCD_SHUFFLE
@@ -1163,26 +2273,28 @@ void ColumnML::AVX_SCD(
 				uint32_t coordinate = j;
 #endif
 
-				m_cstore->ReturnDecompressedAndDecrypted(transformedColumn1, transformedColumn2, coordinate, &m, 1, minibatchSize, useEncrypted, useCompressed, toIntegerScaler, decryptionTime, decompressionTime);
+				if (!m_cstore->IsRunColumn(coordinate)) {
+					m_cstore->ReturnDecompressedAndDecrypted(transformedColumn1, transformedColumn2, coordinate, &m, 1, minibatchSize, useEncrypted, useCompressed, toIntegerScaler, decryptionTime, decompressionTime, kernel != compressedKernel);
+				}
 
 				if ( (epoch+1)%(residualUpdatePeriod+1) == 0 ) {
-					AVX_UpdateResidual(residual, coordinate, m, minibatchSize, transformedColumn2, xFinal);
+					AVX_ColumnUpdateResidual(kernel, residual, coordinate, m, minibatchSize, m_cstore, transformedColumn2, args->m_normalization, toIntegerScaler, xFinal);
 				}
 				else {
-					float step = AVX_GetStep(type, residual, j, m, minibatchSize, m_cstore, transformedColumn2, scaledStepSize, dotTime);
+					float step = AVX_ColumnGetStep(kernel, type, residual, coordinate, m, minibatchSize, m_cstore, transformedColumn2, args->m_normalization, toIntegerScaler, scaledStepSize, dotTime);
 
-					if (x[m*m_cstore->m_numFeatures + coordinate] + step > -scaledLambda) {
+					if (x[k*m_cstore->m_numFeatures + coordinate] + step > -scaledLambda) {
 						step += scaledLambda;
 					}
-					else if (x[m*m_cstore->m_numFeatures + coordinate] + step < scaledLambda) {
+					else if (x[k*m_cstore->m_numFeatures + coordinate] + step < scaledLambda) {
 						step -= scaledLambda;
 					}
 					else {
-						step = -x[m*m_cstore->m_numFeatures + coordinate];
+						step = -x[k*m_cstore->m_numFeatures + coordinate];
 					}
-					x[m*m_cstore->m_numFeatures + coordinate] += step;
+					x[k*m_cstore->m_numFeatures + coordinate] += step;
 
-					AVX_ApplyStep(step, residual, m, minibatchSize, transformedColumn2, residualUpdateTime);
+					AVX_ColumnApplyStep(kernel, step, residual, coordinate, m, minibatchSize, m_cstore, transformedColumn2, args->m_normalization, residualUpdateTime);
 				}
 			}
 		}
@@ -1217,22 +2329,11 @@ void ColumnML::AVX_SCD(
 				cout << Loss(type, xFinal, lambda, args) << endl;
 #endif
 #ifdef PRINT_ACCURACY
-				cout << Accuracy(type, xFinal, args) << " corrects out of " << args->m_numSamples << endl;
+				cout << Accuracy(type, xFinal, args) << " corrects out of " << GetNumSamples(args) << endl;
 #endif
 			}
 		}
 	}
-
-	if (useEncrypted && useCompressed) {
-		free(transformedColumn1);
-		free(transformedColumn2);
-	}
-	else if (useEncrypted || useCompressed) {
-		free(transformedColumn2);
-	}
-	free(x);
-	free(xFinal);
-	free(residual);
 }
 
 typedef struct {
@@ -1253,6 +2354,8 @@ typedef struct {
 	uint32_t m_toIntegerScaler;
 	AdditionalArguments* m_args;
 	uint32_t m_numThreads;
+	ColumnKernel m_kernel;
+	bool m_cacheDecodedColumns;
 
 	float* m_x;
 	float* m_xFinal;
@@ -1261,6 +2364,8 @@ typedef struct {
 	uint32_t m_startingBatch;
 	uint32_t m_numBatchesToProcess;
 	uint32_t m_numMinibatches;
+	uint32_t m_numaNode;
+	bool m_bindToNumaNode;
 	
 	double m_decryptionTime;
 	double m_decompressionTime;
@@ -1274,14 +2379,36 @@ void* batchThread(void* args) {
 
 	ColumnStore* cstore = r->m_obj->m_cstore;
 
+	// This thread's minibatch range of the columns, residual and x lives on its own node.
+	// The residual and x slices are first touched here, the columns were allocated by the loader.
+	// Binding is only done for ranges, where the minibatches of a thread are contiguous.
+	uint32_t firstMinibatch = GetMinibatchIndex(r->m_args, r->m_startingBatch, r->m_minibatchSize);
+	float* xSlice = r->m_x + (uint64_t)r->m_startingBatch*cstore->m_numFeatures;
+	uint64_t xSliceSize = (uint64_t)r->m_numBatchesToProcess*cstore->m_numFeatures*sizeof(float);
+	if (r->m_bindToNumaNode) {
+		NumaTopology::BindToNode(r->m_residual + (uint64_t)firstMinibatch*r->m_minibatchSize, (uint64_t)r->m_numBatchesToProcess*r->m_minibatchSize*sizeof(float), r->m_numaNode);
+		NumaTopology::BindToNode(xSlice, xSliceSize, r->m_numaNode);
+		cstore->BindMinibatchesToNode(firstMinibatch, r->m_numBatchesToProcess, r->m_minibatchSize, r->m_numaNode, r->m_useEncrypted, r->m_useCompressed);
+	}
+	for (uint32_t k = r->m_startingBatch; k < r->m_startingBatch + r->m_numBatchesToProcess; k++) {
+		memset(r->m_residual + (uint64_t)GetMinibatchIndex(r->m_args, k, r->m_minibatchSize)*r->m_minibatchSize, 0, r->m_minibatchSize*sizeof(float));
+	}
+	memset(xSlice, 0, xSliceSize);
+
 	float* transformedColumn1 = nullptr;
 	float* transformedColumn2 = nullptr;
 	if (r->m_useEncrypted && r->m_useCompressed) {
-		transformedColumn1 = (float*)aligned_alloc(64, r->m_minibatchSize*sizeof(float));
-		transformedColumn2 = (float*)aligned_alloc(64, r->m_minibatchSize*sizeof(float));
+		transformedColumn1 = r->m_obj->m_scratchPools[r->m_tid].Get(scratchColumn1, MaxCompressedMinibatchWords(r->m_minibatchSize));
+		transformedColumn2 = r->m_obj->m_scratchPools[r->m_tid].Get(scratchColumn2, r->m_minibatchSize);
 	}
-	else if (r->m_useEncrypted || r->m_useCompressed) {
-		transformedColumn2 = (float*)aligned_alloc(64, r->m_minibatchSize*sizeof(float));
+	else if (r->m_useEncrypted || r->m_useCompressed || cstore->IsOutOfCore()) {
+		transformedColumn2 = r->m_obj->m_scratchPools[r->m_tid].Get(scratchColumn2, r->m_minibatchSize);
+	}
+	// Real SCD: the current feature over all of this thread's minibatches, decoded in the gradient
+	// pass and read again by the apply pass
+	float* decodedColumns = nullptr;
+	if (r->m_cacheDecodedColumns) {
+		decodedColumns = r->m_obj->m_scratchPools[r->m_tid].Get(scratchDecodedColumns, (uint64_t)r->m_numBatchesToProcess*r->m_minibatchSize);
 	}
 
 	double start, end, epochTimes;
@@ -1318,10 +2445,17 @@ void* batchThread(void* args) {
 			for (uint32_t j = 0; j < cstore->m_numFeatures; j++) {
 				r->m_stepsFromThreads[r->m_tid] = 0;
 				pthread_barrier_wait(r->m_barrier);
-				for (uint32_t m = r->m_startingBatch; m < r->m_startingBatch + r->m_numBatchesToProcess; m++) {
-					cstore->ReturnDecompressedAndDecrypted(transformedColumn1, transformedColumn2, j, &m, 1, r->m_minibatchSize, r->m_useEncrypted, r->m_useCompressed, r->m_toIntegerScaler, r->m_decryptionTime, r->m_decompressionTime);
+				for (uint32_t k = r->m_startingBatch; k < r->m_startingBatch + r->m_numBatchesToProcess; k++) {
+					uint32_t m = GetMinibatchIndex(r->m_args, k, r->m_minibatchSize);
+					float* column = transformedColumn2;
+					if (decodedColumns != nullptr) {
+						column = decodedColumns + (uint64_t)(k - r->m_startingBatch)*r->m_minibatchSize;
+					}
+					if (!cstore->IsRunColumn(j)) {
+						cstore->ReturnDecompressedAndDecrypted(transformedColumn1, column, j, &m, 1, r->m_minibatchSize, r->m_useEncrypted, r->m_useCompressed, r->m_toIntegerScaler, r->m_decryptionTime, r->m_decompressionTime, r->m_kernel != compressedKernel);
+					}
 
-					float step = AVX_GetStep(r->m_type, r->m_residual, j, m, r->m_minibatchSize, cstore, transformedColumn2, scaledStepSize, r->m_dotTime);
+					float step = AVX_ColumnGetStep(r->m_kernel, r->m_type, r->m_residual, j, m, r->m_minibatchSize, cstore, column, r->m_args->m_normalization, r->m_toIntegerScaler, scaledStepSize, r->m_dotTime);
 					r->m_stepsFromThreads[r->m_tid] += step;
 				}
 				
@@ -1348,11 +2482,21 @@ void* batchThread(void* args) {
 				}
 				pthread_barrier_wait(r->m_barrier);
 
-				for (uint32_t m = r->m_startingBatch; m < r->m_startingBatch + r->m_numBatchesToProcess; m++) {
+				for (uint32_t k = r->m_startingBatch; k < r->m_startingBatch + r->m_numBatchesToProcess; k++) {
+					uint32_t m = GetMinibatchIndex(r->m_args, k, r->m_minibatchSize);
 
-					cstore->ReturnDecompressedAndDecrypted(transformedColumn1, transformedColumn2, j, &m, 1, r->m_minibatchSize, r->m_useEncrypted, r->m_useCompressed, r->m_toIntegerScaler, r->m_decryptionTime, r->m_decompressionTime);
+					float* column = transformedColumn2;
+					if (decodedColumns != nullptr) {
+						column = decodedColumns + (uint64_t)(k - r->m_startingBatch)*r->m_minibatchSize;
+					}
+					else {
+						// The get steps of the other minibatches ran in between, so also compressed columns are decoded again here
+						if (!cstore->IsRunColumn(j)) {
+							cstore->ReturnDecompressedAndDecrypted(transformedColumn1, column, j, &m, 1, r->m_minibatchSize, r->m_useEncrypted, r->m_useCompressed, r->m_toIntegerScaler, r->m_decryptionTime, r->m_decompressionTime);
+						}
+					}
 
-					AVX_ApplyStep(r->m_stepsFromThreads[r->m_tid], r->m_residual, m, r->m_minibatchSize, transformedColumn2, r->m_residualUpdateTime);
+					AVX_ColumnApplyStep(r->m_kernel, r->m_stepsFromThreads[r->m_tid], r->m_residual, j, m, r->m_minibatchSize, cstore, column, r->m_args->m_normalization, r->m_residualUpdateTime);
 				}
 			}
 			if (r->m_tid == 0) {
@@ -1371,22 +2515,26 @@ void* batchThread(void* args) {
 					cout << r->m_obj->Loss(r->m_type, r->m_xFinal, r->m_lambda, r->m_args) << endl;
 #endif
 #ifdef PRINT_ACCURACY
-					cout << r->m_obj->Accuracy(r->m_type, r->m_xFinal, r->m_args) << " corrects out of " << cstore->m_numSamples << endl;
+					cout << r->m_obj->Accuracy(r->m_type, r->m_xFinal, r->m_args) << " corrects out of " << GetNumSamples(r->m_args) << endl;
 #endif
 				}
 			}
 		}
 		else {
 			if ( (epoch+1)%(r->m_residualUpdatePeriod+1) == 0 ) {
-				for (uint32_t m = r->m_startingBatch; m < r->m_startingBatch + r->m_numBatchesToProcess; m++) {
+				for (uint32_t k = r->m_startingBatch; k < r->m_startingBatch + r->m_numBatchesToProcess; k++) {
+					uint32_t m = GetMinibatchIndex(r->m_args, k, r->m_minibatchSize);
 					for (uint32_t j = 0; j < cstore->m_numFeatures; j++) {
-						cstore->ReturnDecompressedAndDecrypted(transformedColumn1, transformedColumn2, j, &m, 1, r->m_minibatchSize, r->m_useEncrypted, r->m_useCompressed, r->m_toIntegerScaler, r->m_decryptionTime, r->m_decompressionTime);
-						AVX_UpdateResidual(r->m_residual, j, m, r->m_minibatchSize, transformedColumn2, r->m_xFinal);
+						if (!cstore->IsRunColumn(j)) {
+							cstore->ReturnDecompressedAndDecrypted(transformedColumn1, transformedColumn2, j, &m, 1, r->m_minibatchSize, r->m_useEncrypted, r->m_useCompressed, r->m_toIntegerScaler, r->m_decryptionTime, r->m_decompressionTime, r->m_kernel != compressedKernel);
+						}
+						AVX_ColumnUpdateResidual(r->m_kernel, r->m_residual, j, m, r->m_minibatchSize, cstore, transformedColumn2, r->m_args->m_normalization, r->m_toIntegerScaler, r->m_xFinal);
 					}
 				}
 			}
 			else {
-				for (uint32_t m = r->m_startingBatch; m < r->m_startingBatch + r->m_numBatchesToProcess; m++) {
+				for (uint32_t k = r->m_startingBatch; k < r->m_startingBatch + r->m_numBatchesToProcess; k++) {
+					uint32_t m = GetMinibatchIndex(r->m_args, k, r->m_minibatchSize);
 					for (uint32_t j = 0; j < cstore->m_numFeatures; j++) {
 #ifdef SCD_SHUFFLE
 						uint32_t rand = 0;
@@ -1395,22 +2543,24 @@ void* batchThread(void* args) {
 #else
 						uint32_t coordinate = j;
 #endif
-						cstore->ReturnDecompressedAndDecrypted(transformedColumn1, transformedColumn2, coordinate, &m, 1, r->m_minibatchSize, r->m_useEncrypted, r->m_useCompressed, r->m_toIntegerScaler, r->m_decryptionTime, r->m_decompressionTime);
+						if (!cstore->IsRunColumn(coordinate)) {
+							cstore->ReturnDecompressedAndDecrypted(transformedColumn1, transformedColumn2, coordinate, &m, 1, r->m_minibatchSize, r->m_useEncrypted, r->m_useCompressed, r->m_toIntegerScaler, r->m_decryptionTime, r->m_decompressionTime, r->m_kernel != compressedKernel);
+						}
 						
-						float step = AVX_GetStep(r->m_type, r->m_residual, coordinate, m, r->m_minibatchSize, cstore, transformedColumn2, scaledStepSize, r->m_dotTime);
+						float step = AVX_ColumnGetStep(r->m_kernel, r->m_type, r->m_residual, coordinate, m, r->m_minibatchSize, cstore, transformedColumn2, r->m_args->m_normalization, r->m_toIntegerScaler, scaledStepSize, r->m_dotTime);
 						
-						if (r->m_x[m*cstore->m_numFeatures + coordinate] + step > -scaledLambda) {
+						if (r->m_x[k*cstore->m_numFeatures + coordinate] + step > -scaledLambda) {
 							step += scaledLambda;
 						}
-						else if (r->m_x[m*cstore->m_numFeatures + coordinate] + step < scaledLambda) {
+						else if (r->m_x[k*cstore->m_numFeatures + coordinate] + step < scaledLambda) {
 							step -= scaledLambda;
 						}
 						else {
-							step = -r->m_x[m*cstore->m_numFeatures + coordinate];
+							step = -r->m_x[k*cstore->m_numFeatures + coordinate];
 						}
 
-						r->m_x[m*cstore->m_numFeatures + coordinate] += step;
-						AVX_ApplyStep(step, r->m_residual, m, r->m_minibatchSize, transformedColumn2, r->m_residualUpdateTime);	
+						r->m_x[k*cstore->m_numFeatures + coordinate] += step;
+						AVX_ColumnApplyStep(r->m_kernel, step, r->m_residual, coordinate, m, r->m_minibatchSize, cstore, transformedColumn2, r->m_args->m_normalization, r->m_residualUpdateTime);	
 					}
 				}
 			}
@@ -1445,7 +2595,7 @@ void* batchThread(void* args) {
 						cout << r->m_obj->Loss(r->m_type, r->m_xFinal, r->m_lambda, r->m_args) << endl;
 #endif
 #ifdef PRINT_ACCURACY
-						cout << r->m_obj->Accuracy(r->m_type, r->m_xFinal, r->m_args) << " corrects out of " << cstore->m_numSamples << endl;
+						cout << r->m_obj->Accuracy(r->m_type, r->m_xFinal, r->m_args) << " corrects out of " << GetNumSamples(r->m_args) << endl;
 #endif
 					}
 				}
@@ -1457,14 +2607,6 @@ void* batchThread(void* args) {
 		cout << "avg epoch time: " << r->m_averageEpochTime << endl;
 	}
 
-	if (r->m_useEncrypted && r->m_useCompressed) {
-		free(transformedColumn1);
-		free(transformedColumn2);
-	}
-	else if (r->m_useEncrypted || r->m_useCompressed) {
-		free(transformedColumn2);
-	}
-
 	return nullptr;
 }
 
@@ -1491,6 +2633,19 @@ double ColumnML::AVXmulti_SCD (
 		cout << "numThreads: " << numThreads << " is not possible" << endl;
 		exit(1);
 	}
+	if (m_cstore->IsSparse() && (useEncrypted || useCompressed)) {
+		cout << "Sparse samples can not be used compressed or encrypted!" << endl;
+		exit(1);
+	}
+	m_cstore->SetSparseMinibatchSize(minibatchSize);
+	m_cstore->CheckLayoutMinibatchSize(minibatchSize);
+	CheckMinibatchAlignment(args, minibatchSize, "AVXmulti_SCD");
+	CheckRunColumns(m_cstore, useCompressed, "AVXmulti_SCD");
+	ColumnKernel kernel = SelectColumnKernel(m_cstore, useEncrypted, useCompressed);
+	if (kernel != denseKernel && kernel != dictionaryKernel && kernel != compressedKernel) {
+		CheckNoNormalization(args, "AVXmulti_SCD on sparse, reduced precision or quantized samples");
+	}
+
 	cout << "AVXmulti_SCD with " << numThreads << " threads running..." << endl;
 	cout << "useEncrypted: " << ((useEncrypted) ? 1 : 0) << endl;
 	cout << "useCompressed: " << ((useCompressed) ? 1 : 0) << endl;
@@ -1500,37 +2655,54 @@ double ColumnML::AVXmulti_SCD (
 	pthread_t threads[MAX_NUM_THREADS];
 	batch_thread_data thread_args[MAX_NUM_THREADS];
 	cpu_set_t set;
+	NumaTopology topology;
+	bool bindToNumaNode = topology.GetNumNodes() > 1 && !m_cstore->IsOutOfCore() && args->m_view == nullptr;
+	cout << "NUMA nodes: " << topology.GetNumNodes() << endl;
 
-	float* residual = (float*)aligned_alloc(64, args->m_numSamples*sizeof(float));
-	memset(residual, 0, args->m_numSamples*sizeof(float));
-
-	uint32_t numMinibatches = args->m_numSamples/minibatchSize;
+	uint32_t numMinibatches = GetNumSamples(args)/minibatchSize;
 	cout << "numMinibatches: " << numMinibatches << endl;
-	uint32_t rest = args->m_numSamples - numMinibatches*minibatchSize;
+	uint32_t rest = GetNumSamples(args) - numMinibatches*minibatchSize;
 	cout << "rest: " << rest << endl;
 
-	float* x = (float*)aligned_alloc(64, numMinibatches*m_cstore->m_numFeatures*sizeof(float));
-	memset(x, 0, numMinibatches*m_cstore->m_numFeatures*sizeof(float));
+	// Indexed like the samples of the store. The threads zero their own minibatches of
+	// residual and x, see batchThread.
+	uint32_t residualSize = GetResidualSize(args, m_cstore->m_numSamples);
+	float* residual = m_scratchPools[0].Get(scratchResidual, residualSize);
+	if (args->m_view == nullptr) {
+		memset(residual + args->m_firstSample + numMinibatches*minibatchSize, 0, rest*sizeof(float));
+	}
+
+	float* x = m_scratchPools[0].Get(scratchX, numMinibatches*m_cstore->m_numFeatures);
 	float stepsFromThreads[MAX_NUM_THREADS];
 
-	float* xFinal= (float*)aligned_alloc(64, m_cstore->m_numFeatures*sizeof(float));
+	float* xFinal= m_scratchPools[0].Get(scratchXFinal, m_cstore->m_numFeatures);
 	memset(xFinal, 0, m_cstore->m_numFeatures*sizeof(float));
 
 #ifdef PRINT_LOSS
-	cout << "Initial loss: " << Loss(type, x, lambda, args) << endl;
+	cout << "Initial loss: " << Loss(type, xFinal, lambda, args) << endl;
 #endif
 #ifdef PRINT_ACCURACY
-	cout << "Initial accuracy: " << Accuracy(type, x, args) << " corrects out of " << args->m_numSamples << endl;
+	cout << "Initial accuracy: " << Accuracy(type, xFinal, args) << " corrects out of " << GetNumSamples(args) << endl;
 #endif
 
+	// Real SCD walks each column over all minibatches, pSCD walks each minibatch over all columns
+	m_cstore->SetReadAheadOrder(doRealSCD ? featureMajor : minibatchMajor, minibatchSize);
+
+	// Real SCD reads every feature twice per epoch. Columns that have to be decrypted, decompressed
+	// or read from disk are kept decoded in between, if the largest thread's share fits.
+	uint64_t maxDecodedColumnsSize = (uint64_t)(numMinibatches/numThreads + (numMinibatches%numThreads > 0))*minibatchSize*sizeof(float);
+	bool cacheDecodedColumns = doRealSCD
+		&& (useEncrypted || useCompressed || m_cstore->IsOutOfCore())
+		&& (kernel == denseKernel || kernel == compressedKernel)
+		&& maxDecodedColumnsSize <= DECODED_COLUMN_CACHE_MAX_BYTES;
+	if (doRealSCD) {
+		cout << "cacheDecodedColumns: " << ((cacheDecodedColumns) ? 1 : 0) << endl;
+	}
+
 	uint32_t startingBatch = 0;
 	pthread_barrier_init(&barrier, NULL, numThreads);
 	pthread_attr_init(&attr);
-	CPU_ZERO(&set);
 	for (uint32_t n = 0; n < numThreads; n++) {
-		CPU_SET(n, &set);
-		pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &set);
-
 		thread_args[n].m_barrier = &barrier;
 		thread_args[n].m_tid = n;
 		thread_args[n].m_obj = this;
@@ -1548,6 +2720,8 @@ double ColumnML::AVXmulti_SCD (
 		thread_args[n].m_toIntegerScaler = toIntegerScaler;
 		thread_args[n].m_args = args;
 		thread_args[n].m_numThreads = numThreads;
+		thread_args[n].m_kernel = kernel;
+		thread_args[n].m_cacheDecodedColumns = cacheDecodedColumns;
 
 		thread_args[n].m_x = x;
 		thread_args[n].m_xFinal = xFinal;
@@ -1563,11 +2737,16 @@ double ColumnML::AVXmulti_SCD (
 			thread_args[n].m_numBatchesToProcess = temp;
 		}
 		thread_args[n].m_numMinibatches = numMinibatches;
+		thread_args[n].m_numaNode = topology.GetThreadNode(n, numThreads);
+		thread_args[n].m_bindToNumaNode = bindToNumaNode;
 
 		startingBatch += thread_args[n].m_numBatchesToProcess;
-		cout << "Thread " << n << ", numBatchesToProcess: " << thread_args[n].m_numBatchesToProcess << endl;
+		cout << "Thread " << n << ", numBatchesToProcess: " << thread_args[n].m_numBatchesToProcess << ", CPU: " << topology.GetThreadCpu(n, numThreads) << ", node: " << thread_args[n].m_numaNode << endl;
 	}
 	for (uint32_t n = 0; n < numThreads; n++) {
+		CPU_ZERO(&set);
+		CPU_SET(topology.GetThreadCpu(n, numThreads), &set);
+		pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &set);
 		pthread_create(&threads[n], &attr, batchThread, (void*)&thread_args[n]);
 	}
 	for (uint32_t n = 0; n < numThreads; n++) {
@@ -1589,10 +2768,6 @@ double ColumnML::AVXmulti_SCD (
 	cout << "dotTime: " << dotTime/numThreads << endl;
 	cout << "residualUpdateTime: " << residualUpdateTime/numThreads << endl;
 
-	free(x);
-	free(xFinal);
-	free(residual);
-
 	return thread_args[0].m_averageEpochTime;
 }
 #endif
\ No newline at end of file
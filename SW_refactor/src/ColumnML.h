@@ -22,9 +22,11 @@
 #include <limits.h>
 #include <iostream>
 #include <cmath>
+#include <algorithm>
 #include <pthread.h>
 
 #include "ColumnStore.h"
+#include "DatasetView.h"
 
 #ifdef AVX2
 #include "immintrin.h"
@@ -40,8 +42,15 @@ using namespace std;
 // #define SCD_SHUFFLE
 
 #define MAX_NUM_THREADS 14
+// Samples the compressed SCD kernels decode ahead of the gradient, small enough to stay in L1
+#define COMPRESSED_CHUNK_SIZE 256
+// Per thread limit of the decoded columns real SCD keeps between its two passes over a feature,
+// above it the columns are decoded again for the second pass
+#define DECODED_COLUMN_CACHE_MAX_BYTES (64ULL << 20)
 
 enum ModelType {l2svm, logreg, linreg};
+// Representation the per-column SCD kernels read
+enum ColumnKernel {denseKernel, sparseKernel, halfKernel, quantizedKernel, dictionaryKernel, compressedKernel};
 
 struct AdditionalArguments
 {
@@ -59,8 +68,64 @@ struct AdditionalArguments
 	float m_falseLabel;
 
 	bool m_constantStepSize;
+
+	// Samples to work on instead of the range above, not owned
+	DatasetView* m_view = nullptr;
+
+	// Normalization applied to the raw samples as they are read, not owned
+	ColumnNormalization* m_normalization = nullptr;
 };
 
+// Number of samples the solvers and Loss/Accuracy work on
+static inline uint32_t GetNumSamples(AdditionalArguments* args) {
+	return (args->m_view != nullptr) ? args->m_view->m_numSamples : args->m_numSamples;
+}
+
+// Index in the store of sample i of args
+static inline uint32_t GetSampleIndex(AdditionalArguments* args, uint32_t i) {
+	return (args->m_view != nullptr) ? args->m_view->GetSample(i) : args->m_firstSample + i;
+}
+
+// Minibatch of the store that minibatch k of args is, for solvers walking whole minibatches
+static inline uint32_t GetMinibatchIndex(AdditionalArguments* args, uint32_t k, uint32_t minibatchSize) {
+	return GetSampleIndex(args, k*minibatchSize)/minibatchSize;
+}
+
+// Samples of the store the residual of a solver walking whole minibatches has to cover
+static inline uint32_t GetResidualSize(AdditionalArguments* args, uint32_t numStoreSamples) {
+	return (args->m_view != nullptr) ? numStoreSamples : args->m_firstSample + args->m_numSamples;
+}
+
+// Solvers walking whole minibatches need them to lie within the minibatches of the view or range
+static inline void CheckMinibatchAlignment(AdditionalArguments* args, uint32_t minibatchSize, const char* solver) {
+	if (minibatchSize == 1) {
+		return;
+	}
+	if (args->m_view != nullptr && (!args->m_view->IsMinibatchView() || args->m_view->m_minibatchSize%minibatchSize > 0)) {
+		cout << solver << " needs a minibatch view with a minibatch size that is a multiple of " << minibatchSize << "!" << endl;
+		exit(1);
+	}
+	if (args->m_view == nullptr && args->m_firstSample%minibatchSize > 0) {
+		cout << solver << " needs m_firstSample to be a multiple of " << minibatchSize << "!" << endl;
+		exit(1);
+	}
+}
+
+// Solvers that use the samples only as they are stored
+static inline void CheckNoNormalization(AdditionalArguments* args, const char* solver) {
+	if (args->m_normalization != nullptr) {
+		cout << solver << " can not apply a ColumnNormalization, normalize the samples with NormalizeSamples!" << endl;
+		exit(1);
+	}
+}
+
+// The run-length columns describe either the samples or the decoded compressed samples
+static inline void CheckRunColumns(ColumnStore* cstore, bool useCompressed, const char* solver) {
+	if (cstore->m_runStarts != nullptr && cstore->m_runsUseCompressed != useCompressed) {
+		cout << solver << (useCompressed ? " trains on compressed samples, call FindRunColumns with useCompressed!" : " trains on uncompressed samples, call FindRunColumns without useCompressed!") << endl;
+		exit(1);
+	}
+}
 
 struct tuple_t {
 	uint32_t index;
@@ -120,6 +185,9 @@ static void quicksort(tuple_t* base, uint32_t low, uint32_t high) {
 class ColumnML {
 public:
 	ColumnStore* m_cstore;
+	// Solver buffers, reused across calls. Thread n of a multithreaded solver uses pool n,
+	// the calling thread uses pool 0 for the buffers it shares with the threads.
+	ScratchPool m_scratchPools[MAX_NUM_THREADS];
 
 	ColumnML() {
 		m_cstore = new ColumnStore();
@@ -129,7 +197,8 @@ public:
 		delete m_cstore;
 	}
 
-	void WriteLogregPredictions(char* fileName, float* x);
+	// Applies normalization to the raw samples if given, otherwise m_samplesMin and m_samplesRange
+	void WriteLogregPredictions(char* fileName, float* x, ColumnNormalization* normalization = nullptr);
 	void LoadModel(char* fileName, float* x, uint32_t numFeatures) {
 		cout << "LoadModel from " << fileName << endl;
 		FILE* f = fopen(fileName, "r");
@@ -281,6 +350,26 @@ public:
 	}
 
 private:
+	// Dots of all samples in args for sparse and out-of-core stores, nullptr if the dense samples are in memory
+	float* getColumnwiseDots(float* x, AdditionalArguments* args);
+
+	// Model to take the dots of the raw samples with: x itself, or x with args->m_normalization
+	// folded in, in which case offset has to be added to every dot. Free with freeRawModel.
+	float* getRawModel(float* x, AdditionalArguments* args, float &offset) {
+		offset = 0;
+		if (args->m_normalization == nullptr) {
+			return x;
+		}
+		float* rawX = (float*)aligned_alloc(64, m_cstore->m_numFeatures*sizeof(float));
+		offset = args->m_normalization->FoldIntoModel(x, rawX);
+		return rawX;
+	}
+	void freeRawModel(float* rawX, float* x) {
+		if (rawX != x) {
+			free(rawX);
+		}
+	}
+
 	inline float getDot(float* x, uint32_t sampleIndex) {
 		float dot = 0.0;
 		for (uint32_t j = 0; j < m_cstore->m_numFeatures; j++) {
@@ -314,12 +403,34 @@ private:
 		return dot;
 	}
 
+	// 8 samples of feature j, in either layout, widened if the store holds reduced precision, quantized or dictionary encoded samples
+	inline __m256 AVX_loadSamples(uint32_t j, uint32_t sampleIndex) {
+		if (m_cstore->m_halfSamples != nullptr) {
+			return AVX_WidenSamples(m_cstore->m_halfSamples[j] + sampleIndex, m_cstore->m_samplesPrecision);
+		}
+		if (m_cstore->m_paxSamples != nullptr) {
+			return _mm256_load_ps(m_cstore->GetPaxSlice(j, sampleIndex/m_cstore->m_paxChunkSize) + sampleIndex%m_cstore->m_paxChunkSize);
+		}
+		if (m_cstore->m_quantizedSamples != nullptr) {
+			__m256 AVX_levels = _mm256_cvtepi32_ps(AVX_UnpackQuantized(m_cstore->m_quantizedSamples[j], sampleIndex, m_cstore->m_quantizedBits));
+			return _mm256_fmadd_ps(AVX_levels, _mm256_set1_ps(m_cstore->m_quantizedScale[j]), _mm256_set1_ps(m_cstore->m_quantizedMin[j]));
+		}
+		if (m_cstore->m_dictionaryCodes != nullptr) {
+			if (m_cstore->m_dictionaryCodes[j] == nullptr) {
+				return _mm256_load_ps(m_cstore->m_dictionaryPlain[j] + sampleIndex);
+			}
+			__m256i AVX_codes = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i*)(m_cstore->m_dictionaryCodes[j] + sampleIndex)));
+			return _mm256_i32gather_ps(m_cstore->m_dictionaryValues[j], AVX_codes, 4);
+		}
+		return _mm256_load_ps(m_cstore->m_samples[j] + sampleIndex);
+	}
+
 	inline __m256 AVX_verticalGetDot(float* x, uint32_t sampleIndex) {
 		__m256 AVX_dot = _mm256_set1_ps(0.0);
 		float dot[8];
 		for (uint32_t j = 0; j < m_cstore->m_numFeatures; j++) {
 			__m256 AVX_x = _mm256_set1_ps(x[j]);
-			__m256 AVX_samples = _mm256_load_ps(m_cstore->m_samples[j] + sampleIndex);
+			__m256 AVX_samples = AVX_loadSamples(j, sampleIndex);
 			AVX_dot = _mm256_fmadd_ps(AVX_x, AVX_samples, AVX_dot);
 		}
 		
@@ -18,6 +18,34 @@
 
 using namespace std;
 
+// Folds the min and max of count values into min and max
+static inline void AccumulateMinMax(const float* values, uint32_t count, float &min, float &max) {
+	uint32_t i = 0;
+#ifdef AVX2
+	if (count >= 8) {
+		__m256 AVX_min = _mm256_set1_ps(min);
+		__m256 AVX_max = _mm256_set1_ps(max);
+		for (; i + 8 <= count; i += 8) {
+			__m256 AVX_values = _mm256_loadu_ps(values + i);
+			AVX_min = _mm256_min_ps(AVX_min, AVX_values);
+			AVX_max = _mm256_max_ps(AVX_max, AVX_values);
+		}
+		float mins[8];
+		float maxs[8];
+		_mm256_storeu_ps(mins, AVX_min);
+		_mm256_storeu_ps(maxs, AVX_max);
+		for (uint32_t k = 0; k < 8; k++) {
+			min = (mins[k] < min) ? mins[k] : min;
+			max = (maxs[k] > max) ? maxs[k] : max;
+		}
+	}
+#endif
+	for (; i < count; i++) {
+		min = (values[i] < min) ? values[i] : min;
+		max = (values[i] > max) ? values[i] : max;
+	}
+}
+
 void ColumnStore::LoadLibsvmData(char* pathToFile, uint32_t numSamples, uint32_t numFeatures, bool samplesBiased) {
 	cout << "LoadLibsvmData is reading " << pathToFile << endl;
 
@@ -78,6 +106,467 @@ void ColumnStore::LoadLibsvmData(char* pathToFile, uint32_t numSamples, uint32_t
 	cout << "m_numFeatures: " << m_numFeatures << endl;
 }
 
+static inline bool IsBlank(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char* ParseUint(const char* p, const char* end, uint32_t &value) {
+	uint32_t result = 0;
+	while (p < end && *p >= '0' && *p <= '9') {
+		result = result*10 + (uint32_t)(*p - '0');
+		p++;
+	}
+	value = result;
+	return p;
+}
+
+static inline const char* ParseFloat(const char* p, const char* end, float &value) {
+	static const double powersOf10[23] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+	const char* start = p;
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = (*p == '-');
+		p++;
+	}
+
+	uint64_t mantissa = 0;
+	int32_t exponent = 0;
+	uint32_t numDigits = 0;
+	while (p < end && *p >= '0' && *p <= '9') {
+		if (numDigits < 19) {
+			mantissa = mantissa*10 + (uint64_t)(*p - '0');
+			numDigits += (mantissa > 0);
+		}
+		else {
+			exponent++;
+		}
+		p++;
+	}
+	if (p < end && *p == '.') {
+		p++;
+		while (p < end && *p >= '0' && *p <= '9') {
+			if (numDigits < 19) {
+				mantissa = mantissa*10 + (uint64_t)(*p - '0');
+				numDigits += (mantissa > 0);
+				exponent--;
+			}
+			p++;
+		}
+	}
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		p++;
+		bool negativeExponent = false;
+		if (p < end && (*p == '-' || *p == '+')) {
+			negativeExponent = (*p == '-');
+			p++;
+		}
+		uint32_t e = 0;
+		p = ParseUint(p, end, e);
+		exponent += negativeExponent ? -(int32_t)e : (int32_t)e;
+	}
+
+	if (p == start || (p < end && !IsBlank(*p) && *p != '\n' && *p != ':')) {
+		// Not a plain decimal number (e.g. nan, inf), let the C library deal with it
+		char temp[64];
+		const char* tokenEnd = start;
+		while (tokenEnd < end && !IsBlank(*tokenEnd) && *tokenEnd != '\n' && tokenEnd - start < 63) {
+			tokenEnd++;
+		}
+		memcpy(temp, start, tokenEnd - start);
+		temp[tokenEnd - start] = '\0';
+		value = strtof(temp, NULL);
+		return tokenEnd;
+	}
+
+	double result = (double)mantissa;
+	if (exponent < 0) {
+		result = (exponent >= -22) ? result/powersOf10[-exponent] : result*pow(10.0, exponent);
+	}
+	else if (exponent > 0) {
+		result = (exponent <= 22) ? result*powersOf10[exponent] : result*pow(10.0, exponent);
+	}
+	value = (float)(negative ? -result : result);
+	return p;
+}
+
+// Returns the start of the next line that contains a sample, or end
+static inline const char* SkipToSample(const char* p, const char* end) {
+	while (p < end && (IsBlank(*p) || *p == '\n')) {
+		p++;
+	}
+	return p;
+}
+
+typedef struct {
+	ColumnStore* m_cstore;
+	const char* m_begin;
+	const char* m_end;
+	uint32_t m_firstSample;
+	uint32_t m_numLines;
+
+	// LoadLibsvmDataSparse only: nonzeros of the chunk in file order and their count per column.
+	// Before the scatter pass m_columnNnz is turned into the write position of the chunk in each column.
+	uint32_t* m_columnNnz;
+	uint32_t* m_entryColumns;
+	uint32_t* m_entryRows;
+	float* m_entryValues;
+	uint64_t m_numEntries;
+	uint64_t m_entriesCapacity;
+
+	// LoadLibsvmDataParallel only: min, max and count of the values present in the chunk, per column
+	float* m_min;
+	float* m_max;
+	uint32_t* m_count;
+} libsvm_thread_data;
+
+static void* libsvmCountThread(void* args) {
+	libsvm_thread_data* r = (libsvm_thread_data*)args;
+
+	uint32_t numLines = 0;
+	const char* p = SkipToSample(r->m_begin, r->m_end);
+	while (p < r->m_end) {
+		numLines++;
+		const char* newLine = (const char*)memchr(p, '\n', r->m_end - p);
+		if (newLine == NULL) {
+			break;
+		}
+		p = SkipToSample(newLine + 1, r->m_end);
+	}
+	r->m_numLines = numLines;
+
+	return nullptr;
+}
+
+static void* libsvmParseThread(void* args) {
+	libsvm_thread_data* r = (libsvm_thread_data*)args;
+	ColumnStore* cstore = r->m_cstore;
+
+	bool sparse = (r->m_columnNnz != nullptr);
+
+	if (!sparse && r->m_firstSample < cstore->m_numSamples) {
+		uint32_t numSamplesToZero = r->m_numLines;
+		if (r->m_firstSample + numSamplesToZero > cstore->m_numSamples) {
+			numSamplesToZero = cstore->m_numSamples - r->m_firstSample;
+		}
+		// Sparse input: features not present in a line are 0
+		for (uint32_t j = 0; j < cstore->m_numFeatures; j++) {
+			memset(cstore->m_samples[j] + r->m_firstSample, 0, numSamplesToZero*sizeof(float));
+		}
+	}
+
+	uint32_t index = r->m_firstSample;
+	const char* end = r->m_end;
+	const char* p = SkipToSample(r->m_begin, end);
+	while (p < end && index < cstore->m_numSamples) {
+		float label;
+		p = ParseFloat(p, end, label);
+		cstore->m_labels[index] = label;
+
+		while (true) {
+			while (p < end && IsBlank(*p)) {
+				p++;
+			}
+			if (p >= end || *p == '\n') {
+				break;
+			}
+			uint32_t column;
+			p = ParseUint(p, end, column);
+			if (p >= end || *p != ':') {
+				cout << "LoadLibsvmDataParallel: malformed line at sample " << index << endl;
+				exit(1);
+			}
+			p++;
+			float value;
+			p = ParseFloat(p, end, value);
+
+			column = cstore->m_samplesBiased ? column : column - 1;
+			if (sparse) {
+				// Column 0 is the bias when biased, it is filled in later
+				if (column < cstore->m_numFeatures && !(cstore->m_samplesBiased && column == 0) && value != 0) {
+					if (r->m_numEntries == r->m_entriesCapacity) {
+						r->m_entriesCapacity = 2*r->m_entriesCapacity + 1024;
+						r->m_entryColumns = (uint32_t*)realloc(r->m_entryColumns, r->m_entriesCapacity*sizeof(uint32_t));
+						r->m_entryRows = (uint32_t*)realloc(r->m_entryRows, r->m_entriesCapacity*sizeof(uint32_t));
+						r->m_entryValues = (float*)realloc(r->m_entryValues, r->m_entriesCapacity*sizeof(float));
+					}
+					r->m_entryColumns[r->m_numEntries] = column;
+					r->m_entryRows[r->m_numEntries] = index;
+					r->m_entryValues[r->m_numEntries] = value;
+					r->m_numEntries++;
+					r->m_columnNnz[column]++;
+				}
+			}
+			else if (column < cstore->m_numFeatures) {
+				cstore->m_samples[column][index] = value;
+				r->m_min[column] = (value < r->m_min[column]) ? value : r->m_min[column];
+				r->m_max[column] = (value > r->m_max[column]) ? value : r->m_max[column];
+				r->m_count[column]++;
+			}
+		}
+		index++;
+		p = SkipToSample(p, end);
+	}
+
+	return nullptr;
+}
+
+// Splits the mmaped LibSVM file into line-aligned chunks and counts the lines in each one, returns the total
+static uint32_t SplitLibsvmFile(ColumnStore* cstore, const char* file, size_t fileSize, uint32_t numThreads, pthread_t* threads, libsvm_thread_data* thread_args) {
+	// Split the file into chunks, each chunk begins right after a new line
+	const char* fileEnd = file + fileSize;
+	const char* chunkBegin = file;
+	for (uint32_t n = 0; n < numThreads; n++) {
+		const char* chunkEnd = file + (fileSize/numThreads)*(n+1);
+		if (n == numThreads-1 || chunkEnd < chunkBegin) {
+			chunkEnd = (n == numThreads-1) ? fileEnd : chunkBegin;
+		}
+		else {
+			const char* newLine = (const char*)memchr(chunkEnd, '\n', fileEnd - chunkEnd);
+			chunkEnd = (newLine == NULL) ? fileEnd : newLine + 1;
+		}
+		thread_args[n].m_cstore = cstore;
+		thread_args[n].m_columnNnz = nullptr;
+		thread_args[n].m_numEntries = 0;
+		thread_args[n].m_min = nullptr;
+		thread_args[n].m_max = nullptr;
+		thread_args[n].m_count = nullptr;
+		thread_args[n].m_begin = chunkBegin;
+		thread_args[n].m_end = chunkEnd;
+		chunkBegin = chunkEnd;
+	}
+
+	// Pass 1: count lines per chunk to find out where each chunk starts writing
+	for (uint32_t n = 0; n < numThreads; n++) {
+		pthread_create(&threads[n], NULL, libsvmCountThread, (void*)&thread_args[n]);
+	}
+	for (uint32_t n = 0; n < numThreads; n++) {
+		pthread_join(threads[n], NULL);
+	}
+	uint32_t numLines = 0;
+	for (uint32_t n = 0; n < numThreads; n++) {
+		thread_args[n].m_firstSample = numLines;
+		numLines += thread_args[n].m_numLines;
+	}
+	return numLines;
+}
+
+void ColumnStore::LoadLibsvmDataParallel(char* pathToFile, uint32_t numSamples, uint32_t numFeatures, bool samplesBiased, uint32_t numThreads) {
+	cout << "LoadLibsvmDataParallel is reading " << pathToFile << " with " << numThreads << " threads" << endl;
+
+	double start = get_time();
+
+	int fd = open(pathToFile, O_RDONLY);
+	if (fd < 0) {
+		cout << "Unable to open file " << pathToFile << endl;
+		exit(1);
+	}
+	struct stat fileStat;
+	fstat(fd, &fileStat);
+	size_t fileSize = fileStat.st_size;
+
+	const char* file = (const char*)mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (file == MAP_FAILED) {
+		cout << "Unable to mmap file " << pathToFile << endl;
+		exit(1);
+	}
+	madvise((void*)file, fileSize, MADV_SEQUENTIAL);
+
+	m_samplesBiased = samplesBiased;
+	m_numSamples = numSamples;
+	m_numFeatures = m_samplesBiased ? numFeatures + 1 : numFeatures;
+
+	reallocData();
+
+	if (numThreads == 0) {
+		numThreads = 1;
+	}
+	pthread_t* threads = (pthread_t*)malloc(numThreads*sizeof(pthread_t));
+	libsvm_thread_data* thread_args = (libsvm_thread_data*)malloc(numThreads*sizeof(libsvm_thread_data));
+
+	uint32_t numLines = SplitLibsvmFile(this, file, fileSize, numThreads, threads, thread_args);
+	if (numLines < m_numSamples) {
+		cout << "File contains only " << numLines << " samples, the rest is set to 0" << endl;
+		for (uint32_t j = 0; j < m_numFeatures; j++) {
+			memset(m_samples[j] + numLines, 0, (m_numSamples - numLines)*sizeof(float));
+		}
+		memset(m_labels + numLines, 0, (m_numSamples - numLines)*sizeof(float));
+	}
+
+	// Pass 2: parse, every thread writes directly into its range of the columns
+	for (uint32_t n = 0; n < numThreads; n++) {
+		thread_args[n].m_min = (float*)malloc(m_numFeatures*sizeof(float));
+		thread_args[n].m_max = (float*)malloc(m_numFeatures*sizeof(float));
+		thread_args[n].m_count = (uint32_t*)calloc(m_numFeatures, sizeof(uint32_t));
+		for (uint32_t j = 0; j < m_numFeatures; j++) {
+			thread_args[n].m_min[j] = numeric_limits<float>::max();
+			thread_args[n].m_max[j] = -numeric_limits<float>::max();
+		}
+		pthread_create(&threads[n], NULL, libsvmParseThread, (void*)&thread_args[n]);
+	}
+	resetRunningMinMax();
+	uint64_t* counts = (uint64_t*)calloc(m_numFeatures, sizeof(uint64_t));
+	for (uint32_t n = 0; n < numThreads; n++) {
+		pthread_join(threads[n], NULL);
+		for (uint32_t j = 0; j < m_numFeatures; j++) {
+			m_runningMin[j] = (thread_args[n].m_min[j] < m_runningMin[j]) ? thread_args[n].m_min[j] : m_runningMin[j];
+			m_runningMax[j] = (thread_args[n].m_max[j] > m_runningMax[j]) ? thread_args[n].m_max[j] : m_runningMax[j];
+			counts[j] += thread_args[n].m_count[j];
+		}
+		free(thread_args[n].m_min);
+		free(thread_args[n].m_max);
+		free(thread_args[n].m_count);
+	}
+	// Samples without a value for a column hold a 0 there
+	for (uint32_t j = 0; j < m_numFeatures; j++) {
+		if (counts[j] < m_numSamples) {
+			m_runningMin[j] = (0 < m_runningMin[j]) ? 0 : m_runningMin[j];
+			m_runningMax[j] = (0 > m_runningMax[j]) ? 0 : m_runningMax[j];
+		}
+	}
+	free(counts);
+
+	free(threads);
+	free(thread_args);
+	munmap((void*)file, fileSize);
+	close(fd);
+
+	if (m_samplesBiased) {
+		for (uint32_t i = 0; i < m_numSamples; i++) { // Bias term
+			m_samples[0][i] = 1.0;
+		}
+		m_runningMin[0] = 1.0;
+		m_runningMax[0] = 1.0;
+	}
+
+	double end = get_time();
+	cout << "Parse throughput: " << ((double)fileSize/1e6)/(end-start) << " MB/s" << endl;
+	cout << "m_numSamples: " << m_numSamples << endl;
+	cout << "m_numFeatures: " << m_numFeatures << endl;
+}
+
+
+static void* libsvmScatterThread(void* args) {
+	libsvm_thread_data* r = (libsvm_thread_data*)args;
+	ColumnStore* cstore = r->m_cstore;
+
+	// Chunks are in sample order and so are the entries within a chunk, rows stay sorted per column
+	for (uint64_t e = 0; e < r->m_numEntries; e++) {
+		uint32_t column = r->m_entryColumns[e];
+		uint32_t position = r->m_columnNnz[column]++;
+		cstore->m_sparseRows[column][position] = r->m_entryRows[e];
+		cstore->m_sparseValues[column][position] = r->m_entryValues[e];
+	}
+
+	return nullptr;
+}
+
+void ColumnStore::LoadLibsvmDataSparse(char* pathToFile, uint32_t numSamples, uint32_t numFeatures, bool samplesBiased, uint32_t numThreads) {
+	cout << "LoadLibsvmDataSparse is reading " << pathToFile << " with " << numThreads << " threads" << endl;
+
+	double start = get_time();
+
+	int fd = open(pathToFile, O_RDONLY);
+	if (fd < 0) {
+		cout << "Unable to open file " << pathToFile << endl;
+		exit(1);
+	}
+	struct stat fileStat;
+	fstat(fd, &fileStat);
+	size_t fileSize = fileStat.st_size;
+
+	const char* file = (const char*)mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (file == MAP_FAILED) {
+		cout << "Unable to mmap file " << pathToFile << endl;
+		exit(1);
+	}
+	madvise((void*)file, fileSize, MADV_SEQUENTIAL);
+
+	deallocData();
+
+	m_samplesBiased = samplesBiased;
+	m_numSamples = numSamples;
+	m_numFeatures = m_samplesBiased ? numFeatures + 1 : numFeatures;
+
+	m_labels = (float*)aligned_alloc(64, m_numSamples*sizeof(float));
+	reallocSparse();
+
+	if (numThreads == 0) {
+		numThreads = 1;
+	}
+	pthread_t* threads = (pthread_t*)malloc(numThreads*sizeof(pthread_t));
+	libsvm_thread_data* thread_args = (libsvm_thread_data*)malloc(numThreads*sizeof(libsvm_thread_data));
+
+	uint32_t numLines = SplitLibsvmFile(this, file, fileSize, numThreads, threads, thread_args);
+	if (numLines < m_numSamples) {
+		cout << "File contains only " << numLines << " samples, the rest is set to 0" << endl;
+		memset(m_labels + numLines, 0, (m_numSamples - numLines)*sizeof(float));
+	}
+
+	// Pass 2: parse, every thread collects the nonzeros of its chunk
+	for (uint32_t n = 0; n < numThreads; n++) {
+		thread_args[n].m_columnNnz = (uint32_t*)calloc(m_numFeatures, sizeof(uint32_t));
+		thread_args[n].m_entriesCapacity = (thread_args[n].m_end - thread_args[n].m_begin)/8;
+		thread_args[n].m_entryColumns = (uint32_t*)malloc(thread_args[n].m_entriesCapacity*sizeof(uint32_t));
+		thread_args[n].m_entryRows = (uint32_t*)malloc(thread_args[n].m_entriesCapacity*sizeof(uint32_t));
+		thread_args[n].m_entryValues = (float*)malloc(thread_args[n].m_entriesCapacity*sizeof(float));
+		pthread_create(&threads[n], NULL, libsvmParseThread, (void*)&thread_args[n]);
+	}
+	for (uint32_t n = 0; n < numThreads; n++) {
+		pthread_join(threads[n], NULL);
+	}
+
+	// Column sizes, and where each chunk starts writing in each column
+	for (uint32_t j = 0; j < m_numFeatures; j++) {
+		uint32_t nnz = 0;
+		if (m_samplesBiased && j == 0) {
+			nnz = m_numSamples;
+		}
+		for (uint32_t n = 0; n < numThreads; n++) {
+			uint32_t chunkNnz = thread_args[n].m_columnNnz[j];
+			thread_args[n].m_columnNnz[j] = nnz;
+			nnz += chunkNnz;
+		}
+		m_sparseNnz[j] = nnz;
+		m_sparseRows[j] = (uint32_t*)aligned_alloc(64, (nnz + 16)*sizeof(uint32_t));
+		m_sparseValues[j] = (float*)aligned_alloc(64, (nnz + 16)*sizeof(float));
+	}
+
+	// Pass 3: scatter the nonzeros into the columns
+	for (uint32_t n = 0; n < numThreads; n++) {
+		pthread_create(&threads[n], NULL, libsvmScatterThread, (void*)&thread_args[n]);
+	}
+	for (uint32_t n = 0; n < numThreads; n++) {
+		pthread_join(threads[n], NULL);
+	}
+
+	for (uint32_t n = 0; n < numThreads; n++) {
+		free(thread_args[n].m_columnNnz);
+		free(thread_args[n].m_entryColumns);
+		free(thread_args[n].m_entryRows);
+		free(thread_args[n].m_entryValues);
+	}
+	free(threads);
+	free(thread_args);
+	munmap((void*)file, fileSize);
+	close(fd);
+
+	if (m_samplesBiased) {
+		for (uint32_t i = 0; i < m_numSamples; i++) { // Bias term
+			m_sparseRows[0][i] = i;
+			m_sparseValues[0][i] = 1.0;
+		}
+	}
+
+	double end = get_time();
+	uint64_t nnz = GetSparseNnz();
+	cout << "Parse throughput: " << ((double)fileSize/1e6)/(end-start) << " MB/s" << endl;
+	cout << "m_numSamples: " << m_numSamples << endl;
+	cout << "m_numFeatures: " << m_numFeatures << endl;
+	cout << "nnz: " << nnz << " (" << 100.0*(double)nnz/((double)m_numSamples*m_numFeatures) << "%)" << endl;
+}
 
 void ColumnStore::LoadRawData(char* pathToFile, uint32_t numSamples, uint32_t numFeatures, bool labelPresent) {
 	cout << "LoadRawData is reading " << pathToFile << endl;
@@ -98,13 +587,17 @@ void ColumnStore::LoadRawData(char* pathToFile, uint32_t numSamples, uint32_t nu
 	
 	uint32_t numFeaturesWithoutBias = m_numFeatures-1;
 
+	resetRunningMinMax();
 	if (labelPresent) {
 		temp = (double*)malloc(m_numSamples*(numFeaturesWithoutBias+1)*sizeof(double));
 		size_t readsize = fread(temp, sizeof(double), m_numSamples*(numFeaturesWithoutBias+1), f);
 		for (uint32_t i = 0; i < m_numSamples; i++) {
 			m_labels[i] = (float)temp[i*(numFeaturesWithoutBias+1)];
 			for (uint32_t j = 0; j < numFeaturesWithoutBias; j++) {
-				m_samples[j+1][i] = (float)temp[i*(numFeaturesWithoutBias+1) + j + 1];
+				float value = (float)temp[i*(numFeaturesWithoutBias+1) + j + 1];
+				m_samples[j+1][i] = value;
+				m_runningMin[j+1] = (value < m_runningMin[j+1]) ? value : m_runningMin[j+1];
+				m_runningMax[j+1] = (value > m_runningMax[j+1]) ? value : m_runningMax[j+1];
 			}
 		}
 	}
@@ -114,7 +607,10 @@ void ColumnStore::LoadRawData(char* pathToFile, uint32_t numSamples, uint32_t nu
 		for (uint32_t i = 0; i < m_numSamples; i++) {
 			m_labels[i] = 0;
 			for (uint32_t j = 0; j < numFeaturesWithoutBias; j++) {
-				m_samples[j+1][i] = (float)temp[i*numFeaturesWithoutBias + j];
+				float value = (float)temp[i*numFeaturesWithoutBias + j];
+				m_samples[j+1][i] = value;
+				m_runningMin[j+1] = (value < m_runningMin[j+1]) ? value : m_runningMin[j+1];
+				m_runningMax[j+1] = (value > m_runningMax[j+1]) ? value : m_runningMax[j+1];
 			}
 		}
 	}
@@ -122,6 +618,8 @@ void ColumnStore::LoadRawData(char* pathToFile, uint32_t numSamples, uint32_t nu
 	for (uint32_t i = 0; i < m_numSamples; i++) { // Bias term
 		m_samples[0][i] = 1.0;
 	}
+	m_runningMin[0] = 1.0;
+	m_runningMax[0] = 1.0;
 
 	free(temp);
 	fclose(f);
@@ -130,6 +628,222 @@ void ColumnStore::LoadRawData(char* pathToFile, uint32_t numSamples, uint32_t nu
 	cout << "m_numFeatures: " << m_numFeatures << endl;
 }
 
+#define RAW_TILE_ROWS 4096
+
+typedef struct {
+	ColumnStore* m_cstore;
+	const double* m_file;
+	uint32_t m_rowStride;
+	uint32_t m_labelOffset;
+	bool m_labelPresent;
+	uint32_t m_firstSample;
+	uint32_t m_numSamplesToProcess;
+
+	// Per feature, over the samples of this thread
+	float* m_min;
+	float* m_max;
+} raw_thread_data;
+
+#ifdef AVX2
+static inline void Transpose8x8(__m256 &r0, __m256 &r1, __m256 &r2, __m256 &r3, __m256 &r4, __m256 &r5, __m256 &r6, __m256 &r7) {
+	__m256 t0 = _mm256_unpacklo_ps(r0, r1);
+	__m256 t1 = _mm256_unpackhi_ps(r0, r1);
+	__m256 t2 = _mm256_unpacklo_ps(r2, r3);
+	__m256 t3 = _mm256_unpackhi_ps(r2, r3);
+	__m256 t4 = _mm256_unpacklo_ps(r4, r5);
+	__m256 t5 = _mm256_unpackhi_ps(r4, r5);
+	__m256 t6 = _mm256_unpacklo_ps(r6, r7);
+	__m256 t7 = _mm256_unpackhi_ps(r6, r7);
+	__m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1,0,1,0));
+	__m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3,2,3,2));
+	__m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1,0,1,0));
+	__m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3,2,3,2));
+	__m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1,0,1,0));
+	__m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3,2,3,2));
+	__m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1,0,1,0));
+	__m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3,2,3,2));
+	r0 = _mm256_permute2f128_ps(s0, s4, 0x20);
+	r1 = _mm256_permute2f128_ps(s1, s5, 0x20);
+	r2 = _mm256_permute2f128_ps(s2, s6, 0x20);
+	r3 = _mm256_permute2f128_ps(s3, s7, 0x20);
+	r4 = _mm256_permute2f128_ps(s0, s4, 0x31);
+	r5 = _mm256_permute2f128_ps(s1, s5, 0x31);
+	r6 = _mm256_permute2f128_ps(s2, s6, 0x31);
+	r7 = _mm256_permute2f128_ps(s3, s7, 0x31);
+}
+
+static inline __m256 LoadDoublesAsFloats(const double* p) {
+	__m128 low = _mm256_cvtpd_ps(_mm256_loadu_pd(p));
+	__m128 high = _mm256_cvtpd_ps(_mm256_loadu_pd(p + 4));
+	return _mm256_insertf128_ps(_mm256_castps128_ps256(low), high, 1);
+}
+#endif
+
+static void* rawTransposeThread(void* args) {
+	raw_thread_data* r = (raw_thread_data*)args;
+	ColumnStore* cstore = r->m_cstore;
+
+	uint32_t numFeaturesWithoutBias = cstore->m_numFeatures-1;
+	uint32_t lastSample = r->m_firstSample + r->m_numSamplesToProcess;
+
+	for (uint32_t tileStart = r->m_firstSample; tileStart < lastSample; tileStart += RAW_TILE_ROWS) {
+		uint32_t tileEnd = (tileStart + RAW_TILE_ROWS < lastSample) ? tileStart + RAW_TILE_ROWS : lastSample;
+
+		uint32_t i = tileStart;
+#ifdef AVX2
+		for (; i + 8 <= tileEnd; i += 8) {
+			const double* rows = r->m_file + (size_t)i*r->m_rowStride;
+			if (r->m_labelPresent) {
+				for (uint32_t k = 0; k < 8; k++) {
+					cstore->m_labels[i+k] = (float)rows[k*r->m_rowStride];
+				}
+			}
+			else {
+				_mm256_storeu_ps(cstore->m_labels + i, _mm256_setzero_ps());
+			}
+
+			uint32_t j = 0;
+			for (; j + 8 <= numFeaturesWithoutBias; j += 8) {
+				const double* p = rows + r->m_labelOffset + j;
+				__m256 r0 = LoadDoublesAsFloats(p);
+				__m256 r1 = LoadDoublesAsFloats(p + r->m_rowStride);
+				__m256 r2 = LoadDoublesAsFloats(p + 2*r->m_rowStride);
+				__m256 r3 = LoadDoublesAsFloats(p + 3*r->m_rowStride);
+				__m256 r4 = LoadDoublesAsFloats(p + 4*r->m_rowStride);
+				__m256 r5 = LoadDoublesAsFloats(p + 5*r->m_rowStride);
+				__m256 r6 = LoadDoublesAsFloats(p + 6*r->m_rowStride);
+				__m256 r7 = LoadDoublesAsFloats(p + 7*r->m_rowStride);
+				Transpose8x8(r0, r1, r2, r3, r4, r5, r6, r7);
+				_mm256_storeu_ps(cstore->m_samples[j+1] + i, r0);
+				_mm256_storeu_ps(cstore->m_samples[j+2] + i, r1);
+				_mm256_storeu_ps(cstore->m_samples[j+3] + i, r2);
+				_mm256_storeu_ps(cstore->m_samples[j+4] + i, r3);
+				_mm256_storeu_ps(cstore->m_samples[j+5] + i, r4);
+				_mm256_storeu_ps(cstore->m_samples[j+6] + i, r5);
+				_mm256_storeu_ps(cstore->m_samples[j+7] + i, r6);
+				_mm256_storeu_ps(cstore->m_samples[j+8] + i, r7);
+			}
+			for (; j < numFeaturesWithoutBias; j++) {
+				for (uint32_t k = 0; k < 8; k++) {
+					cstore->m_samples[j+1][i+k] = (float)rows[k*r->m_rowStride + r->m_labelOffset + j];
+				}
+			}
+		}
+#endif
+		for (; i < tileEnd; i++) {
+			const double* row = r->m_file + (size_t)i*r->m_rowStride;
+			cstore->m_labels[i] = r->m_labelPresent ? (float)row[0] : 0;
+			for (uint32_t j = 0; j < numFeaturesWithoutBias; j++) {
+				cstore->m_samples[j+1][i] = (float)row[r->m_labelOffset + j];
+			}
+		}
+
+		for (uint32_t i = tileStart; i < tileEnd; i++) { // Bias term
+			cstore->m_samples[0][i] = 1.0;
+		}
+		// The tile is still in cache
+		for (uint32_t j = 0; j < cstore->m_numFeatures; j++) {
+			AccumulateMinMax(cstore->m_samples[j] + tileStart, tileEnd - tileStart, r->m_min[j], r->m_max[j]);
+		}
+
+		// Drop the pages of this tile so that the mapping never holds the whole file
+		size_t pageSize = 4096;
+		size_t tileBegin = (size_t)r->m_file + (size_t)tileStart*r->m_rowStride*sizeof(double);
+		size_t tileFinish = (size_t)r->m_file + (size_t)tileEnd*r->m_rowStride*sizeof(double);
+		tileBegin = (tileBegin + pageSize - 1) & ~(pageSize - 1);
+		tileFinish = tileFinish & ~(pageSize - 1);
+		if (tileFinish > tileBegin) {
+			madvise((void*)tileBegin, tileFinish - tileBegin, MADV_DONTNEED);
+		}
+	}
+
+	return nullptr;
+}
+
+void ColumnStore::LoadRawDataStreaming(char* pathToFile, uint32_t numSamples, uint32_t numFeatures, bool labelPresent, uint32_t numThreads) {
+	cout << "LoadRawDataStreaming is reading " << pathToFile << " with " << numThreads << " threads" << endl;
+
+	double start = get_time();
+
+	m_samplesBiased = true;
+	m_numSamples = numSamples;
+	m_numFeatures = numFeatures+1; // For the bias term
+
+	uint32_t rowStride = labelPresent ? numFeatures+1 : numFeatures;
+	size_t bytesToRead = (size_t)m_numSamples*rowStride*sizeof(double);
+
+	int fd = open(pathToFile, O_RDONLY);
+	if (fd < 0) {
+		cout << "Can't find files at pathToFile" << endl;
+		exit(1);
+	}
+	struct stat fileStat;
+	fstat(fd, &fileStat);
+	if ((size_t)fileStat.st_size < bytesToRead) {
+		cout << "File " << pathToFile << " is smaller than " << bytesToRead << " bytes" << endl;
+		exit(1);
+	}
+
+	const double* file = (const double*)mmap(NULL, bytesToRead, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (file == MAP_FAILED) {
+		cout << "Unable to mmap file " << pathToFile << endl;
+		exit(1);
+	}
+	madvise((void*)file, bytesToRead, MADV_SEQUENTIAL);
+
+	reallocData();
+
+	if (numThreads == 0) {
+		numThreads = 1;
+	}
+	pthread_t* threads = (pthread_t*)malloc(numThreads*sizeof(pthread_t));
+	raw_thread_data* thread_args = (raw_thread_data*)malloc(numThreads*sizeof(raw_thread_data));
+
+	// Sample ranges are multiples of 16, so that every 8x8 tile stays within one thread and no two
+	// threads write the same 64 byte line of a column
+	uint32_t samplesPerThread = m_numSamples/numThreads + (m_numSamples%numThreads > 0);
+	samplesPerThread += (16 - samplesPerThread%16)%16;
+	uint32_t firstSample = 0;
+	for (uint32_t n = 0; n < numThreads; n++) {
+		thread_args[n].m_cstore = this;
+		thread_args[n].m_file = file;
+		thread_args[n].m_rowStride = rowStride;
+		thread_args[n].m_labelOffset = labelPresent ? 1 : 0;
+		thread_args[n].m_labelPresent = labelPresent;
+		thread_args[n].m_firstSample = firstSample;
+		thread_args[n].m_numSamplesToProcess = (samplesPerThread < m_numSamples - firstSample) ? samplesPerThread : m_numSamples - firstSample;
+		firstSample += thread_args[n].m_numSamplesToProcess;
+		thread_args[n].m_min = (float*)malloc(m_numFeatures*sizeof(float));
+		thread_args[n].m_max = (float*)malloc(m_numFeatures*sizeof(float));
+		for (uint32_t j = 0; j < m_numFeatures; j++) {
+			thread_args[n].m_min[j] = numeric_limits<float>::max();
+			thread_args[n].m_max[j] = -numeric_limits<float>::max();
+		}
+
+		pthread_create(&threads[n], NULL, rawTransposeThread, (void*)&thread_args[n]);
+	}
+	resetRunningMinMax();
+	for (uint32_t n = 0; n < numThreads; n++) {
+		pthread_join(threads[n], NULL);
+		for (uint32_t j = 0; j < m_numFeatures; j++) {
+			m_runningMin[j] = (thread_args[n].m_min[j] < m_runningMin[j]) ? thread_args[n].m_min[j] : m_runningMin[j];
+			m_runningMax[j] = (thread_args[n].m_max[j] > m_runningMax[j]) ? thread_args[n].m_max[j] : m_runningMax[j];
+		}
+		free(thread_args[n].m_min);
+		free(thread_args[n].m_max);
+	}
+
+	free(threads);
+	free(thread_args);
+	munmap((void*)file, bytesToRead);
+	close(fd);
+
+	double end = get_time();
+	cout << "Load throughput: " << ((double)bytesToRead/1e6)/(end-start) << " MB/s" << endl;
+	cout << "m_numSamples: " << m_numSamples << endl;
+	cout << "m_numFeatures: " << m_numFeatures << endl;
+}
+
 void ColumnStore::GenerateSyntheticData(uint32_t numSamples, uint32_t numFeatures, bool labelBinary, NormType labelsNorm) {
 	
 	m_numSamples = numSamples;
@@ -174,191 +888,1894 @@ void ColumnStore::GenerateSyntheticData(uint32_t numSamples, uint32_t numFeature
 	cout << "m_numFeatures: " << m_numFeatures << endl;
 }
 
-void ColumnStore::NormalizeSamples(NormType norm, NormDirection direction) {
-	m_samplesNorm = norm;
+#define SYNTHETIC_BLOCK_SIZE 2048
+
+// Streams of the synthetic generator, the counter within a stream is the element index
+#define SYNTHETIC_STREAM_MODEL 0
+#define SYNTHETIC_STREAM_LATENT 1
+#define SYNTHETIC_STREAM_VALUE 2
+#define SYNTHETIC_STREAM_MASK 3
+#define SYNTHETIC_STREAM_LABEL 4
+
+typedef struct {
+	ColumnStore* m_cstore;
+	SyntheticDataParameters* m_parameters;
+	float* m_model;
+	bool m_labelBinary;
+	NormType m_labelsNorm;
+	uint32_t m_firstSample;
+	uint32_t m_numSamplesToProcess;
+} synthetic_thread_data;
+
+static inline uint64_t SyntheticSeed(uint64_t seed, uint32_t stream) {
+	return CounterHash(seed, stream);
+}
 
-	if (direction == row) {
-		m_samplesRange = (float*)realloc(m_samplesRange, m_numSamples*sizeof(float));
-		m_samplesMin = (float*)realloc(m_samplesMin, m_numSamples*sizeof(float));
+static inline float SyntheticGaussian(uint64_t seed, uint64_t counter) {
+	// Box-Muller from two uniforms of the same counter
+	float u1 = CounterUniform(seed, 2*counter) + 1.0f/33554432.0f;
+	float u2 = CounterUniform(seed, 2*counter + 1);
+	return sqrtf(-2.0f*logf(u1))*cosf(6.2831853f*u2);
+}
 
-		for (uint32_t i = 0; i < m_numSamples; i++) {
-			float samplesMin = numeric_limits<float>::max();
-			float samplesMax = -numeric_limits<float>::max();
-			for (uint32_t j = 0; j < m_numFeatures; j++) {
-				if (m_samples[j][i] > samplesMax) {
-					samplesMax = m_samples[j][i];
-				}
-				if (m_samples[j][i] < samplesMin) {
-					samplesMin = m_samples[j][i];
+// Zero mean, unit variance
+static inline float SyntheticValue(SyntheticDistribution distribution, uint64_t seed, uint64_t counter) {
+	float value = 0;
+	switch (distribution) {
+		case uniform:
+			value = (CounterUniform(seed, counter)*2.0f - 1.0f)*1.7320508f;
+			break;
+		case gaussian:
+			value = SyntheticGaussian(seed, counter);
+			break;
+		case laplace: {
+			float u = CounterUniform(seed, counter) - 0.5f;
+			float magnitude = -logf(1.0f - 2.0f*fabsf(u) + 1.0f/33554432.0f)*0.70710678f;
+			value = (u < 0) ? -magnitude : magnitude;
+			break;
+		}
+	}
+	return value;
+}
+
+static void* syntheticThread(void* args) {
+	synthetic_thread_data* r = (synthetic_thread_data*)args;
+	ColumnStore* cstore = r->m_cstore;
+	SyntheticDataParameters* parameters = r->m_parameters;
+
+	uint64_t latentSeed = SyntheticSeed(parameters->m_seed, SYNTHETIC_STREAM_LATENT);
+	uint64_t valueSeed = SyntheticSeed(parameters->m_seed, SYNTHETIC_STREAM_VALUE);
+	uint64_t maskSeed = SyntheticSeed(parameters->m_seed, SYNTHETIC_STREAM_MASK);
+	uint64_t labelSeed = SyntheticSeed(parameters->m_seed, SYNTHETIC_STREAM_LABEL);
+	float sharedWeight = sqrtf(parameters->m_correlation);
+	float ownWeight = sqrtf(1.0f - parameters->m_correlation);
+
+	float latent[SYNTHETIC_BLOCK_SIZE];
+	float score[SYNTHETIC_BLOCK_SIZE];
+
+	// Blocks of samples, so that every column is written sequentially
+	for (uint32_t block = 0; block < r->m_numSamplesToProcess; block += SYNTHETIC_BLOCK_SIZE) {
+		uint32_t first = r->m_firstSample + block;
+		uint32_t count = r->m_numSamplesToProcess - block;
+		if (count > SYNTHETIC_BLOCK_SIZE) {
+			count = SYNTHETIC_BLOCK_SIZE;
+		}
+
+		for (uint32_t i = 0; i < count; i++) {
+			latent[i] = sharedWeight*SyntheticValue(parameters->m_distribution, latentSeed, first + i);
+			score[i] = 0;
+		}
+
+		for (uint32_t j = 0; j < cstore->m_numFeatures; j++) {
+			float* column = cstore->m_samples[j] + first;
+			for (uint32_t i = 0; i < count; i++) {
+				uint64_t counter = (uint64_t)j*cstore->m_numSamples + first + i;
+				float value = latent[i] + ownWeight*SyntheticValue(parameters->m_distribution, valueSeed, counter);
+				if (parameters->m_sparsity > 0 && CounterUniform(maskSeed, counter) < parameters->m_sparsity) {
+					value = 0;
 				}
+				column[i] = value;
+				score[i] += r->m_model[j]*value;
 			}
-			float samplesRange = samplesMax - samplesMin;
-			if (samplesRange > 0) {
-				if (m_samplesNorm == MinusOneToOne) {
-					for (uint32_t j = 0; j < m_numFeatures; j++) {
-						m_samples[j][i] = ((m_samples[j][i] - samplesMin)/samplesRange)*2.0-1.0;
-					}
+		}
+
+		for (uint32_t i = 0; i < count; i++) {
+			if (r->m_labelBinary) {
+				bool positive = (score[i] > 0);
+				if (CounterUniform(labelSeed, first + i) < parameters->m_labelNoise) {
+					positive = !positive;
+				}
+				if (positive) {
+					cstore->m_labels[first + i] = 1.0;
 				}
 				else {
-					for (uint32_t j = 0; j < m_numFeatures; j++) {
-						m_samples[j][i] = ((m_samples[j][i] - samplesMin)/samplesRange);
-					}
+					cstore->m_labels[first + i] = (r->m_labelsNorm == MinusOneToOne) ? -1.0 : 0.0;
 				}
 			}
-			m_samplesRange[i] = samplesRange;
-			m_samplesMin[i] = samplesMin;
+			else {
+				cstore->m_labels[first + i] = score[i] + parameters->m_labelNoise*SyntheticGaussian(labelSeed, first + i);
+			}
 		}
 	}
-	else {
-		m_samplesRange = (float*)realloc(m_samplesRange, m_numFeatures*sizeof(float));
-		m_samplesMin = (float*)realloc(m_samplesMin, m_numFeatures*sizeof(float));
 
-		uint32_t startCoordinate = m_samplesBiased ? 1 : 0;
-		m_samplesRange[0] = 0.0;
-		m_samplesMin[0] = 0.0;
-		for (uint32_t j = startCoordinate; j < m_numFeatures; j++) {
-			float samplesMin = numeric_limits<float>::max();
-			float samplesMax = -numeric_limits<float>::max();
-			for (uint32_t i = 0; i < m_numSamples; i++) {
-				if (m_samples[j][i] > samplesMax) {
-					samplesMax = m_samples[j][i];;
-				}
-				if (m_samples[j][i] < samplesMin) {
-					samplesMin = m_samples[j][i];;
-				}
-			}
-			float samplesRange = samplesMax - samplesMin;
-			if (samplesRange > 0) {
-				if (m_samplesNorm == MinusOneToOne) {
-					for (uint32_t i = 0; i < m_numSamples; i++) {
-						m_samples[j][i] = ((m_samples[j][i] - samplesMin)/samplesRange)*2.0-1.0;
-					}
+	return nullptr;
+}
+
+void ColumnStore::GenerateSyntheticDataParallel(uint32_t numSamples, uint32_t numFeatures, bool labelBinary, NormType labelsNorm, SyntheticDataParameters* parameters, uint32_t numThreads) {
+	cout << "GenerateSyntheticDataParallel with " << numThreads << " threads, seed: " << parameters->m_seed << ", sparsity: " << parameters->m_sparsity << ", correlation: " << parameters->m_correlation << ", labelNoise: " << parameters->m_labelNoise << ", distribution: " << parameters->m_distribution << endl;
+
+	if (parameters->m_correlation < 0 || parameters->m_correlation > 1 || parameters->m_sparsity < 0 || parameters->m_sparsity > 1) {
+		cout << "correlation and sparsity must be in [0, 1]!" << endl;
+		exit(1);
+	}
+
+	double start = get_time();
+
+	m_numSamples = numSamples;
+	m_numFeatures = numFeatures;
+	m_samplesBiased = false;
+	m_labelsNorm = labelsNorm;
+
+	reallocData();
+
+	// The true model, normalized so that the label score has about unit variance
+	uint64_t modelSeed = SyntheticSeed(parameters->m_seed, SYNTHETIC_STREAM_MODEL);
+	float* model = (float*)malloc(m_numFeatures*sizeof(float));
+	for (uint32_t j = 0; j < m_numFeatures; j++) {
+		model[j] = SyntheticGaussian(modelSeed, j)/sqrtf((float)m_numFeatures);
+	}
+
+	if (numThreads == 0) {
+		numThreads = 1;
+	}
+	pthread_t* threads = (pthread_t*)malloc(numThreads*sizeof(pthread_t));
+	synthetic_thread_data* thread_args = (synthetic_thread_data*)malloc(numThreads*sizeof(synthetic_thread_data));
+
+	// 16 sample aligned ranges, so that no two threads write to the same cache line of a column
+	uint32_t samplesPerThread = (m_numSamples/numThreads + 15)/16*16;
+	uint32_t firstSample = 0;
+	for (uint32_t n = 0; n < numThreads; n++) {
+		uint32_t numSamplesToProcess = (firstSample < m_numSamples) ? m_numSamples - firstSample : 0;
+		if (n < numThreads-1 && numSamplesToProcess > samplesPerThread) {
+			numSamplesToProcess = samplesPerThread;
+		}
+		thread_args[n].m_cstore = this;
+		thread_args[n].m_parameters = parameters;
+		thread_args[n].m_model = model;
+		thread_args[n].m_labelBinary = labelBinary;
+		thread_args[n].m_labelsNorm = labelsNorm;
+		thread_args[n].m_firstSample = firstSample;
+		thread_args[n].m_numSamplesToProcess = numSamplesToProcess;
+		firstSample += numSamplesToProcess;
+		pthread_create(&threads[n], NULL, syntheticThread, (void*)&thread_args[n]);
+	}
+	for (uint32_t n = 0; n < numThreads; n++) {
+		pthread_join(threads[n], NULL);
+	}
+
+	free(threads);
+	free(thread_args);
+	free(model);
+
+	double end = get_time();
+	cout << "Generation throughput: " << ((double)m_numSamples*m_numFeatures*sizeof(float)/1e6)/(end-start) << " MB/s" << endl;
+	cout << "m_numSamples: " << m_numSamples << endl;
+	cout << "m_numFeatures: " << m_numFeatures << endl;
+}
+
+#define NORMALIZE_TILE_SAMPLES 1024
+
+typedef struct {
+	ColumnStore* m_cstore;
+	uint32_t m_firstSample;
+	uint32_t m_numSamplesToProcess;
+
+	// Per feature, over the samples of this thread
+	float* m_min;
+	float* m_max;
+} normalize_thread_data;
+
+// (value - min)/range, then mapped from [0, 1] to [-1, 1] for MinusOneToOne. Rows pass a
+// min and range per value (stride 1), columns a single one (stride 0).
+static inline void ScaleValues(float* values, uint32_t count, const float* min, const float* range, uint32_t stride, NormType norm) {
+	uint32_t i = 0;
+#ifdef AVX2
+	__m256 AVX_zeros = _mm256_setzero_ps();
+	__m256 AVX_twos = _mm256_set1_ps(2.0);
+	__m256 AVX_ones = _mm256_set1_ps(1.0);
+	for (; i + 8 <= count; i += 8) {
+		__m256 AVX_values = _mm256_loadu_ps(values + i);
+		__m256 AVX_min = (stride == 0) ? _mm256_set1_ps(min[0]) : _mm256_loadu_ps(min + i);
+		__m256 AVX_range = (stride == 0) ? _mm256_set1_ps(range[0]) : _mm256_loadu_ps(range + i);
+		__m256 AVX_scaled = _mm256_div_ps(_mm256_sub_ps(AVX_values, AVX_min), AVX_range);
+		if (norm == MinusOneToOne) {
+			AVX_scaled = _mm256_sub_ps(_mm256_mul_ps(AVX_scaled, AVX_twos), AVX_ones);
+		}
+		// Values with a range of 0 stay as they are
+		__m256 AVX_hasRange = _mm256_cmp_ps(AVX_range, AVX_zeros, _CMP_GT_OQ);
+		_mm256_storeu_ps(values + i, _mm256_blendv_ps(AVX_values, AVX_scaled, AVX_hasRange));
+	}
+#endif
+	for (; i < count; i++) {
+		float valueRange = range[i*stride];
+		if (valueRange > 0) {
+			values[i] = (values[i] - min[i*stride])/valueRange;
+			if (norm == MinusOneToOne) {
+				values[i] = values[i]*2.0-1.0;
+			}
+		}
+	}
+}
+
+// Column normalization, first pass: statistics of the thread's samples
+static void* normalizeStatsThread(void* args) {
+	normalize_thread_data* r = (normalize_thread_data*)args;
+	ColumnStore* cstore = r->m_cstore;
+
+	for (uint32_t j = 0; j < cstore->m_numFeatures; j++) {
+		AccumulateMinMax(cstore->m_samples[j] + r->m_firstSample, r->m_numSamplesToProcess, r->m_min[j], r->m_max[j]);
+	}
+	return nullptr;
+}
+
+// Column normalization, second pass
+static void* normalizeColumnsThread(void* args) {
+	normalize_thread_data* r = (normalize_thread_data*)args;
+	ColumnStore* cstore = r->m_cstore;
+
+	uint32_t startCoordinate = cstore->m_samplesBiased ? 1 : 0;
+	for (uint32_t j = startCoordinate; j < cstore->m_numFeatures; j++) {
+		if (cstore->m_samplesRange[j] > 0) {
+			ScaleValues(cstore->m_samples[j] + r->m_firstSample, r->m_numSamplesToProcess, cstore->m_samplesMin + j, cstore->m_samplesRange + j, 0, cstore->m_samplesNorm);
+		}
+	}
+	return nullptr;
+}
+
+// Row normalization in a single pass: the statistics of a tile of samples are gathered over
+// all features and applied while the tile is still in cache
+static void* normalizeRowsThread(void* args) {
+	normalize_thread_data* r = (normalize_thread_data*)args;
+	ColumnStore* cstore = r->m_cstore;
+
+	uint32_t lastSample = r->m_firstSample + r->m_numSamplesToProcess;
+	for (uint32_t tileStart = r->m_firstSample; tileStart < lastSample; tileStart += NORMALIZE_TILE_SAMPLES) {
+		uint32_t tileSize = (tileStart + NORMALIZE_TILE_SAMPLES < lastSample) ? NORMALIZE_TILE_SAMPLES : lastSample - tileStart;
+		float* tileMin = cstore->m_samplesMin + tileStart;
+		float* tileRange = cstore->m_samplesRange + tileStart;
+
+		// tileRange holds the max until all features are seen
+		for (uint32_t i = 0; i < tileSize; i++) {
+			tileMin[i] = numeric_limits<float>::max();
+			tileRange[i] = -numeric_limits<float>::max();
+		}
+		for (uint32_t j = 0; j < cstore->m_numFeatures; j++) {
+			float* values = cstore->m_samples[j] + tileStart;
+			uint32_t i = 0;
+#ifdef AVX2
+			for (; i + 8 <= tileSize; i += 8) {
+				__m256 AVX_values = _mm256_loadu_ps(values + i);
+				_mm256_storeu_ps(tileMin + i, _mm256_min_ps(_mm256_loadu_ps(tileMin + i), AVX_values));
+				_mm256_storeu_ps(tileRange + i, _mm256_max_ps(_mm256_loadu_ps(tileRange + i), AVX_values));
+			}
+#endif
+			for (; i < tileSize; i++) {
+				tileMin[i] = (values[i] < tileMin[i]) ? values[i] : tileMin[i];
+				tileRange[i] = (values[i] > tileRange[i]) ? values[i] : tileRange[i];
+			}
+		}
+		for (uint32_t i = 0; i < tileSize; i++) {
+			tileRange[i] = tileRange[i] - tileMin[i];
+		}
+
+		for (uint32_t j = 0; j < cstore->m_numFeatures; j++) {
+			ScaleValues(cstore->m_samples[j] + tileStart, tileSize, tileMin, tileRange, 1, cstore->m_samplesNorm);
+			AccumulateMinMax(cstore->m_samples[j] + tileStart, tileSize, r->m_min[j], r->m_max[j]);
+		}
+	}
+	return nullptr;
+}
+
+// Sample ranges are multiples of 8, so that only the last one has a scalar tail
+static void SplitNormalizeSamples(ColumnStore* cstore, uint32_t numThreads, normalize_thread_data* thread_args) {
+	uint32_t samplesPerThread = cstore->m_numSamples/numThreads + (cstore->m_numSamples%numThreads > 0);
+	samplesPerThread += (8 - samplesPerThread%8)%8;
+	uint32_t firstSample = 0;
+	for (uint32_t n = 0; n < numThreads; n++) {
+		thread_args[n].m_cstore = cstore;
+		thread_args[n].m_firstSample = firstSample;
+		thread_args[n].m_numSamplesToProcess = (samplesPerThread < cstore->m_numSamples - firstSample) ? samplesPerThread : cstore->m_numSamples - firstSample;
+		firstSample += thread_args[n].m_numSamplesToProcess;
+		thread_args[n].m_min = (float*)malloc(cstore->m_numFeatures*sizeof(float));
+		thread_args[n].m_max = (float*)malloc(cstore->m_numFeatures*sizeof(float));
+		for (uint32_t j = 0; j < cstore->m_numFeatures; j++) {
+			thread_args[n].m_min[j] = numeric_limits<float>::max();
+			thread_args[n].m_max[j] = -numeric_limits<float>::max();
+		}
+	}
+}
+
+void ColumnStore::gatherColumnStatistics(uint32_t numThreads) {
+	if (m_runningMin != nullptr && m_runningMinMaxExact) {
+		return;
+	}
+	pthread_t* threads = (pthread_t*)malloc(numThreads*sizeof(pthread_t));
+	normalize_thread_data* thread_args = (normalize_thread_data*)malloc(numThreads*sizeof(normalize_thread_data));
+	SplitNormalizeSamples(this, numThreads, thread_args);
+	for (uint32_t n = 0; n < numThreads; n++) {
+		pthread_create(&threads[n], NULL, normalizeStatsThread, (void*)&thread_args[n]);
+	}
+	resetRunningMinMax();
+	for (uint32_t n = 0; n < numThreads; n++) {
+		pthread_join(threads[n], NULL);
+		for (uint32_t j = 0; j < m_numFeatures; j++) {
+			m_runningMin[j] = (thread_args[n].m_min[j] < m_runningMin[j]) ? thread_args[n].m_min[j] : m_runningMin[j];
+			m_runningMax[j] = (thread_args[n].m_max[j] > m_runningMax[j]) ? thread_args[n].m_max[j] : m_runningMax[j];
+		}
+		free(thread_args[n].m_min);
+		free(thread_args[n].m_max);
+	}
+	free(threads);
+	free(thread_args);
+}
+
+void ColumnStore::NormalizeSamples(NormType norm, NormDirection direction) {
+	NormalizeSamplesParallel(norm, direction, 1);
+}
+
+void ColumnStore::NormalizeSamplesParallel(NormType norm, NormDirection direction, uint32_t numThreads) {
+	requireDenseSamples("NormalizeSamples");
+	deallocRuns();
+
+	double start = get_time();
+
+	m_samplesNorm = norm;
+	m_samplesNormDirection = direction;
+
+	uint32_t numValues = (direction == row) ? m_numSamples : m_numFeatures;
+	m_samplesRange = (float*)realloc(m_samplesRange, numValues*sizeof(float));
+	m_samplesMin = (float*)realloc(m_samplesMin, numValues*sizeof(float));
+
+	if (numThreads == 0) {
+		numThreads = 1;
+	}
+	pthread_t* threads = (pthread_t*)malloc(numThreads*sizeof(pthread_t));
+	normalize_thread_data* thread_args = (normalize_thread_data*)malloc(numThreads*sizeof(normalize_thread_data));
+
+	SplitNormalizeSamples(this, numThreads, thread_args);
+
+	if (direction == row) {
+		for (uint32_t n = 0; n < numThreads; n++) {
+			pthread_create(&threads[n], NULL, normalizeRowsThread, (void*)&thread_args[n]);
+		}
+		resetRunningMinMax();
+		for (uint32_t n = 0; n < numThreads; n++) {
+			pthread_join(threads[n], NULL);
+			for (uint32_t j = 0; j < m_numFeatures; j++) {
+				m_runningMin[j] = (thread_args[n].m_min[j] < m_runningMin[j]) ? thread_args[n].m_min[j] : m_runningMin[j];
+				m_runningMax[j] = (thread_args[n].m_max[j] > m_runningMax[j]) ? thread_args[n].m_max[j] : m_runningMax[j];
+			}
+		}
+	}
+	else {
+		gatherColumnStatistics(numThreads);
+
+		uint32_t startCoordinate = m_samplesBiased ? 1 : 0;
+		m_samplesRange[0] = 0.0;
+		m_samplesMin[0] = 0.0;
+		for (uint32_t j = startCoordinate; j < m_numFeatures; j++) {
+			m_samplesRange[j] = m_runningMax[j] - m_runningMin[j];
+			m_samplesMin[j] = m_runningMin[j];
+		}
+
+		for (uint32_t n = 0; n < numThreads; n++) {
+			pthread_create(&threads[n], NULL, normalizeColumnsThread, (void*)&thread_args[n]);
+		}
+		for (uint32_t n = 0; n < numThreads; n++) {
+			pthread_join(threads[n], NULL);
+		}
+
+		// The normalized columns span exactly the normalization range
+		for (uint32_t j = startCoordinate; j < m_numFeatures; j++) {
+			if (m_samplesRange[j] > 0) {
+				m_runningMin[j] = (norm == MinusOneToOne) ? -1.0 : 0.0;
+				m_runningMax[j] = 1.0;
+			}
+		}
+	}
+
+	for (uint32_t n = 0; n < numThreads; n++) {
+		free(thread_args[n].m_min);
+		free(thread_args[n].m_max);
+	}
+	free(threads);
+	free(thread_args);
+
+	double end = get_time();
+	cout << "Normalization throughput: " << ((double)m_numSamples*m_numFeatures*sizeof(float)/1e6)/(end-start) << " MB/s" << endl;
+}
+
+ColumnNormalization* ColumnStore::CreateColumnNormalization(NormType norm, uint32_t numThreads) {
+	if (m_samplesNormDirection == row && m_samplesRange != nullptr) {
+		cout << "CreateColumnNormalization: the samples are already normalized row by row!" << endl;
+		exit(1);
+	}
+	if (numThreads == 0) {
+		numThreads = 1;
+	}
+	if (m_runningMin == nullptr || !m_runningMinMaxExact) {
+		requireDenseSamples("CreateColumnNormalization");
+		gatherColumnStatistics(numThreads);
+	}
+
+	ColumnNormalization* normalization = new ColumnNormalization(m_numFeatures, norm);
+	uint32_t startCoordinate = m_samplesBiased ? 1 : 0;
+	for (uint32_t j = startCoordinate; j < m_numFeatures; j++) {
+		normalization->SetFeature(j, m_runningMin[j], m_runningMax[j] - m_runningMin[j]);
+	}
+	return normalization;
+}
+
+void ColumnStore::NormalizeLabels(NormType norm, bool binarizeLabels, float labelsToBinarizeTo) {
+	m_labelsNorm = norm;
+
+	if (!binarizeLabels) {
+		float labelsMin = numeric_limits<float>::max();
+		float labelsMax = -numeric_limits<float>::max();
+		for (uint32_t i = 0; i < m_numSamples; i++) {
+			if (m_labels[i] > labelsMax) {
+				labelsMax = m_labels[i];
+			}
+			if (m_labels[i] < labelsMin) {
+				labelsMin = m_labels[i];
+			}
+		}
+		
+		float labelsRange = labelsMax - labelsMin;
+		if (labelsRange > 0) {
+			if (m_labelsNorm == MinusOneToOne) {
+				for (uint32_t i = 0; i < m_numSamples; i++) {
+					m_labels[i] = ((m_labels[i] - labelsMin)/labelsRange)*2.0 - 1.0;
+				}
+			}
+			else {
+				for (uint32_t i = 0; i < m_numSamples; i++) {
+					m_labels[i] = (m_labels[i] - labelsMin)/labelsRange;
+				}
+			}
+		}
+		m_labelsMin = labelsMin;
+		m_labelsRange = labelsRange;
+	}
+	else {
+		for (uint32_t i = 0; i < m_numSamples; i++) {
+			if(m_labels[i] == labelsToBinarizeTo) {
+				m_labels[i] = 1.0;
+			}
+			else {
+				if (m_labelsNorm == MinusOneToOne) {
+					m_labels[i] = -1.0;
+					m_labelsMin = -1.0;
+					m_labelsRange = 2.0;
 				}
 				else {
-					for (uint32_t i = 0; i < m_numSamples; i++) {
-						m_samples[j][i] = ((m_samples[j][i] - samplesMin)/samplesRange);
+					m_labels[i] = 0.0;
+					m_labelsMin = 0.0;
+					m_labelsRange = 1.0;
+				}
+			}
+		}
+	}
+}
+
+float ColumnStore::CompressSamples(uint32_t minibatchSize, uint32_t toIntegerScaler, CompressionCodec codec) {
+	return CompressSamplesParallel(minibatchSize, toIntegerScaler, 1, codec);
+}
+
+float ColumnStore::CompressSamplesParallel(uint32_t minibatchSize, uint32_t toIntegerScaler, uint32_t numThreads, CompressionCodec codec) {
+	requireDenseSamples("CompressSamples");
+	if (m_runsUseCompressed) {
+		deallocRuns();
+	}
+	double start = get_time();
+
+	uint32_t numMinibatches = m_numSamples/minibatchSize;
+	cout << "numMinibatches: " << numMinibatches << endl;
+	uint32_t rest = m_numSamples - numMinibatches*minibatchSize;
+	cout << "rest: " << rest << endl;
+
+	reallocCompressed(numMinibatches, minibatchSize);
+	m_compressedMinibatchSize = minibatchSize;
+	m_compressedToIntegerScaler = toIntegerScaler;
+	for (uint32_t j = 0; j < m_numFeatures; j++) {
+		m_compressedCodecs[j] = (codec == frameOfReferenceCodec) ? frameOfReferenceCodec : lineDeltaCodec;
+	}
+
+	compressMinibatches(0, numMinibatches, numThreads, codec == adaptiveCodec);
+
+	uint32_t numWordsAfterCompression = 0;
+	uint32_t numFrameColumns = 0;
+	for (uint32_t j = 0; j < m_numFeatures; j++) {
+		numWordsAfterCompression += m_compressedSamplesSizes[j][numMinibatches-1];
+		numFrameColumns += (m_compressedCodecs[j] == frameOfReferenceCodec);
+	}
+	if (codec == adaptiveCodec) {
+		cout << "frameOfReferenceCodec columns: " << numFrameColumns << " of " << m_numFeatures << endl;
+	}
+
+	double end = get_time();
+	cout << "Compression throughput: " << ((double)numMinibatches*minibatchSize*m_numFeatures*sizeof(float)/1e6)/(end-start) << " MB/s" << endl;
+
+	float compressionRate = (float)(numMinibatches*minibatchSize*m_numFeatures)/(float)numWordsAfterCompression;
+
+	return compressionRate;
+}
+
+typedef struct {
+	ColumnStore* m_cstore;
+	uint64_t m_firstSegment;
+	uint64_t m_lastSegment;
+	uint32_t m_firstMinibatch;
+	uint32_t m_numMinibatches;
+	uint32_t m_numMismatches;
+} encrypt_thread_data;
+
+// The words of minibatch m of feature j as encrypted, and where they come from (nullptr if the
+// source is gone)
+static uint32_t encryptedMinibatch(ColumnStore* cstore, uint32_t j, uint32_t m, float** original, uint32_t** encrypted) {
+	uint32_t minibatchSize = cstore->m_encryptedMinibatchSize;
+	if (cstore->m_encryptedUseCompressed) {
+		uint32_t compressedSamplesOffset = 0;
+		if (m > 0) {
+			compressedSamplesOffset = cstore->m_compressedSamplesSizes[j][m-1];
+		}
+		*original = (cstore->m_compressedSamples != nullptr) ? (float*)(cstore->m_compressedSamples[j] + compressedSamplesOffset) : nullptr;
+		*encrypted = cstore->m_encryptedSamples[j] + compressedSamplesOffset;
+		return cstore->m_compressedSamplesSizes[j][m] - compressedSamplesOffset;
+	}
+	*original = (cstore->m_samples != nullptr) ? cstore->m_samples[j] + (uint64_t)m*minibatchSize : nullptr;
+	*encrypted = cstore->m_encryptedSamples[j] + (uint64_t)m*minibatchSize;
+	return minibatchSize;
+}
+
+static double encryptedBytes(ColumnStore* cstore, uint32_t numMinibatches) {
+	if (numMinibatches == 0) {
+		return 0;
+	}
+	double numWords = 0;
+	for (uint32_t j = 0; j < cstore->m_numFeatures; j++) {
+		numWords += cstore->m_encryptedUseCompressed ? cstore->m_compressedSamplesSizes[j][numMinibatches-1] : (double)numMinibatches*cstore->m_encryptedMinibatchSize;
+	}
+	return numWords*sizeof(uint32_t);
+}
+
+// A segment is one minibatch of one feature, segment s is minibatch s%m_numMinibatches of feature
+// s/m_numMinibatches. Each has its own CBC chain or CTR nonce, and writes only its own words:
+// CTR stops at the last word, CBC segments are whole blocks (compressed minibatches are padded
+// to 4 words, EncryptSamplesParallel checks the others). So threads share nothing.
+static void* encryptThread(void* args) {
+	encrypt_thread_data* r = (encrypt_thread_data*)args;
+	ColumnStore* cstore = r->m_cstore;
+	float* original;
+	uint32_t* encrypted;
+
+	for (uint64_t s = r->m_firstSegment; s < r->m_lastSegment; s++) {
+		uint32_t j = s/r->m_numMinibatches;
+		uint32_t m = r->m_firstMinibatch + s%r->m_numMinibatches;
+		uint32_t numWords = encryptedMinibatch(cstore, j, m, &original, &encrypted);
+		cstore->encryptColumn(original, numWords, encrypted, j, m);
+	}
+	return nullptr;
+}
+
+static void* decryptThread(void* args) {
+	encrypt_thread_data* r = (encrypt_thread_data*)args;
+	ColumnStore* cstore = r->m_cstore;
+	float* original;
+	uint32_t* encrypted;
+	// CBC decrypts whole blocks
+	uint64_t maxWords = cstore->m_encryptedUseCompressed ? MaxCompressedMinibatchWords(cstore->m_encryptedMinibatchSize) : cstore->m_encryptedMinibatchSize;
+	float* decrypted = (float*)malloc((maxWords + 4)*sizeof(float));
+
+	r->m_numMismatches = 0;
+	for (uint64_t s = r->m_firstSegment; s < r->m_lastSegment; s++) {
+		uint32_t j = s/r->m_numMinibatches;
+		uint32_t m = r->m_firstMinibatch + s%r->m_numMinibatches;
+		uint32_t numWords = encryptedMinibatch(cstore, j, m, &original, &encrypted);
+		cstore->decryptColumn(encrypted, numWords, decrypted, j, m);
+		if (original != nullptr && memcmp(decrypted, original, numWords*sizeof(float)) != 0) {
+			r->m_numMismatches++;
+		}
+	}
+	free(decrypted);
+	return nullptr;
+}
+
+void ColumnStore::EncryptSamples(uint32_t minibatchSize, bool useCompressed, EncryptionMode mode) {
+	EncryptSamplesParallel(minibatchSize, useCompressed, 1, mode);
+}
+
+void ColumnStore::EncryptSamplesParallel(uint32_t minibatchSize, bool useCompressed, uint32_t numThreads, EncryptionMode mode) {
+	uint32_t numMinibatches = m_numSamples/minibatchSize;
+	cout << "numMinibatches: " << numMinibatches << endl;
+	uint32_t rest = m_numSamples - numMinibatches*minibatchSize;
+	cout << "rest: " << rest << endl;
+	cout << "Encryption: " << ((mode == ctrMode) ? "CTR" : "CBC") << ", decryption: " << ((mode == ctrMode) ? "pipelined" : m_cbcDecryptName) << endl;
+
+	if (!useCompressed) {
+		requireDenseSamples("EncryptSamples");
+	}
+	// A CBC minibatch ending in a partial block would overwrite the start of the next one
+	if (mode == cbcMode && !useCompressed && minibatchSize%4 != 0) {
+		cout << "EncryptSamples in cbcMode needs minibatchSize%4 == 0, or ctrMode!" << endl;
+		exit(1);
+	}
+	// Encrypted compressed minibatches sit at the same offsets as the compressed ones
+	reallocEncrypted(useCompressed ? m_compressedCapacity : m_numSamples);
+	m_encryptedMinibatchSize = minibatchSize;
+	m_encryptedUseCompressed = useCompressed;
+	m_encryptionMode = mode;
+	m_encryptedMinibatchBase = 0;
+
+	double start = get_time();
+	encryptMinibatches(0, numMinibatches, numThreads);
+	double end = get_time();
+	cout << "Encryption throughput: " << (encryptedBytes(this, numMinibatches)/1e9)/(end-start) << " GB/s" << endl;
+}
+
+uint32_t ColumnStore::VerifyEncryptedSamples(uint32_t numThreads) {
+	if (m_encryptedSamples == nullptr) {
+		cout << "VerifyEncryptedSamples needs encrypted samples!" << endl;
+		exit(1);
+	}
+	uint32_t numMinibatches = m_numSamples/m_encryptedMinibatchSize;
+
+	double start = get_time();
+	uint32_t numMismatches = decryptMinibatches(0, numMinibatches, numThreads);
+	double end = get_time();
+	cout << "Decryption throughput: " << (encryptedBytes(this, numMinibatches)/1e9)/(end-start) << " GB/s" << endl;
+	if (numMismatches > 0) {
+		cout << numMismatches << " encrypted minibatches do not decrypt to their samples!" << endl;
+	}
+	return numMismatches;
+}
+
+typedef struct {
+	ColumnStore* m_cstore;
+	uint32_t m_firstFeature;
+	uint32_t m_numFeaturesToProcess;
+	uint32_t m_firstMinibatch;
+	uint32_t m_lastMinibatch;
+	bool m_chooseCodecs;
+} compress_thread_data;
+
+// Each feature is compressed into its own column, the sizes of its minibatches are cumulative
+// per feature, so threads working on different features share nothing
+static void* compressThread(void* args) {
+	compress_thread_data* r = (compress_thread_data*)args;
+	ColumnStore* cstore = r->m_cstore;
+	uint32_t minibatchSize = cstore->m_compressedMinibatchSize;
+
+	for (uint32_t j = r->m_firstFeature; j < r->m_firstFeature + r->m_numFeaturesToProcess; j++) {
+		if (r->m_chooseCodecs) {
+			cstore->m_compressedCodecs[j] = cstore->ChooseCodec(j);
+		}
+		for (uint32_t m = r->m_firstMinibatch; m < r->m_lastMinibatch; m++) {
+			uint32_t compressedSamplesOffset = 0;
+			if (m > 0) {
+				compressedSamplesOffset = cstore->m_compressedSamplesSizes[j][m-1];
+			}
+			uint32_t numWordsInBatch = ColumnStore::compressColumn(cstore->m_samples[j] + m*minibatchSize, minibatchSize, cstore->m_compressedSamples[j] + compressedSamplesOffset, cstore->m_compressedToIntegerScaler, cstore->m_compressedCodecs[j]);
+			if (numWordsInBatch%4 > 0) {
+				numWordsInBatch += (4 - numWordsInBatch%4);
+			}
+			cstore->m_compressedSamplesSizes[j][m] = compressedSamplesOffset + numWordsInBatch;
+		}
+	}
+	return nullptr;
+}
+
+void ColumnStore::compressMinibatches(uint32_t firstMinibatch, uint32_t lastMinibatch, uint32_t numThreads, bool chooseCodecs) {
+	if (numThreads == 0) {
+		numThreads = 1;
+	}
+	if (numThreads > m_numFeatures) {
+		numThreads = m_numFeatures;
+	}
+	compress_thread_data* thread_args = (compress_thread_data*)malloc(numThreads*sizeof(compress_thread_data));
+	uint32_t firstFeature = 0;
+	for (uint32_t n = 0; n < numThreads; n++) {
+		thread_args[n].m_cstore = this;
+		thread_args[n].m_firstFeature = firstFeature;
+		thread_args[n].m_numFeaturesToProcess = m_numFeatures/numThreads + (n < m_numFeatures%numThreads);
+		thread_args[n].m_firstMinibatch = firstMinibatch;
+		thread_args[n].m_lastMinibatch = lastMinibatch;
+		thread_args[n].m_chooseCodecs = chooseCodecs;
+		firstFeature += thread_args[n].m_numFeaturesToProcess;
+	}
+	if (numThreads == 1) {
+		compressThread((void*)&thread_args[0]);
+	}
+	else {
+		pthread_t* threads = (pthread_t*)malloc(numThreads*sizeof(pthread_t));
+		for (uint32_t n = 0; n < numThreads; n++) {
+			pthread_create(&threads[n], NULL, compressThread, (void*)&thread_args[n]);
+		}
+		for (uint32_t n = 0; n < numThreads; n++) {
+			pthread_join(threads[n], NULL);
+		}
+		free(threads);
+	}
+	free(thread_args);
+}
+
+// Runs threadFunction over the segments of minibatches [firstMinibatch, lastMinibatch) of all
+// features, split evenly over numThreads threads. Returns the sum of their m_numMismatches.
+static uint32_t runEncryptThreads(ColumnStore* cstore, void* (*threadFunction)(void*), uint32_t firstMinibatch, uint32_t lastMinibatch, uint32_t numThreads) {
+	uint32_t numMinibatches = lastMinibatch - firstMinibatch;
+	uint64_t numSegments = (uint64_t)cstore->m_numFeatures*numMinibatches;
+	if (numThreads > numSegments) {
+		numThreads = numSegments;
+	}
+	if (numThreads == 0) {
+		numThreads = 1;
+	}
+	encrypt_thread_data* thread_args = (encrypt_thread_data*)malloc(numThreads*sizeof(encrypt_thread_data));
+	uint64_t firstSegment = 0;
+	for (uint32_t n = 0; n < numThreads; n++) {
+		thread_args[n].m_cstore = cstore;
+		thread_args[n].m_firstSegment = firstSegment;
+		thread_args[n].m_lastSegment = firstSegment + numSegments/numThreads + (n < numSegments%numThreads);
+		thread_args[n].m_firstMinibatch = firstMinibatch;
+		thread_args[n].m_numMinibatches = numMinibatches;
+		thread_args[n].m_numMismatches = 0;
+		firstSegment = thread_args[n].m_lastSegment;
+	}
+	if (numThreads == 1) {
+		threadFunction((void*)&thread_args[0]);
+	}
+	else {
+		pthread_t* threads = (pthread_t*)malloc(numThreads*sizeof(pthread_t));
+		for (uint32_t n = 0; n < numThreads; n++) {
+			pthread_create(&threads[n], NULL, threadFunction, (void*)&thread_args[n]);
+		}
+		for (uint32_t n = 0; n < numThreads; n++) {
+			pthread_join(threads[n], NULL);
+		}
+		free(threads);
+	}
+	uint32_t numMismatches = 0;
+	for (uint32_t n = 0; n < numThreads; n++) {
+		numMismatches += thread_args[n].m_numMismatches;
+	}
+	free(thread_args);
+	return numMismatches;
+}
+
+void ColumnStore::encryptMinibatches(uint32_t firstMinibatch, uint32_t lastMinibatch, uint32_t numThreads) {
+	runEncryptThreads(this, encryptThread, firstMinibatch, lastMinibatch, numThreads);
+}
+
+uint32_t ColumnStore::decryptMinibatches(uint32_t firstMinibatch, uint32_t lastMinibatch, uint32_t numThreads) {
+	return runEncryptThreads(this, decryptThread, firstMinibatch, lastMinibatch, numThreads);
+}
+
+void ColumnStore::growColumns(void** columns, uint64_t usedBytes, uint64_t newBytes, HugePageArena* &arena, bool owned) {
+	void** grown = (void**)malloc(m_numFeatures*sizeof(void*));
+	HugePageArena* grownArena = nullptr;
+	allocColumns(grown, newBytes, grownArena);
+	for (uint32_t j = 0; j < m_numFeatures; j++) {
+		memcpy(grown[j], columns[j], usedBytes);
+	}
+	if (owned) {
+		freeColumns(columns, arena);
+	}
+	memcpy(columns, grown, m_numFeatures*sizeof(void*));
+	arena = grownArena;
+	free(grown);
+}
+
+void ColumnStore::growSamples(uint32_t capacity) {
+	growColumns((void**)m_samples, (uint64_t)m_numSamples*sizeof(float), (uint64_t)capacity*sizeof(float), m_samplesArena, !m_samplesMapped);
+
+	float* labels = (float*)aligned_alloc(64, (uint64_t)capacity*sizeof(float));
+	memcpy(labels, m_labels, m_numSamples*sizeof(float));
+	if (!m_samplesMapped) {
+		free(m_labels);
+	}
+	m_labels = labels;
+	// Mapped columns were copied, from now on the store owns them
+	m_samplesMapped = false;
+
+	if (m_samplesMin != nullptr && m_samplesNormDirection == row) {
+		m_samplesRange = (float*)realloc(m_samplesRange, capacity*sizeof(float));
+		m_samplesMin = (float*)realloc(m_samplesMin, capacity*sizeof(float));
+	}
+	m_samplesCapacity = capacity;
+}
+
+void ColumnStore::AppendSamples(float* samples, float* labels, uint32_t numNewSamples) {
+	requireDenseSamples("AppendSamples");
+	if (numNewSamples == 0) {
+		return;
+	}
+	deallocRuns();
+	uint32_t oldNumSamples = m_numSamples;
+	uint32_t numSamples = m_numSamples + numNewSamples;
+	uint32_t firstFeature = m_samplesBiased ? 1 : 0;
+	uint32_t numRawFeatures = m_numFeatures - firstFeature;
+
+	// Geometric growth, so that appending n samples in small steps copies O(n) samples
+	if (numSamples > max(m_samplesCapacity, m_numSamples)) {
+		growSamples(max(numSamples, 2*m_numSamples));
+	}
+
+	if (m_runningMin == nullptr) {
+		resetRunningMinMax();
+		for (uint32_t j = 0; j < m_numFeatures; j++) {
+			AccumulateMinMax(m_samples[j], m_numSamples, m_runningMin[j], m_runningMax[j]);
+		}
+	}
+
+	for (uint32_t i = 0; i < numNewSamples; i++) {
+		uint32_t k = oldNumSamples + i;
+		float* sample = samples + (uint64_t)i*numRawFeatures;
+		if (m_samplesBiased) {
+			m_samples[0][k] = 1.0;
+		}
+		for (uint32_t j = 0; j < numRawFeatures; j++) {
+			m_samples[firstFeature + j][k] = sample[j];
+		}
+		m_labels[k] = (labels != nullptr) ? labels[i] : 0;
+
+		// Same normalization as NormalizeSamples applied to the samples already in the store
+		if (m_samplesMin != nullptr && m_samplesNormDirection == row) {
+			float samplesMin = numeric_limits<float>::max();
+			float samplesMax = -numeric_limits<float>::max();
+			for (uint32_t j = 0; j < m_numFeatures; j++) {
+				samplesMin = (m_samples[j][k] < samplesMin) ? m_samples[j][k] : samplesMin;
+				samplesMax = (m_samples[j][k] > samplesMax) ? m_samples[j][k] : samplesMax;
+			}
+			float samplesRange = samplesMax - samplesMin;
+			if (samplesRange > 0) {
+				for (uint32_t j = 0; j < m_numFeatures; j++) {
+					m_samples[j][k] = (m_samples[j][k] - samplesMin)/samplesRange;
+					if (m_samplesNorm == MinusOneToOne) {
+						m_samples[j][k] = m_samples[j][k]*2.0-1.0;
+					}
+				}
+			}
+			m_samplesRange[k] = samplesRange;
+			m_samplesMin[k] = samplesMin;
+		}
+		else if (m_samplesMin != nullptr) {
+			for (uint32_t j = firstFeature; j < m_numFeatures; j++) {
+				if (m_samplesRange[j] > 0) {
+					m_samples[j][k] = (m_samples[j][k] - m_samplesMin[j])/m_samplesRange[j];
+					if (m_samplesNorm == MinusOneToOne) {
+						m_samples[j][k] = m_samples[j][k]*2.0-1.0;
 					}
 				}
 			}
-			m_samplesRange[j] = samplesRange;
-			m_samplesMin[j] = samplesMin;
 		}
+
+		for (uint32_t j = 0; j < m_numFeatures; j++) {
+			m_runningMin[j] = (m_samples[j][k] < m_runningMin[j]) ? m_samples[j][k] : m_runningMin[j];
+			m_runningMax[j] = (m_samples[j][k] > m_runningMax[j]) ? m_samples[j][k] : m_runningMax[j];
+		}
+	}
+	m_numSamples = numSamples;
+
+	// Only the minibatches the new samples completed are compressed and encrypted
+	if (m_compressedSamples != nullptr) {
+		uint32_t minibatchSize = m_compressedMinibatchSize;
+		uint32_t firstMinibatch = oldNumSamples/minibatchSize;
+		uint32_t lastMinibatch = m_numSamples/minibatchSize;
+		if (lastMinibatch > m_compressedSizesCapacity || m_compressedMapped) {
+			uint32_t sizesCapacity = max(lastMinibatch, 2*m_compressedSizesCapacity);
+			for (uint32_t j = 0; j < m_numFeatures; j++) {
+				uint32_t* sizes = (uint32_t*)aligned_alloc(64, sizesCapacity*sizeof(uint32_t));
+				memcpy(sizes, m_compressedSamplesSizes[j], firstMinibatch*sizeof(uint32_t));
+				if (!m_compressedMapped) {
+					free(m_compressedSamplesSizes[j]);
+				}
+				m_compressedSamplesSizes[j] = sizes;
+			}
+			m_compressedSizesCapacity = sizesCapacity;
+		}
+		uint64_t maxUsedWords = 0;
+		for (uint32_t j = 0; j < m_numFeatures && firstMinibatch > 0; j++) {
+			maxUsedWords = max(maxUsedWords, (uint64_t)m_compressedSamplesSizes[j][firstMinibatch-1]);
+		}
+		uint64_t neededWords = maxUsedWords + (lastMinibatch - firstMinibatch)*MaxCompressedMinibatchWords(minibatchSize);
+		if (neededWords > m_compressedCapacity || m_compressedMapped) {
+			uint32_t compressedCapacity = max(neededWords, 2*(uint64_t)m_compressedCapacity);
+			growColumns((void**)m_compressedSamples, maxUsedWords*sizeof(uint32_t), (uint64_t)compressedCapacity*sizeof(uint32_t), m_compressedArena, !m_compressedMapped);
+			m_compressedCapacity = compressedCapacity;
+			m_compressedMapped = false;
+		}
+		compressMinibatches(firstMinibatch, lastMinibatch, 1, false);
+	}
+	if (m_encryptedSamples != nullptr) {
+		uint32_t minibatchSize = m_encryptedMinibatchSize;
+		uint32_t firstMinibatch = oldNumSamples/minibatchSize;
+		uint32_t lastMinibatch = m_numSamples/minibatchSize;
+		// Encrypted compressed minibatches sit at the same offsets as the compressed ones
+		uint32_t neededCapacity = m_encryptedUseCompressed ? m_compressedCapacity : lastMinibatch*minibatchSize;
+		if (neededCapacity > m_encryptedCapacity || m_encryptedMapped) {
+			uint32_t encryptedCapacity = m_encryptedUseCompressed ? m_compressedCapacity : max(neededCapacity, 2*m_encryptedCapacity);
+			uint64_t usedWords = (uint64_t)firstMinibatch*minibatchSize;
+			if (m_encryptedUseCompressed) {
+				usedWords = 0;
+				for (uint32_t j = 0; j < m_numFeatures && firstMinibatch > 0; j++) {
+					usedWords = max(usedWords, (uint64_t)m_compressedSamplesSizes[j][firstMinibatch-1]);
+				}
+			}
+			growColumns((void**)m_encryptedSamples, usedWords*sizeof(uint32_t), (uint64_t)encryptedCapacity*sizeof(uint32_t), m_encryptedArena, !m_encryptedMapped);
+			m_encryptedCapacity = encryptedCapacity;
+			m_encryptedMapped = false;
+		}
+		encryptMinibatches(firstMinibatch, lastMinibatch, 1);
+	}
+
+	if (m_windowNumMinibatches > 0 && m_numSamples > m_windowNumMinibatches*m_windowMinibatchSize) {
+		uint32_t excess = m_numSamples - m_windowNumMinibatches*m_windowMinibatchSize;
+		dropOldestMinibatches(excess/m_windowMinibatchSize + (excess%m_windowMinibatchSize > 0), m_windowMinibatchSize);
+	}
+
+	cout << "Appended " << numNewSamples << " samples, m_numSamples: " << m_numSamples << endl;
+}
+
+void ColumnStore::AppendRawData(char* pathToFile, uint32_t numSamples, bool labelPresent) {
+	cout << "AppendRawData is reading " << pathToFile << endl;
+
+	FILE* f = fopen(pathToFile, "r");
+	if (f == NULL) {
+		cout << "Can't find files at pathToFile" << endl;
+		exit(1);
+	}
+
+	uint32_t numRawFeatures = m_samplesBiased ? m_numFeatures-1 : m_numFeatures;
+	uint32_t rowSize = labelPresent ? numRawFeatures+1 : numRawFeatures;
+	double* temp = (double*)malloc((uint64_t)numSamples*rowSize*sizeof(double));
+	size_t readsize = fread(temp, sizeof(double), (uint64_t)numSamples*rowSize, f);
+	numSamples = readsize/rowSize;
+
+	float* samples = (float*)malloc((uint64_t)numSamples*numRawFeatures*sizeof(float));
+	float* labels = (float*)malloc(numSamples*sizeof(float));
+	for (uint32_t i = 0; i < numSamples; i++) {
+		labels[i] = labelPresent ? (float)temp[(uint64_t)i*rowSize] : 0;
+		for (uint32_t j = 0; j < numRawFeatures; j++) {
+			samples[(uint64_t)i*numRawFeatures + j] = (float)temp[(uint64_t)i*rowSize + (labelPresent ? 1 : 0) + j];
+		}
+	}
+	free(temp);
+	fclose(f);
+
+	AppendSamples(samples, labels, numSamples);
+
+	free(samples);
+	free(labels);
+}
+
+void ColumnStore::SetSlidingWindow(uint32_t numMinibatches, uint32_t minibatchSize) {
+	if (numMinibatches > 0 && ((m_compressedSamples != nullptr && m_compressedMinibatchSize != minibatchSize) || (m_encryptedSamples != nullptr && m_encryptedMinibatchSize != minibatchSize))) {
+		cout << "The sliding window has to drop whole compressed and encrypted minibatches!" << endl;
+		exit(1);
+	}
+	m_windowNumMinibatches = numMinibatches;
+	m_windowMinibatchSize = minibatchSize;
+}
+
+void ColumnStore::dropOldestMinibatches(uint32_t numMinibatches, uint32_t minibatchSize) {
+	deallocRuns();
+	uint32_t numDropped = numMinibatches*minibatchSize;
+	uint32_t numKept = m_numSamples - numDropped;
+
+	for (uint32_t j = 0; j < m_numFeatures; j++) {
+		memmove(m_samples[j], m_samples[j] + numDropped, numKept*sizeof(float));
+	}
+	memmove(m_labels, m_labels + numDropped, numKept*sizeof(float));
+	if (m_samplesMin != nullptr && m_samplesNormDirection == row) {
+		memmove(m_samplesRange, m_samplesRange + numDropped, numKept*sizeof(float));
+		memmove(m_samplesMin, m_samplesMin + numDropped, numKept*sizeof(float));
+	}
+
+	// Minibatches are compressed and encrypted independently, so the remaining ones only move
+	uint32_t numCompressedMinibatches = m_numSamples/minibatchSize;
+	for (uint32_t j = 0; j < m_numFeatures; j++) {
+		if (m_compressedSamples != nullptr) {
+			uint32_t droppedWords = m_compressedSamplesSizes[j][numMinibatches-1];
+			uint32_t keptWords = m_compressedSamplesSizes[j][numCompressedMinibatches-1] - droppedWords;
+			memmove(m_compressedSamples[j], m_compressedSamples[j] + droppedWords, keptWords*sizeof(uint32_t));
+			if (m_encryptedSamples != nullptr && m_encryptedUseCompressed) {
+				memmove(m_encryptedSamples[j], m_encryptedSamples[j] + droppedWords, keptWords*sizeof(uint32_t));
+			}
+			for (uint32_t m = 0; m < numCompressedMinibatches - numMinibatches; m++) {
+				m_compressedSamplesSizes[j][m] = m_compressedSamplesSizes[j][m + numMinibatches] - droppedWords;
+			}
+		}
+		if (m_encryptedSamples != nullptr && !m_encryptedUseCompressed) {
+			memmove(m_encryptedSamples[j], m_encryptedSamples[j] + numDropped, (numCompressedMinibatches - numMinibatches)*minibatchSize*sizeof(uint32_t));
+		}
+	}
+	m_numSamples = numKept;
+	m_runningMinMaxExact = false;
+	// The kept minibatches keep their CTR nonces
+	m_encryptedMinibatchBase += numMinibatches;
+	cout << "Sliding window dropped " << numDropped << " samples" << endl;
+}
+
+void ColumnStore::ReduceSamplesPrecision(SamplesPrecision precision) {
+	if (precision == fp32) {
+		return;
+	}
+	requireDenseSamples("ReduceSamplesPrecision");
+	deallocRuns();
+
+	float** samples = m_samples;
+	m_samples = nullptr;
+	m_halfSamples = (uint16_t**)malloc(m_numFeatures*sizeof(uint16_t*));
+	allocColumns((void**)m_halfSamples, m_numSamples*sizeof(uint16_t), m_halfArena);
+	m_samplesPrecision = precision;
+
+	double maxError = 0;
+	for (uint32_t j = 0; j < m_numFeatures; j++) {
+		for (uint32_t i = 0; i < m_numSamples; i++) {
+			m_halfSamples[j][i] = (precision == fp16) ? FloatToHalf(samples[j][i]) : FloatToBfloat(samples[j][i]);
+			double error = fabs((double)GetHalfSample(j, i) - (double)samples[j][i]);
+			if (error > maxError) {
+				maxError = error;
+			}
+		}
+		// Arena columns go all at once below
+		if (!m_samplesMapped && m_samplesArena == nullptr) {
+			free(samples[j]);
+		}
+	}
+	free(samples);
+	if (m_samplesArena != nullptr) {
+		delete m_samplesArena;
+		m_samplesArena = nullptr;
+	}
+
+	cout << "Samples stored as " << ((precision == fp16) ? "fp16" : "bf16") << ", max absolute error: " << maxError << endl;
+}
+
+void ColumnStore::QuantizeSamples(uint32_t numBits, uint64_t seed) {
+	if (numBits != 8 && numBits != 4 && numBits != 2) {
+		cout << "QuantizeSamples supports 8, 4 and 2 bits!" << endl;
+		exit(1);
+	}
+	requireDenseSamples("QuantizeSamples");
+	deallocRuns();
+
+	float** samples = m_samples;
+	m_samples = nullptr;
+	m_quantizedSamples = (uint8_t**)malloc(m_numFeatures*sizeof(uint8_t*));
+	m_quantizedScale = (float*)malloc(m_numFeatures*sizeof(float));
+	m_quantizedMin = (float*)malloc(m_numFeatures*sizeof(float));
+	m_quantizedBits = numBits;
+
+	uint32_t maxLevel = (1 << numBits) - 1;
+	// Padded, so that the kernels can always load a full word
+	uint64_t numBytes = ((uint64_t)m_numSamples*numBits + 7)/8 + 32;
+	allocColumns((void**)m_quantizedSamples, numBytes, m_quantizedArena);
+	double squaredError = 0;
+	for (uint32_t j = 0; j < m_numFeatures; j++) {
+		float columnMin = numeric_limits<float>::max();
+		float columnMax = -numeric_limits<float>::max();
+		for (uint32_t i = 0; i < m_numSamples; i++) {
+			columnMin = (samples[j][i] < columnMin) ? samples[j][i] : columnMin;
+			columnMax = (samples[j][i] > columnMax) ? samples[j][i] : columnMax;
+		}
+		m_quantizedMin[j] = columnMin;
+		m_quantizedScale[j] = (columnMax > columnMin) ? (columnMax - columnMin)/(float)maxLevel : 1.0;
+
+		memset(m_quantizedSamples[j], 0, numBytes);
+		for (uint32_t i = 0; i < m_numSamples; i++) {
+			// Stochastic rounding: unbiased, E[level] equals the scaled value
+			float scaled = (samples[j][i] - columnMin)/m_quantizedScale[j];
+			uint32_t level = (uint32_t)scaled;
+			if (level > maxLevel) {
+				level = maxLevel;
+			}
+			if (level < maxLevel && CounterUniform(seed, (uint64_t)j*m_numSamples + i) < scaled - (float)level) {
+				level++;
+			}
+			uint64_t bit = (uint64_t)i*numBits;
+			m_quantizedSamples[j][bit/8] |= (uint8_t)(level << (bit%8));
+
+			double error = (double)GetQuantizedSample(j, i) - (double)samples[j][i];
+			squaredError += error*error;
+		}
+		// Arena columns go all at once below
+		if (!m_samplesMapped && m_samplesArena == nullptr) {
+			free(samples[j]);
+		}
+	}
+	free(samples);
+	if (m_samplesArena != nullptr) {
+		delete m_samplesArena;
+		m_samplesArena = nullptr;
+	}
+
+	cout << "Samples quantized to " << numBits << " bits, RMS error: " << sqrt(squaredError/((double)m_numSamples*m_numFeatures)) << endl;
+}
+
+void ColumnStore::DictionaryEncodeSamples(uint32_t maxDictionarySize) {
+	if (maxDictionarySize < 2 || maxDictionarySize > DICTIONARY_MAX_SIZE) {
+		cout << "DictionaryEncodeSamples supports dictionaries of 2 to " << DICTIONARY_MAX_SIZE << " values!" << endl;
+		exit(1);
+	}
+	requireDenseSamples("DictionaryEncodeSamples");
+
+	float** samples = m_samples;
+	m_samples = nullptr;
+	m_dictionaryCodes = (uint8_t**)malloc(m_numFeatures*sizeof(uint8_t*));
+	m_dictionaryValues = (float**)malloc(m_numFeatures*sizeof(float*));
+	m_dictionarySizes = (uint32_t*)malloc(m_numFeatures*sizeof(uint32_t));
+	m_dictionaryPlain = (float**)malloc(m_numFeatures*sizeof(float*));
+
+	// Open addressing over the bits of the values, so that e.g. -0 and 0 get separate codes
+	const uint32_t tableSize = 2*DICTIONARY_MAX_SIZE;
+	uint32_t tableBits[tableSize];
+	int32_t tableCodes[tableSize];
+	uint32_t numEncoded = 0;
+	uint64_t encodedBytes = 0;
+	for (uint32_t j = 0; j < m_numFeatures; j++) {
+		// Padded, so that the kernels can always load 8 codes and 8 values
+		uint8_t* codes = (uint8_t*)aligned_alloc(64, ((uint64_t)m_numSamples + 32 + 63)/64*64);
+		float* values = (float*)aligned_alloc(64, DICTIONARY_MAX_SIZE*sizeof(float));
+		memset(values, 0, DICTIONARY_MAX_SIZE*sizeof(float));
+		memset(tableCodes, -1, tableSize*sizeof(int32_t));
+		uint32_t size = 0;
+		uint32_t i = 0;
+		for (; i < m_numSamples; i++) {
+			uint32_t bits;
+			memcpy(&bits, samples[j] + i, sizeof(uint32_t));
+			uint32_t slot = (bits*2654435761U) >> 23;
+			while (tableCodes[slot] >= 0 && tableBits[slot] != bits) {
+				slot = (slot + 1)%tableSize;
+			}
+			if (tableCodes[slot] < 0) {
+				if (size == maxDictionarySize) {
+					break;
+				}
+				tableBits[slot] = bits;
+				tableCodes[slot] = size;
+				values[size++] = samples[j][i];
+			}
+			codes[i] = (uint8_t)tableCodes[slot];
+		}
+
+		if (i < m_numSamples) {
+			free(codes);
+			free(values);
+			m_dictionaryCodes[j] = nullptr;
+			m_dictionaryValues[j] = nullptr;
+			m_dictionarySizes[j] = 0;
+			if (!m_samplesMapped && m_samplesArena == nullptr) {
+				m_dictionaryPlain[j] = samples[j];
+				continue;
+			}
+			m_dictionaryPlain[j] = (float*)aligned_alloc(64, ((uint64_t)m_numSamples*sizeof(float) + 63)/64*64);
+			memcpy(m_dictionaryPlain[j], samples[j], m_numSamples*sizeof(float));
+			continue;
+		}
+		memset(codes + m_numSamples, 0, 32);
+		m_dictionaryCodes[j] = codes;
+		m_dictionaryValues[j] = values;
+		m_dictionarySizes[j] = size;
+		m_dictionaryPlain[j] = nullptr;
+		numEncoded++;
+		encodedBytes += m_numSamples;
+		// Arena columns go all at once below
+		if (!m_samplesMapped && m_samplesArena == nullptr) {
+			free(samples[j]);
+		}
+	}
+	free(samples);
+	if (m_samplesArena != nullptr) {
+		delete m_samplesArena;
+		m_samplesArena = nullptr;
+	}
+
+	cout << "Dictionary encoded " << numEncoded << " of " << m_numFeatures << " features, codes take " << (double)encodedBytes/(1024*1024) << " MB" << endl;
+}
+
+// Appends sample i with the given value to the runs of a column, false once there are more than maxRuns
+static inline bool appendRun(uint32_t* starts, float* values, uint32_t &numRuns, uint32_t maxRuns, uint32_t i, float value) {
+	// Compared by bits, so that a NaN continues a run of the same NaN
+	if (numRuns > 0 && memcmp(&values[numRuns-1], &value, sizeof(float)) == 0) {
+		return true;
+	}
+	if (numRuns == maxRuns) {
+		return false;
+	}
+	starts[numRuns] = i;
+	values[numRuns] = value;
+	numRuns++;
+	return true;
+}
+
+uint32_t ColumnStore::FindRunColumns(uint32_t maxRuns, bool useCompressed) {
+	if (useCompressed && m_compressedSamples == nullptr) {
+		cout << "FindRunColumns needs compressed samples!" << endl;
+		exit(1);
+	}
+	if (!useCompressed && !IsSparse() && m_samples == nullptr && m_paxSamples == nullptr && m_halfSamples == nullptr && m_quantizedSamples == nullptr && m_dictionaryCodes == nullptr) {
+		cout << "FindRunColumns needs the samples in memory!" << endl;
+		exit(1);
+	}
+	if (maxRuns == 0 || m_numSamples == 0) {
+		return 0;
+	}
+	deallocRuns();
+
+	m_runStarts = (uint32_t**)malloc(m_numFeatures*sizeof(uint32_t*));
+	m_runValues = (float**)malloc(m_numFeatures*sizeof(float*));
+	m_numRuns = (uint32_t*)malloc(m_numFeatures*sizeof(uint32_t));
+	uint32_t* starts = (uint32_t*)malloc((maxRuns + 1)*sizeof(uint32_t));
+	float* values = (float*)malloc(maxRuns*sizeof(float));
+	uint32_t numRunColumns = 0;
+	uint64_t numRunSamples = 0;
+	uint32_t numCompressedMinibatches = 0;
+	float* decoded = nullptr;
+	if (useCompressed) {
+		numCompressedMinibatches = m_numSamples/m_compressedMinibatchSize;
+		decoded = (float*)aligned_alloc(64, ((uint64_t)m_compressedMinibatchSize*sizeof(float) + 63)/64*64);
+	}
+	m_runsUseCompressed = useCompressed;
+	for (uint32_t j = 0; j < m_numFeatures; j++) {
+		uint32_t numRuns = 0;
+		bool fits = true;
+		if (useCompressed) {
+			// The values the compressed kernels see, the samples past the last minibatch are not compressed
+			for (uint32_t m = 0; m < numCompressedMinibatches && fits; m++) {
+				uint32_t compressedSamplesOffset = (m > 0) ? m_compressedSamplesSizes[j][m-1] : 0;
+				decompressColumn(m_compressedSamples[j] + compressedSamplesOffset, m_compressedSamplesSizes[j][m] - compressedSamplesOffset, decoded, m_compressedToIntegerScaler, m_compressedCodecs[j]);
+				for (uint32_t i = 0; i < m_compressedMinibatchSize && fits; i++) {
+					fits = appendRun(starts, values, numRuns, maxRuns, m*m_compressedMinibatchSize + i, decoded[i]);
+				}
+			}
+			for (uint32_t i = numCompressedMinibatches*m_compressedMinibatchSize; i < m_numSamples && fits; i++) {
+				fits = appendRun(starts, values, numRuns, maxRuns, i, GetSample(j, i));
+			}
+		}
+		else if (IsSparse()) {
+			// The samples between two nonzeros are zero
+			uint32_t next = 0;
+			for (uint32_t k = 0; k < m_sparseNnz[j] && fits; k++) {
+				uint32_t row = m_sparseRows[j][k];
+				if (row > next) {
+					fits = appendRun(starts, values, numRuns, maxRuns, next, 0);
+				}
+				fits = fits && appendRun(starts, values, numRuns, maxRuns, row, m_sparseValues[j][k]);
+				next = row + 1;
+			}
+			if (fits && next < m_numSamples) {
+				fits = appendRun(starts, values, numRuns, maxRuns, next, 0);
+			}
+		}
+		else {
+			for (uint32_t i = 0; i < m_numSamples && fits; i++) {
+				fits = appendRun(starts, values, numRuns, maxRuns, i, GetSample(j, i));
+			}
+		}
+
+		if (!fits) {
+			m_runStarts[j] = nullptr;
+			m_runValues[j] = nullptr;
+			m_numRuns[j] = 0;
+			continue;
+		}
+		starts[numRuns] = m_numSamples;
+		m_runStarts[j] = (uint32_t*)malloc((numRuns + 1)*sizeof(uint32_t));
+		m_runValues[j] = (float*)malloc(numRuns*sizeof(float));
+		memcpy(m_runStarts[j], starts, (numRuns + 1)*sizeof(uint32_t));
+		memcpy(m_runValues[j], values, numRuns*sizeof(float));
+		m_numRuns[j] = numRuns;
+		numRunColumns++;
+		numRunSamples += m_numSamples;
+	}
+	free(starts);
+	free(values);
+	free(decoded);
+
+	cout << "Run-length columns: " << numRunColumns << " of " << m_numFeatures << ", " << (double)numRunSamples*sizeof(float)/(1024*1024) << " MB not read by the SCD kernels" << endl;
+	return numRunColumns;
+}
+
+void ColumnStore::SetSamplesLayout(SamplesLayout layout, uint32_t chunkSize) {
+	if (layout == GetSamplesLayout()) {
+		return;
+	}
+
+	if (layout == paxLayout) {
+		if (chunkSize == 0 || chunkSize%8 > 0) {
+			cout << "PAX layout needs chunkSize%8 == 0!" << endl;
+			exit(1);
+		}
+		requireDenseSamples("SetSamplesLayout");
+		uint64_t numChunks = m_numSamples/chunkSize + (m_numSamples%chunkSize > 0);
+
+		uint64_t numBytes = numChunks*m_numFeatures*chunkSize*sizeof(float);
+		if (m_arenaPageSize != noArena) {
+			m_paxArena = new HugePageArena(numBytes, m_arenaPageSize);
+			m_paxSamples = (float*)m_paxArena->Allocate(numBytes, 0);
+		}
+		else {
+			m_paxSamples = (float*)aligned_alloc(64, numBytes);
+		}
+		m_paxChunkSize = chunkSize;
+
+		for (uint32_t c = 0; c < numChunks; c++) {
+			uint32_t count = (c == numChunks-1) ? m_numSamples - c*chunkSize : chunkSize;
+			for (uint32_t j = 0; j < m_numFeatures; j++) {
+				float* slice = GetPaxSlice(j, c);
+				memcpy(slice, m_samples[j] + (uint64_t)c*chunkSize, count*sizeof(float));
+				memset(slice + count, 0, (chunkSize - count)*sizeof(float));
+			}
+		}
+
+		if (!m_samplesMapped) {
+			freeColumns((void**)m_samples, m_samplesArena);
+		}
+		free(m_samples);
+		m_samples = nullptr;
+		cout << "Samples stored in PAX layout, chunkSize: " << chunkSize << endl;
+	}
+	else {
+		uint64_t numChunks = m_numSamples/m_paxChunkSize + (m_numSamples%m_paxChunkSize > 0);
+		m_samples = (float**)malloc(m_numFeatures*sizeof(float*));
+		allocColumns((void**)m_samples, m_numSamples*sizeof(float), m_samplesArena);
+		for (uint32_t c = 0; c < numChunks; c++) {
+			uint32_t count = (c == numChunks-1) ? m_numSamples - c*m_paxChunkSize : m_paxChunkSize;
+			for (uint32_t j = 0; j < m_numFeatures; j++) {
+				memcpy(m_samples[j] + (uint64_t)c*m_paxChunkSize, GetPaxSlice(j, c), count*sizeof(float));
+			}
+		}
+		// The new columns are ours, so the labels have to be as well
+		if (m_samplesMapped) {
+			float* labels = (float*)aligned_alloc(64, m_numSamples*sizeof(float));
+			memcpy(labels, m_labels, m_numSamples*sizeof(float));
+			m_labels = labels;
+			m_samplesMapped = false;
+		}
+		deallocPax();
+		cout << "Samples stored in column layout" << endl;
+	}
+}
+
+void ColumnStore::SparsifySamples() {
+	requireDenseSamples("SparsifySamples");
+
+	float** samples = m_samples;
+	m_samples = nullptr;
+	reallocSparse();
+
+	for (uint32_t j = 0; j < m_numFeatures; j++) {
+		uint32_t nnz = 0;
+		for (uint32_t i = 0; i < m_numSamples; i++) {
+			nnz += (samples[j][i] != 0);
+		}
+		m_sparseNnz[j] = nnz;
+		m_sparseRows[j] = (uint32_t*)aligned_alloc(64, (nnz + 16)*sizeof(uint32_t));
+		m_sparseValues[j] = (float*)aligned_alloc(64, (nnz + 16)*sizeof(float));
+		uint32_t k = 0;
+		for (uint32_t i = 0; i < m_numSamples; i++) {
+			if (samples[j][i] != 0) {
+				m_sparseRows[j][k] = i;
+				m_sparseValues[j][k] = samples[j][i];
+				k++;
+			}
+		}
+		// Arena columns go all at once below
+		if (!m_samplesMapped && m_samplesArena == nullptr) {
+			free(samples[j]);
+		}
+	}
+	free(samples);
+	if (m_samplesArena != nullptr) {
+		delete m_samplesArena;
+		m_samplesArena = nullptr;
 	}
+
+	uint64_t nnz = GetSparseNnz();
+	cout << "nnz: " << nnz << " (" << 100.0*(double)nnz/((double)m_numSamples*m_numFeatures) << "%)" << endl;
 }
 
-void ColumnStore::NormalizeLabels(NormType norm, bool binarizeLabels, float labelsToBinarizeTo) {
-	m_labelsNorm = norm;
+void ColumnStore::SetSparseMinibatchSize(uint32_t minibatchSize) {
+	if (m_sparseRows == nullptr || m_sparseMinibatchSize == minibatchSize) {
+		return;
+	}
+	uint32_t numMinibatches = m_numSamples/minibatchSize + (m_numSamples%minibatchSize > 0);
 
-	if (!binarizeLabels) {
-		float labelsMin = numeric_limits<float>::max();
-		float labelsMax = -numeric_limits<float>::max();
-		for (uint32_t i = 0; i < m_numSamples; i++) {
-			if (m_labels[i] > labelsMax) {
-				labelsMax = m_labels[i];
-			}
-			if (m_labels[i] < labelsMin) {
-				labelsMin = m_labels[i];
+	if (m_sparseSegments == nullptr) {
+		m_sparseSegments = (uint32_t**)malloc(m_numFeatures*sizeof(uint32_t*));
+		memset(m_sparseSegments, 0, m_numFeatures*sizeof(uint32_t*));
+	}
+	for (uint32_t j = 0; j < m_numFeatures; j++) {
+		m_sparseSegments[j] = (uint32_t*)realloc(m_sparseSegments[j], (numMinibatches+1)*sizeof(uint32_t));
+		uint32_t k = 0;
+		for (uint32_t m = 0; m <= numMinibatches; m++) {
+			uint64_t minibatchStart = (uint64_t)m*minibatchSize;
+			while (k < m_sparseNnz[j] && m_sparseRows[j][k] < minibatchStart) {
+				k++;
 			}
+			m_sparseSegments[j][m] = k;
 		}
-		
-		float labelsRange = labelsMax - labelsMin;
-		if (labelsRange > 0) {
-			if (m_labelsNorm == MinusOneToOne) {
-				for (uint32_t i = 0; i < m_numSamples; i++) {
-					m_labels[i] = ((m_labels[i] - labelsMin)/labelsRange)*2.0 - 1.0;
-				}
+	}
+	m_sparseMinibatchSize = minibatchSize;
+}
+
+void ColumnStore::BindMinibatchesToNode(uint32_t firstMinibatch, uint32_t numMinibatches, uint32_t minibatchSize, uint32_t node, bool useEncrypted, bool useCompressed) {
+	uint64_t firstSample = (uint64_t)firstMinibatch*minibatchSize;
+	uint64_t numSamples = (uint64_t)numMinibatches*minibatchSize;
+	if (numMinibatches == 0 || firstSample >= m_numSamples) {
+		return;
+	}
+	if (firstSample + numSamples > m_numSamples) {
+		numSamples = m_numSamples - firstSample;
+	}
+	uint32_t lastMinibatch = firstMinibatch + numMinibatches;
+
+	if (m_labels != nullptr) {
+		NumaTopology::BindToNode(m_labels + firstSample, numSamples*sizeof(float), node);
+	}
+
+	if (useEncrypted || useCompressed) {
+		// Minibatch m of the compressed (and of the encrypted compressed) columns ends at
+		// m_compressedSamplesSizes[j][m] words, there are m_numSamples/m_compressedMinibatchSize of them
+		bool bindCompressed = useCompressed && m_compressedSamplesSizes != nullptr && m_compressedMinibatchSize == minibatchSize && (!useEncrypted || (m_encryptedSamples != nullptr && m_encryptedUseCompressed && m_encryptedMinibatchSize == minibatchSize));
+		uint32_t lastCompressedMinibatch = bindCompressed ? min(lastMinibatch, m_numSamples/m_compressedMinibatchSize) : 0;
+		// The encrypted uncompressed columns hold the samples of whole minibatches
+		bool bindEncrypted = useEncrypted && !useCompressed && m_encryptedSamples != nullptr && !m_encryptedUseCompressed;
+		uint64_t numEncryptedSamples = bindEncrypted ? (uint64_t)(m_numSamples/m_encryptedMinibatchSize)*m_encryptedMinibatchSize : 0;
+		for (uint32_t j = 0; j < m_numFeatures; j++) {
+			if (firstMinibatch < lastCompressedMinibatch) {
+				uint32_t begin = (firstMinibatch == 0) ? 0 : m_compressedSamplesSizes[j][firstMinibatch-1];
+				uint32_t end = m_compressedSamplesSizes[j][lastCompressedMinibatch-1];
+				uint32_t** columns = useEncrypted ? m_encryptedSamples : m_compressedSamples;
+				NumaTopology::BindToNode(columns[j] + begin, (uint64_t)(end - begin)*sizeof(uint32_t), node);
 			}
-			else {
-				for (uint32_t i = 0; i < m_numSamples; i++) {
-					m_labels[i] = (m_labels[i] - labelsMin)/labelsRange;
-				}
+			if (firstSample < numEncryptedSamples) {
+				NumaTopology::BindToNode(m_encryptedSamples[j] + firstSample, (min(firstSample + numSamples, numEncryptedSamples) - firstSample)*sizeof(uint32_t), node);
 			}
 		}
-		m_labelsMin = labelsMin;
-		m_labelsRange = labelsRange;
+		return;
 	}
-	else {
-		for (uint32_t i = 0; i < m_numSamples; i++) {
-			if(m_labels[i] == labelsToBinarizeTo) {
-				m_labels[i] = 1.0;
+
+	// PAX chunks hold all features of a minibatch range in one piece
+	if (m_paxSamples != nullptr && m_paxChunkSize == minibatchSize) {
+		NumaTopology::BindToNode(GetPaxSlice(0, firstMinibatch), (uint64_t)m_numFeatures*numSamples*sizeof(float), node);
+	}
+	for (uint32_t j = 0; j < m_numFeatures; j++) {
+		if (m_samples != nullptr) {
+			NumaTopology::BindToNode(m_samples[j] + firstSample, numSamples*sizeof(float), node);
+		}
+		if (m_halfSamples != nullptr) {
+			NumaTopology::BindToNode(m_halfSamples[j] + firstSample, numSamples*sizeof(uint16_t), node);
+		}
+		if (m_quantizedSamples != nullptr) {
+			NumaTopology::BindToNode(m_quantizedSamples[j] + firstSample*m_quantizedBits/8, numSamples*m_quantizedBits/8, node);
+		}
+		if (m_dictionaryCodes != nullptr) {
+			if (m_dictionaryCodes[j] != nullptr) {
+				NumaTopology::BindToNode(m_dictionaryCodes[j] + firstSample, numSamples, node);
 			}
 			else {
-				if (m_labelsNorm == MinusOneToOne) {
-					m_labels[i] = -1.0;
-					m_labelsMin = -1.0;
-					m_labelsRange = 2.0;
-				}
-				else {
-					m_labels[i] = 0.0;
-					m_labelsMin = 0.0;
-					m_labelsRange = 1.0;
-				}
+				NumaTopology::BindToNode(m_dictionaryPlain[j] + firstSample, numSamples*sizeof(float), node);
 			}
 		}
+		if (m_sparseSegments != nullptr && m_sparseMinibatchSize == minibatchSize) {
+			uint32_t numSegments = m_numSamples/minibatchSize + (m_numSamples%minibatchSize > 0);
+			uint32_t lastSegment = (lastMinibatch < numSegments) ? lastMinibatch : numSegments;
+			uint32_t begin = m_sparseSegments[j][firstMinibatch];
+			uint32_t end = m_sparseSegments[j][lastSegment];
+			NumaTopology::BindToNode(m_sparseRows[j] + begin, (uint64_t)(end - begin)*sizeof(uint32_t), node);
+			NumaTopology::BindToNode(m_sparseValues[j] + begin, (uint64_t)(end - begin)*sizeof(float), node);
+		}
 	}
 }
 
-float ColumnStore::CompressSamples(uint32_t minibatchSize, uint32_t toIntegerScaler) {
-	uint32_t numMinibatches = m_numSamples/minibatchSize;
-	cout << "numMinibatches: " << numMinibatches << endl;
-	uint32_t rest = m_numSamples - numMinibatches*minibatchSize;
-	cout << "rest: " << rest << endl;
+static inline uint64_t AlignFileOffset(uint64_t offset) {
+	return (offset + COLUMNSTORE_FILE_ALIGNMENT - 1) & ~((uint64_t)COLUMNSTORE_FILE_ALIGNMENT - 1);
+}
+
+static void WriteAligned(FILE* f, const void* data, uint64_t numBytes, uint64_t &offset) {
+	static const char zeros[COLUMNSTORE_FILE_ALIGNMENT] = {0};
+	if (numBytes > 0 && fwrite(data, 1, numBytes, f) != numBytes) {
+		cout << "Writing to file failed" << endl;
+		exit(1);
+	}
+	offset += numBytes;
+	uint64_t padding = AlignFileOffset(offset) - offset;
+	fwrite(zeros, 1, padding, f);
+	offset += padding;
+}
 
-	reallocCompressed(numMinibatches);
+void ColumnStore::Save(char* pathToFile) {
+	cout << "Save is writing " << pathToFile << endl;
+	requireDenseSamples("Save");
 
-	for (uint32_t m = 0; m < numMinibatches; m++) {
+	FILE* f = fopen(pathToFile, "w");
+	if (f == NULL) {
+		cout << "Unable to open file " << pathToFile << endl;
+		exit(1);
+	}
+
+	ColumnStoreFileHeader header;
+	memset(&header, 0, sizeof(ColumnStoreFileHeader));
+	header.m_magic = COLUMNSTORE_FILE_MAGIC;
+	header.m_version = COLUMNSTORE_FILE_VERSION;
+	header.m_numSamples = m_numSamples;
+	header.m_numFeatures = m_numFeatures;
+	header.m_samplesBiased = m_samplesBiased;
+	header.m_samplesNorm = m_samplesNorm;
+	header.m_labelsNorm = m_labelsNorm;
+	header.m_samplesNormDirection = m_samplesNormDirection;
+	if (m_samplesRange != nullptr && m_samplesMin != nullptr) {
+		header.m_numNormalizationValues = (m_samplesNormDirection == row) ? m_numSamples : m_numFeatures;
+	}
+	header.m_labelsRange = m_labelsRange;
+	header.m_labelsMin = m_labelsMin;
+
+	uint32_t numCompressedMinibatches = 0;
+	if (m_compressedSamples != nullptr) {
+		header.m_compressedMinibatchSize = m_compressedMinibatchSize;
+		header.m_compressedToIntegerScaler = m_compressedToIntegerScaler;
+		numCompressedMinibatches = m_numSamples/m_compressedMinibatchSize;
+	}
+	if (m_encryptedSamples != nullptr) {
+		header.m_encryptedMinibatchSize = m_encryptedMinibatchSize;
+		header.m_encryptedUseCompressed = m_encryptedUseCompressed;
+		header.m_encryptionMode = m_encryptionMode;
+		header.m_encryptedMinibatchBase = m_encryptedMinibatchBase;
+	}
+
+	// Compute the layout first, then write the sections in order
+	uint64_t offset = AlignFileOffset(sizeof(ColumnStoreFileHeader));
+	header.m_samplesColumnStride = AlignFileOffset((uint64_t)m_numSamples*sizeof(float));
+	header.m_samplesOffset = offset;
+	offset += m_numFeatures*header.m_samplesColumnStride;
+	header.m_labelsOffset = offset;
+	offset += header.m_samplesColumnStride;
+	header.m_samplesRangeOffset = offset;
+	offset += AlignFileOffset((uint64_t)header.m_numNormalizationValues*sizeof(float));
+	header.m_samplesMinOffset = offset;
+	offset += AlignFileOffset((uint64_t)header.m_numNormalizationValues*sizeof(float));
+
+	// Compressed and encrypted columns have variable lengths, each section begins with a table of column offsets
+	uint64_t* compressedColumnOffsets = nullptr;
+	if (header.m_compressedMinibatchSize > 0) {
+		header.m_compressedSizesOffset = offset;
+		offset += m_numFeatures*AlignFileOffset((uint64_t)numCompressedMinibatches*sizeof(uint32_t));
+		header.m_compressedColumnsOffset = offset;
+		compressedColumnOffsets = (uint64_t*)malloc(m_numFeatures*sizeof(uint64_t));
+		offset += AlignFileOffset(m_numFeatures*sizeof(uint64_t));
 		for (uint32_t j = 0; j < m_numFeatures; j++) {
-			uint32_t compressedSamplesOffset = 0;
-			if (m > 0) {
-				compressedSamplesOffset = m_compressedSamplesSizes[j][m-1];
+			compressedColumnOffsets[j] = offset;
+			offset += AlignFileOffset((uint64_t)m_compressedSamplesSizes[j][numCompressedMinibatches-1]*sizeof(uint32_t));
+		}
+		header.m_compressedCodecsOffset = offset;
+		offset += AlignFileOffset(m_numFeatures*sizeof(uint32_t));
+	}
+	uint64_t* encryptedColumnOffsets = nullptr;
+	uint64_t* encryptedColumnSizes = nullptr;
+	if (header.m_encryptedMinibatchSize > 0) {
+		uint32_t numEncryptedMinibatches = m_numSamples/m_encryptedMinibatchSize;
+		header.m_encryptedColumnsOffset = offset;
+		encryptedColumnOffsets = (uint64_t*)malloc(m_numFeatures*sizeof(uint64_t));
+		encryptedColumnSizes = (uint64_t*)malloc(m_numFeatures*sizeof(uint64_t));
+		offset += AlignFileOffset(m_numFeatures*sizeof(uint64_t));
+		for (uint32_t j = 0; j < m_numFeatures; j++) {
+			if (m_encryptedUseCompressed) {
+				encryptedColumnSizes[j] = (uint64_t)m_compressedSamplesSizes[j][numEncryptedMinibatches-1]*sizeof(uint32_t);
 			}
-			uint32_t numWordsInBatch = compressColumn(m_samples[j] + m*minibatchSize, minibatchSize, m_compressedSamples[j] + compressedSamplesOffset, toIntegerScaler);
-			if (numWordsInBatch%4 > 0) {
-				numWordsInBatch += (4 - numWordsInBatch%4);
+			else {
+				encryptedColumnSizes[j] = (uint64_t)numEncryptedMinibatches*m_encryptedMinibatchSize*sizeof(uint32_t);
 			}
-			m_compressedSamplesSizes[j][m] = compressedSamplesOffset + numWordsInBatch;
+			encryptedColumnOffsets[j] = offset;
+			offset += AlignFileOffset(encryptedColumnSizes[j]);
 		}
 	}
 
-	uint32_t numWordsAfterCompression = 0;
+	offset = 0;
+	WriteAligned(f, &header, sizeof(ColumnStoreFileHeader), offset);
 	for (uint32_t j = 0; j < m_numFeatures; j++) {
-		numWordsAfterCompression += m_compressedSamplesSizes[j][numMinibatches-1];
+		WriteAligned(f, m_samples[j], (uint64_t)m_numSamples*sizeof(float), offset);
+	}
+	WriteAligned(f, m_labels, (uint64_t)m_numSamples*sizeof(float), offset);
+	WriteAligned(f, m_samplesRange, (uint64_t)header.m_numNormalizationValues*sizeof(float), offset);
+	WriteAligned(f, m_samplesMin, (uint64_t)header.m_numNormalizationValues*sizeof(float), offset);
+	if (header.m_compressedMinibatchSize > 0) {
+		for (uint32_t j = 0; j < m_numFeatures; j++) {
+			WriteAligned(f, m_compressedSamplesSizes[j], (uint64_t)numCompressedMinibatches*sizeof(uint32_t), offset);
+		}
+		WriteAligned(f, compressedColumnOffsets, m_numFeatures*sizeof(uint64_t), offset);
+		for (uint32_t j = 0; j < m_numFeatures; j++) {
+			WriteAligned(f, m_compressedSamples[j], (uint64_t)m_compressedSamplesSizes[j][numCompressedMinibatches-1]*sizeof(uint32_t), offset);
+		}
+		uint32_t* codecs = (uint32_t*)malloc(m_numFeatures*sizeof(uint32_t));
+		for (uint32_t j = 0; j < m_numFeatures; j++) {
+			codecs[j] = m_compressedCodecs[j];
+		}
+		WriteAligned(f, codecs, m_numFeatures*sizeof(uint32_t), offset);
+		free(codecs);
+	}
+	if (header.m_encryptedMinibatchSize > 0) {
+		WriteAligned(f, encryptedColumnOffsets, m_numFeatures*sizeof(uint64_t), offset);
+		for (uint32_t j = 0; j < m_numFeatures; j++) {
+			WriteAligned(f, m_encryptedSamples[j], encryptedColumnSizes[j], offset);
+		}
 	}
 
-	float compressionRate = (float)(numMinibatches*minibatchSize*m_numFeatures)/(float)numWordsAfterCompression;
+	fclose(f);
+	free(compressedColumnOffsets);
+	free(encryptedColumnOffsets);
+	free(encryptedColumnSizes);
 
-	return compressionRate;
+	cout << "Saved " << offset << " bytes" << endl;
 }
 
-void ColumnStore::EncryptSamples(uint32_t minibatchSize, bool useCompressed) {
-	uint32_t numMinibatches = m_numSamples/minibatchSize;
-	cout << "numMinibatches: " << numMinibatches << endl;
-	uint32_t rest = m_numSamples - numMinibatches*minibatchSize;
-	cout << "rest: " << rest << endl;
+void ColumnStore::Open(char* pathToFile) {
+	cout << "Open is mapping " << pathToFile << endl;
 
-	reallocEncrypted();
+	int fd = open(pathToFile, O_RDONLY);
+	if (fd < 0) {
+		cout << "Unable to open file " << pathToFile << endl;
+		exit(1);
+	}
+	struct stat fileStat;
+	fstat(fd, &fileStat);
+	size_t fileSize = fileStat.st_size;
+	if (fileSize < sizeof(ColumnStoreFileHeader)) {
+		cout << pathToFile << " is not a ColumnStore file" << endl;
+		exit(1);
+	}
 
-	if (useCompressed) {
+	// Private writable mapping: pages are shared through the page cache until someone modifies them
+	char* file = (char*)mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (file == MAP_FAILED) {
+		cout << "Unable to mmap file " << pathToFile << endl;
+		exit(1);
+	}
+
+	ColumnStoreFileHeader* header = (ColumnStoreFileHeader*)file;
+	if (header->m_magic != COLUMNSTORE_FILE_MAGIC) {
+		cout << pathToFile << " is not a ColumnStore file" << endl;
+		exit(1);
+	}
+	if (header->m_version < 1 || header->m_version > COLUMNSTORE_FILE_VERSION) {
+		cout << pathToFile << " has version " << header->m_version << ", expected 1 to " << COLUMNSTORE_FILE_VERSION << endl;
+		exit(1);
+	}
+
+	deallocData();
+	deallocCompressed();
+	deallocEncrypted();
+	unmapFile();
+	m_mappedFile = file;
+	m_mappedFileSize = fileSize;
+
+	m_numSamples = header->m_numSamples;
+	m_numFeatures = header->m_numFeatures;
+	m_samplesBiased = header->m_samplesBiased;
+	m_samplesNorm = (NormType)header->m_samplesNorm;
+	m_labelsNorm = (NormType)header->m_labelsNorm;
+	m_samplesNormDirection = (NormDirection)header->m_samplesNormDirection;
+	m_labelsRange = header->m_labelsRange;
+	m_labelsMin = header->m_labelsMin;
+
+	m_samples = (float**)malloc(m_numFeatures*sizeof(float*));
+	for (uint32_t j = 0; j < m_numFeatures; j++) {
+		m_samples[j] = (float*)(file + header->m_samplesOffset + j*header->m_samplesColumnStride);
+	}
+	m_labels = (float*)(file + header->m_labelsOffset);
+	m_samplesMapped = true;
+
+	if (header->m_numNormalizationValues > 0) {
+		m_samplesRange = (float*)realloc(m_samplesRange, header->m_numNormalizationValues*sizeof(float));
+		m_samplesMin = (float*)realloc(m_samplesMin, header->m_numNormalizationValues*sizeof(float));
+		memcpy(m_samplesRange, file + header->m_samplesRangeOffset, header->m_numNormalizationValues*sizeof(float));
+		memcpy(m_samplesMin, file + header->m_samplesMinOffset, header->m_numNormalizationValues*sizeof(float));
+	}
+
+	if (header->m_compressedMinibatchSize > 0) {
+		uint32_t numCompressedMinibatches = m_numSamples/header->m_compressedMinibatchSize;
+		uint64_t* compressedColumnOffsets = (uint64_t*)(file + header->m_compressedColumnsOffset);
+		m_compressedSamples = (uint32_t**)malloc(m_numFeatures*sizeof(uint32_t*));
+		m_compressedSamplesSizes = (uint32_t**)malloc(m_numFeatures*sizeof(uint32_t*));
 		for (uint32_t j = 0; j < m_numFeatures; j++) {
-			for (uint32_t m = 0; m < numMinibatches; m++) {
-				int32_t compressedSamplesOffset = 0;
-				if (m > 0) {
-					compressedSamplesOffset = m_compressedSamplesSizes[j][m-1];
-				}
-				encryptColumn((float*)(m_compressedSamples[j] + compressedSamplesOffset), m_compressedSamplesSizes[j][m] - compressedSamplesOffset, m_encryptedSamples[j] + compressedSamplesOffset);
-			}
+			m_compressedSamplesSizes[j] = (uint32_t*)(file + header->m_compressedSizesOffset + j*AlignFileOffset((uint64_t)numCompressedMinibatches*sizeof(uint32_t)));
+			m_compressedSamples[j] = (uint32_t*)(file + compressedColumnOffsets[j]);
 		}
+		// The header of version 1 files ends before m_compressedCodecsOffset
+		m_compressedCodecs = (CompressionCodec*)malloc(m_numFeatures*sizeof(CompressionCodec));
+		for (uint32_t j = 0; j < m_numFeatures; j++) {
+			m_compressedCodecs[j] = (header->m_version == 1) ? lineDeltaCodec : (CompressionCodec)((uint32_t*)(file + header->m_compressedCodecsOffset))[j];
+		}
+		m_compressedMapped = true;
+		m_compressedMinibatchSize = header->m_compressedMinibatchSize;
+		m_compressedToIntegerScaler = header->m_compressedToIntegerScaler;
+		cout << "Compressed samples present, minibatchSize: " << m_compressedMinibatchSize << ", toIntegerScaler: " << m_compressedToIntegerScaler << endl;
 	}
-	else {
+
+	if (header->m_encryptedMinibatchSize > 0) {
+		uint64_t* encryptedColumnOffsets = (uint64_t*)(file + header->m_encryptedColumnsOffset);
+		m_encryptedSamples = (uint32_t**)malloc(m_numFeatures*sizeof(uint32_t*));
 		for (uint32_t j = 0; j < m_numFeatures; j++) {
-			for (uint32_t m = 0; m < numMinibatches; m++) {
-				encryptColumn(m_samples[j] + m*minibatchSize, minibatchSize, m_encryptedSamples[j] + m*minibatchSize);
+			m_encryptedSamples[j] = (uint32_t*)(file + encryptedColumnOffsets[j]);
+		}
+		m_encryptedMapped = true;
+		m_encryptedMinibatchSize = header->m_encryptedMinibatchSize;
+		m_encryptedUseCompressed = header->m_encryptedUseCompressed;
+		m_encryptionMode = (header->m_version < 3) ? cbcMode : (EncryptionMode)header->m_encryptionMode;
+		m_encryptedMinibatchBase = (header->m_version < 3) ? 0 : header->m_encryptedMinibatchBase;
+		cout << "Encrypted samples present, minibatchSize: " << m_encryptedMinibatchSize << ", useCompressed: " << m_encryptedUseCompressed << ", mode: " << ((m_encryptionMode == ctrMode) ? "CTR" : "CBC") << endl;
+	}
+
+	cout << "m_numSamples: " << m_numSamples << endl;
+	cout << "m_numFeatures: " << m_numFeatures << endl;
+}
+
+static void PreadFully(int fd, void* destination, size_t size, uint64_t offset) {
+	size_t bytesRead = 0;
+	while (bytesRead < size) {
+		ssize_t r = pread(fd, (char*)destination + bytesRead, size - bytesRead, offset + bytesRead);
+		if (r <= 0) {
+			cout << "Unable to read " << size << " bytes at offset " << offset << endl;
+			exit(1);
+		}
+		bytesRead += r;
+	}
+}
+
+void ColumnStore::OpenOutOfCore(char* pathToFile, uint32_t chunkSize, uint64_t cacheSizeInBytes, uint32_t readAheadDepth) {
+	cout << "OpenOutOfCore is opening " << pathToFile << endl;
+
+	if (chunkSize == 0 || chunkSize%8 > 0) {
+		cout << "chunkSize must be a positive multiple of 8!" << endl;
+		exit(1);
+	}
+
+	int fd = open(pathToFile, O_RDONLY);
+	if (fd < 0) {
+		cout << "Unable to open file " << pathToFile << endl;
+		exit(1);
+	}
+	ColumnStoreFileHeader header;
+	PreadFully(fd, &header, sizeof(ColumnStoreFileHeader), 0);
+	if (header.m_magic != COLUMNSTORE_FILE_MAGIC) {
+		cout << pathToFile << " is not a ColumnStore file" << endl;
+		exit(1);
+	}
+	if (header.m_version < 1 || header.m_version > COLUMNSTORE_FILE_VERSION) {
+		cout << pathToFile << " has version " << header.m_version << ", expected 1 to " << COLUMNSTORE_FILE_VERSION << endl;
+		exit(1);
+	}
+
+	deallocData();
+	deallocCompressed();
+	deallocEncrypted();
+	unmapFile();
+
+	m_numSamples = header.m_numSamples;
+	m_numFeatures = header.m_numFeatures;
+	m_samplesBiased = header.m_samplesBiased;
+	m_samplesNorm = (NormType)header.m_samplesNorm;
+	m_labelsNorm = (NormType)header.m_labelsNorm;
+	m_samplesNormDirection = (NormDirection)header.m_samplesNormDirection;
+	m_labelsRange = header.m_labelsRange;
+	m_labelsMin = header.m_labelsMin;
+
+	m_labels = (float*)aligned_alloc(64, m_numSamples*sizeof(float));
+	PreadFully(fd, m_labels, m_numSamples*sizeof(float), header.m_labelsOffset);
+
+	if (header.m_numNormalizationValues > 0) {
+		m_samplesRange = (float*)realloc(m_samplesRange, header.m_numNormalizationValues*sizeof(float));
+		m_samplesMin = (float*)realloc(m_samplesMin, header.m_numNormalizationValues*sizeof(float));
+		PreadFully(fd, m_samplesRange, header.m_numNormalizationValues*sizeof(float), header.m_samplesRangeOffset);
+		PreadFully(fd, m_samplesMin, header.m_numNormalizationValues*sizeof(float), header.m_samplesMinOffset);
+	}
+
+	if (header.m_compressedMinibatchSize > 0 || header.m_encryptedMinibatchSize > 0) {
+		cout << "Compressed and encrypted samples are not loaded out-of-core, use Open for them" << endl;
+	}
+
+	uint32_t numSlots = cacheSizeInBytes/((uint64_t)chunkSize*sizeof(float));
+	// At least one chunk per running thread plus the read-ahead window has to fit
+	if (numSlots < MAX_NUM_CACHE_READERS + 2*readAheadDepth) {
+		numSlots = MAX_NUM_CACHE_READERS + 2*readAheadDepth;
+		cout << "Cache too small, increased to " << numSlots << " chunks" << endl;
+	}
+
+	m_chunkCache = new ChunkCache(fd, header.m_samplesOffset, header.m_samplesColumnStride, m_numFeatures, m_numSamples, chunkSize, numSlots, readAheadDepth);
+
+	cout << "m_numSamples: " << m_numSamples << endl;
+	cout << "m_numFeatures: " << m_numFeatures << endl;
+	cout << "Cache: " << numSlots << " chunks of " << chunkSize << " samples, " << ((double)numSlots*chunkSize*sizeof(float))/1e6 << " MB" << endl;
+}
+
+#ifdef AVX2
+DecompressLanes::DecompressLanes(uint32_t width, uint32_t numDeltas) {
+	m_numVectors = (numDeltas + 1 + 7)/8;
+	for (uint32_t v = 0; v < m_numVectors; v++) {
+		int32_t lo[8], hi[8], right[8], left[8], extend[8];
+		for (uint32_t l = 0; l < 8; l++) {
+			uint32_t t = v*8 + l;
+			if (t == 0 || t > numDeltas) {
+				lo[l] = 0;
+				hi[l] = 0;
+				right[l] = 0;
+				left[l] = 32;
+				extend[l] = 32;
+			}
+			else {
+				uint32_t bit = (t-1)*width;
+				// hi is only needed if the delta crosses into the next word, so never past word 7
+				lo[l] = 1 + bit/32;
+				hi[l] = (2 + bit/32)%8;
+				right[l] = bit%32;
+				left[l] = 32 - bit%32;
+				extend[l] = 32 - width;
 			}
 		}
+		m_lo[v] = _mm256_loadu_si256((__m256i*)lo);
+		m_hi[v] = _mm256_loadu_si256((__m256i*)hi);
+		m_right[v] = _mm256_loadu_si256((__m256i*)right);
+		m_left[v] = _mm256_loadu_si256((__m256i*)left);
+		m_extend[v] = _mm256_loadu_si256((__m256i*)extend);
+	}
+}
+
+const DecompressLanes decompressLanes7Bit(7, 31);
+const DecompressLanes decompressLanes9Bit(9, 23);
+const DecompressLanes decompressLanes14Bit(14, 15);
+const DecompressLanes decompressLanes31Bit(31, 7);
+
+FrameLanes::FrameLanes(uint32_t width) {
+	for (uint32_t v = 0; v < 4; v++) {
+		int32_t words[8], right[8], left[8];
+		m_firstWord[v] = v*8*width/32;
+		for (uint32_t l = 0; l < 8; l++) {
+			uint32_t bit = (v*8 + l)*width;
+			words[l] = bit/32 - m_firstWord[v];
+			right[l] = bit%32;
+			left[l] = 32 - bit%32;
+		}
+		m_words[v] = _mm256_loadu_si256((__m256i*)words);
+		m_right[v] = _mm256_loadu_si256((__m256i*)right);
+		m_left[v] = _mm256_loadu_si256((__m256i*)left);
 	}
+	m_fieldMask = _mm256_set1_epi32((width == 32) ? 0xFFFFFFFF : (1u << width) - 1);
 }
 
-uint32_t ColumnStore::decompressColumn(uint32_t* compressedColumn, uint32_t inNumWords, float* decompressedColumn, uint32_t toIntegerScaler) {
+const FrameLanes frameLanes[33] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16,
+	17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32};
+#endif
+
+// The AVX2 decoder produces exactly the values of the scalar one: the shifts extract the same
+// bits, and dividing by a power of 2 is the same as multiplying with its reciprocal.
+uint32_t ColumnStore::decompressColumn(uint32_t* compressedColumn, uint32_t inNumWords, float* decompressedColumn, uint32_t toIntegerScaler, CompressionCodec codec) {
+	if (codec == frameOfReferenceCodec) {
+		return decompressFrames(compressedColumn, inNumWords, decompressedColumn, toIntegerScaler);
+	}
+#ifdef AVX2
+	uint32_t outNumWords = 0;
+	__m256 AVX_reciprocal = _mm256_set1_ps(1.0f/((float)(1 << toIntegerScaler)));
+
+	for (uint32_t i = 0; i < inNumWords; i+=8) {
+		__builtin_prefetch(compressedColumn + i + 16);
+		__builtin_prefetch(decompressedColumn + outNumWords + 16);
+
+		outNumWords += AVX_DecompressLineTo(compressedColumn + i, AVX_reciprocal, decompressedColumn + outNumWords);
+	}
+	return outNumWords;
+#else
 	uint32_t outNumWords = 0;
 	int delta[31];
 	uint32_t CL[8];
@@ -502,14 +2919,83 @@ uint32_t ColumnStore::decompressColumn(uint32_t* compressedColumn, uint32_t inNu
 		}
 	}
 	return outNumWords;
+#endif
+}
+
+#ifdef AVX2
+// First of the deltas 1 .. numDeltas (bit k of fits is delta k+1) that does not fit, numDeltas+1 if all fit
+static inline uint32_t FirstMisfit(uint32_t fits, uint32_t numDeltas) {
+	uint32_t misfits = ~fits & (uint32_t)((1ULL << numDeltas) - 1);
+	return (misfits != 0) ? 1 + __builtin_ctz(misfits) : numDeltas + 1;
+}
+
+// Number of deltas the line starting at sample i holds, exactly as chosen by the scalar search
+// in compressColumn. That search walks the deltas, lowering the class to the widest one
+// (31, 23, 15 or 7 deltas) the delta fits into, and stops at the first delta p >= the class.
+// With the first delta not fitting each class, found from vector compares, the stop is known
+// in closed form. keys gets the deltas, at least the ones the scalar search wrote.
+static inline uint32_t AVX_ClassifyDeltas(float* originalColumn, uint32_t i, uint32_t inNumWords, uint32_t toIntegerScaler, int base, uint32_t* keys) {
+	uint32_t numRemaining = inNumWords - i - 1;
+	uint32_t numDeltas = (numRemaining < 31) ? numRemaining : 31;
+
+	__m256 AVX_scaler = _mm256_set1_ps((float)(1 << toIntegerScaler));
+	__m256i AVX_base = _mm256_set1_epi32(base);
+	__m256i AVX_laneIndexes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	uint32_t fits7 = 0;
+	uint32_t fits9 = 0;
+	uint32_t fits14 = 0;
+	for (uint32_t v = 0; v*8 < numDeltas; v++) {
+		// Past the end of the column nothing is read, and keys keeps what the previous line
+		// left there, which the last line packs as padding
+		bool full = (v*8 + 8 <= numRemaining);
+		__m256i AVX_mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(numRemaining - v*8), AVX_laneIndexes);
+		__m256 AVX_values = full ? _mm256_loadu_ps(originalColumn + i + 1 + v*8) : _mm256_maskload_ps(originalColumn + i + 1 + v*8, AVX_mask);
+		__m256i AVX_delta = _mm256_sub_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(AVX_values, AVX_scaler)), AVX_base);
+		if (full) {
+			_mm256_storeu_si256((__m256i*)(keys + v*8), AVX_delta);
+		}
+		else {
+			_mm256_maskstore_epi32((int*)(keys + v*8), AVX_mask, AVX_delta);
+		}
+
+		__m256i AVX_fits7 = _mm256_and_si256(_mm256_cmpgt_epi32(AVX_delta, _mm256_set1_epi32(-65)), _mm256_cmpgt_epi32(_mm256_set1_epi32(64), AVX_delta));
+		__m256i AVX_fits9 = _mm256_and_si256(_mm256_cmpgt_epi32(AVX_delta, _mm256_set1_epi32(-257)), _mm256_cmpgt_epi32(_mm256_set1_epi32(256), AVX_delta));
+		__m256i AVX_fits14 = _mm256_and_si256(_mm256_cmpgt_epi32(AVX_delta, _mm256_set1_epi32(-8193)), _mm256_cmpgt_epi32(_mm256_set1_epi32(8192), AVX_delta));
+		fits7 |= (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(AVX_fits7)) << (v*8);
+		fits9 |= (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(AVX_fits9)) << (v*8);
+		fits14 |= (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(AVX_fits14)) << (v*8);
+	}
+
+	// A class is only possible if the line can be filled
+	uint32_t misfit31 = (numRemaining >= 31) ? FirstMisfit(fits7, numDeltas) : 1;
+	uint32_t misfit23 = (numRemaining >= 23) ? FirstMisfit(fits9, numDeltas) : 1;
+	uint32_t misfit15 = (numRemaining >= 15) ? FirstMisfit(fits14, numDeltas) : 1;
+
+	if (misfit31 > 31) {
+		return 31;
+	}
+	if (max(misfit31, 23u) < misfit23) {
+		return 23;
+	}
+	if (max(misfit23, 15u) < misfit15) {
+		return 15;
+	}
+	if (max(misfit15, 7u) <= numRemaining) {
+		return 7;
+	}
+	return numRemaining;
 }
+#endif
 
-uint32_t ColumnStore::compressColumn(float* originalColumn, uint32_t inNumWords, uint32_t* compressedColumn, uint32_t toIntegerScaler) {
+uint32_t ColumnStore::compressColumn(float* originalColumn, uint32_t inNumWords, uint32_t* compressedColumn, uint32_t toIntegerScaler, CompressionCodec codec) {
+	if (codec == frameOfReferenceCodec) {
+		return compressFrames(originalColumn, inNumWords, compressedColumn, toIntegerScaler);
+	}
 	// 0x40 31 7bit delta, 0x30 23 9bit delta, 0x20 15 14bit delta, 0x10 7 31-bit delta
 	uint32_t numWords = 0;
 
 	uint32_t CL[8];
-  	uint32_t keys[31];
+  	uint32_t keys[32];
 
 	uint32_t numProcessed = 0;
 	for (uint32_t i = 0; i < inNumWords; i=i+numProcessed+1) {
@@ -517,6 +3003,9 @@ uint32_t ColumnStore::compressColumn(float* originalColumn, uint32_t inNumWords,
 
 		CL[0] = (uint32_t)base;
 
+#ifdef AVX2
+		numProcessed = AVX_ClassifyDeltas(originalColumn, i, inNumWords, toIntegerScaler, base, keys);
+#else
 		uint32_t search_for = 31;
 		uint32_t j = i + 1;
 		numProcessed = 0;
@@ -542,6 +3031,7 @@ uint32_t ColumnStore::compressColumn(float* originalColumn, uint32_t inNumWords,
 			}
 			j++;
 		}
+#endif
 
 		if (numProcessed == 31) {
 			CL[1] =
@@ -709,10 +3199,247 @@ uint32_t ColumnStore::compressColumn(float* originalColumn, uint32_t inNumWords,
 	return numWords;
 }
 
-void ColumnStore::decryptColumn(uint32_t* encryptedColumn, uint32_t inNumWords, float* decryptedColumn) {
-	AES_CBC_decrypt((unsigned char*)encryptedColumn, (unsigned char*)decryptedColumn, m_ivec, inNumWords*sizeof(float), m_KEYS_dec, 14);
+// frameOfReferenceCodec. The samples are turned into integers like in compressColumn, so both
+// codecs decode to the same values. A frame holds up to FOR_FRAME_SIZE of them:
+//   word 0: width (bits 0-5), deltas (bit 6), number of values (bits 8-13), number of exceptions (bits 16-21)
+//   word 1: reference
+//   the fields, width bits each, packed from bit 0 of word 2 on
+//   the positions of the exceptions, one byte each, then the bits of each exception above width
+// Without deltas, a value is reference + field. With deltas, the field is the zig-zag encoded
+// difference to the previous value, the first one to the reference. A field whose value needs
+// more than width bits is an exception, the frame only holds its low width bits among the fields.
+// A minibatch ends with FOR_TAIL_WORDS zeros, padded to 4 words. A zero word 0 ends it, and the
+// vectors of the last frame can load the 9 words after its fields.
+
+// Words of a frame of numValues fields, width bits each, with numExceptions exceptions
+static inline uint32_t FrameWords(uint32_t numValues, uint32_t width, uint32_t numExceptions) {
+	return 2 + (numValues*width + 31)/32 + (numExceptions + 3)/4 + numExceptions;
+}
+
+// The width that makes the smallest frame out of the fields, the widest one if several do
+static inline uint32_t FrameWidth(uint32_t* fields, uint32_t numValues, uint32_t &numWords) {
+	uint32_t numWithBits[33] = {0};
+	for (uint32_t t = 0; t < numValues; t++) {
+		numWithBits[(fields[t] == 0) ? 0 : 32 - __builtin_clz(fields[t])]++;
+	}
+	uint32_t bestWidth = 32;
+	numWords = FrameWords(numValues, 32, 0);
+	uint32_t numExceptions = 0;
+	for (uint32_t width = 32; width-- > 0; ) {
+		numExceptions += numWithBits[width+1];
+		uint32_t words = FrameWords(numValues, width, numExceptions);
+		if (words < numWords) {
+			bestWidth = width;
+			numWords = words;
+		}
+	}
+	return bestWidth;
+}
+
+uint32_t ColumnStore::compressFrames(float* originalColumn, uint32_t inNumWords, uint32_t* compressedColumn, uint32_t toIntegerScaler) {
+	uint32_t numWords = 0;
+	int32_t integers[FOR_FRAME_SIZE];
+	uint32_t offsets[FOR_FRAME_SIZE];
+	uint32_t deltas[FOR_FRAME_SIZE];
+
+	for (uint32_t i = 0; i < inNumWords; i += FOR_FRAME_SIZE) {
+		uint32_t numValues = min(inNumWords - i, (uint32_t)FOR_FRAME_SIZE);
+		int32_t minimum = numeric_limits<int32_t>::max();
+		for (uint32_t t = 0; t < numValues; t++) {
+			integers[t] = (int)(originalColumn[i+t]*(1 << toIntegerScaler));
+			minimum = min(minimum, integers[t]);
+		}
+		// Both in uint32_t, where differences wrap around like in the decoder
+		for (uint32_t t = 0; t < numValues; t++) {
+			offsets[t] = (uint32_t)integers[t] - (uint32_t)minimum;
+			uint32_t delta = (uint32_t)integers[t] - (uint32_t)integers[(t > 0) ? t-1 : 0];
+			deltas[t] = (delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+		}
+
+		uint32_t offsetsWords;
+		uint32_t deltasWords;
+		uint32_t offsetsWidth = FrameWidth(offsets, numValues, offsetsWords);
+		uint32_t deltasWidth = FrameWidth(deltas, numValues, deltasWords);
+		bool useDeltas = deltasWords < offsetsWords;
+		uint32_t* fields = useDeltas ? deltas : offsets;
+		uint32_t width = useDeltas ? deltasWidth : offsetsWidth;
+
+		uint32_t* frame = compressedColumn + numWords;
+		uint32_t* packed = frame + 2;
+		uint32_t numPackedWords = (numValues*width + 31)/32;
+		uint32_t numExceptions = 0;
+		uint8_t positions[FOR_FRAME_SIZE];
+		uint32_t highBits[FOR_FRAME_SIZE];
+		memset(packed, 0, numPackedWords*sizeof(uint32_t));
+		for (uint32_t t = 0; t < numValues; t++) {
+			if (width < 32 && (fields[t] >> width) != 0) {
+				positions[numExceptions] = t;
+				highBits[numExceptions] = fields[t] >> width;
+				numExceptions++;
+			}
+			if (width == 0) {
+				continue;
+			}
+			uint32_t field = (width == 32) ? fields[t] : fields[t] & ((1u << width) - 1);
+			uint32_t bit = t*width;
+			packed[bit/32] |= field << (bit%32);
+			if (bit%32 + width > 32) {
+				packed[bit/32 + 1] |= field >> (32 - bit%32);
+			}
+		}
+		frame[0] = width | ((uint32_t)useDeltas << 6) | (numValues << 8) | (numExceptions << 16);
+		frame[1] = (uint32_t)(useDeltas ? integers[0] : minimum);
+		uint32_t* exceptions = packed + numPackedWords;
+		memset(exceptions, 0, (numExceptions + 3)/4*sizeof(uint32_t));
+		memcpy(exceptions, positions, numExceptions);
+		memcpy(exceptions + (numExceptions + 3)/4, highBits, numExceptions*sizeof(uint32_t));
+		numWords += FrameWords(numValues, width, numExceptions);
+	}
+
+	for (uint32_t t = 0; t < FOR_TAIL_WORDS; t++) {
+		compressedColumn[numWords++] = 0;
+	}
+	while (numWords%4 > 0) {
+		compressedColumn[numWords++] = 0;
+	}
+	return numWords;
+}
+
+uint32_t ColumnStore::decompressFrames(uint32_t* compressedColumn, uint32_t inNumWords, float* decompressedColumn, uint32_t toIntegerScaler) {
+	uint32_t outNumWords = 0;
+#ifdef AVX2
+	__m256 AVX_reciprocal = _mm256_set1_ps(1.0f/((float)(1 << toIntegerScaler)));
+	uint32_t i = 0;
+	while (i < inNumWords && compressedColumn[i] != 0) {
+		uint32_t numWords;
+		outNumWords += AVX_DecompressFrameTo(compressedColumn + i, AVX_reciprocal, decompressedColumn + outNumWords, numWords);
+		i += numWords;
+	}
+#else
+	uint32_t fields[FOR_FRAME_SIZE];
+	uint32_t i = 0;
+	while (i < inNumWords && compressedColumn[i] != 0) {
+		uint32_t* frame = compressedColumn + i;
+		uint32_t width = frame[0] & 0x3F;
+		bool deltas = (frame[0] >> 6) & 0x1;
+		uint32_t numValues = (frame[0] >> 8) & 0x3F;
+		uint32_t numExceptions = (frame[0] >> 16) & 0x3F;
+		uint32_t* packed = frame + 2;
+		uint32_t numPackedWords = (numValues*width + 31)/32;
+
+		for (uint32_t t = 0; t < numValues; t++) {
+			fields[t] = 0;
+			if (width > 0) {
+				uint32_t bit = t*width;
+				uint32_t field = packed[bit/32] >> (bit%32);
+				if (bit%32 + width > 32) {
+					field |= packed[bit/32 + 1] << (32 - bit%32);
+				}
+				fields[t] = (width == 32) ? field : field & ((1u << width) - 1);
+			}
+		}
+		uint8_t* positions = (uint8_t*)(packed + numPackedWords);
+		uint32_t* highBits = packed + numPackedWords + (numExceptions + 3)/4;
+		for (uint32_t e = 0; e < numExceptions; e++) {
+			fields[positions[e]] |= highBits[e] << width;
+		}
+
+		uint32_t integer = frame[1];
+		for (uint32_t t = 0; t < numValues; t++) {
+			if (deltas) {
+				integer += (fields[t] >> 1) ^ (0 - (fields[t] & 1));
+			}
+			else {
+				integer = frame[1] + fields[t];
+			}
+			decompressedColumn[outNumWords++] = ((float)(int)integer)/((float)(1 << toIntegerScaler));
+		}
+		i += FrameWords(numValues, width, numExceptions);
+	}
+#endif
+	return outNumWords;
+}
+
+// The words of both codecs for the first few minibatches. frameOfReferenceCodec decodes at about
+// half the speed of lineDeltaCodec, it has to save a quarter of the words to be worth it.
+CompressionCodec ColumnStore::ChooseCodec(uint32_t j) {
+	uint32_t minibatchSize = m_compressedMinibatchSize;
+	uint32_t numMinibatches = min(m_numSamples/minibatchSize, 4u);
+	uint32_t* compressed = (uint32_t*)malloc(MaxCompressedMinibatchWords(minibatchSize)*sizeof(uint32_t));
+	uint64_t lineWords = 0;
+	uint64_t frameWords = 0;
+	for (uint32_t m = 0; m < numMinibatches; m++) {
+		lineWords += compressColumn(m_samples[j] + m*minibatchSize, minibatchSize, compressed, m_compressedToIntegerScaler, lineDeltaCodec);
+		frameWords += compressFrames(m_samples[j] + m*minibatchSize, minibatchSize, compressed, m_compressedToIntegerScaler);
+	}
+	free(compressed);
+	return (4*frameWords <= 3*lineWords) ? frameOfReferenceCodec : lineDeltaCodec;
+}
+
+void ColumnStore::ctrNonce(uint32_t coordinate, uint32_t minibatchIndex, unsigned char nonce[16]) {
+	uint32_t words[4] = {0, 0, m_encryptedMinibatchBase + minibatchIndex, coordinate};
+	memcpy(nonce, words, 16);
+	for (uint32_t k = 0; k < 16; k++) {
+		nonce[k] ^= m_ivec[k];
+	}
 }
 
-void ColumnStore::encryptColumn(float* originalColumn, uint32_t inNumWords, uint32_t* encryptedColumn) {
+void ColumnStore::decryptColumn(uint32_t* encryptedColumn, uint32_t inNumWords, float* decryptedColumn, uint32_t coordinate, uint32_t minibatchIndex) {
+	if (m_encryptionMode == ctrMode) {
+		unsigned char nonce[16];
+		ctrNonce(coordinate, minibatchIndex, nonce);
+		m_ctrXcrypt((unsigned char*)encryptedColumn, (unsigned char*)decryptedColumn, nonce, 0, inNumWords*sizeof(float), m_KEYS_enc, 14);
+		return;
+	}
+	m_cbcDecrypt((unsigned char*)encryptedColumn, (unsigned char*)decryptedColumn, m_ivec, inNumWords*sizeof(float), m_KEYS_dec, 14);
+}
+
+void ColumnStore::encryptColumn(float* originalColumn, uint32_t inNumWords, uint32_t* encryptedColumn, uint32_t coordinate, uint32_t minibatchIndex) {
+	if (m_encryptionMode == ctrMode) {
+		unsigned char nonce[16];
+		ctrNonce(coordinate, minibatchIndex, nonce);
+		m_ctrXcrypt((unsigned char*)originalColumn, (unsigned char*)encryptedColumn, nonce, 0, inNumWords*sizeof(float), m_KEYS_enc, 14);
+		return;
+	}
 	AES_CBC_encrypt((unsigned char*)originalColumn, (unsigned char*)encryptedColumn, m_ivec, inNumWords*sizeof(float), m_KEYS_enc, 14);
+}
+
+void ColumnStore::DecryptSamples(uint32_t coordinate, uint32_t firstSample, uint32_t numSamples, float* samples) {
+	if (m_encryptedSamples == nullptr || m_encryptionMode != ctrMode || m_encryptedUseCompressed) {
+		cout << "DecryptSamples needs samples encrypted in ctrMode without compression!" << endl;
+		exit(1);
+	}
+	uint32_t minibatchSize = m_encryptedMinibatchSize;
+	// Only whole minibatches are encrypted
+	uint64_t numEncryptedSamples = (uint64_t)(m_numSamples/minibatchSize)*minibatchSize;
+	if (coordinate >= m_numFeatures || (uint64_t)firstSample + numSamples > numEncryptedSamples) {
+		cout << "DecryptSamples: feature " << coordinate << ", samples " << firstSample << " to " << (uint64_t)firstSample + numSamples << " are not in the " << m_numFeatures << " features and " << numEncryptedSamples << " encrypted samples!" << endl;
+		exit(1);
+	}
+	uint32_t* encryptedColumn = (uint32_t*)m_encryptedSamples[coordinate];
+	unsigned char nonce[16];
+	unsigned char block[16];
+	while (numSamples > 0) {
+		// The range within one minibatch, starting at a whole block (4 samples)
+		uint32_t minibatchIndex = firstSample/minibatchSize;
+		uint32_t offset = firstSample%minibatchSize;
+		uint32_t count = min(numSamples, minibatchSize - offset);
+		ctrNonce(coordinate, minibatchIndex, nonce);
+		uint32_t head = offset%4;
+		if (head > 0) {
+			// The samples of a partial first block
+			uint32_t headCount = min(count, 4 - head);
+			m_ctrXcrypt((unsigned char*)(encryptedColumn + firstSample - head), block, nonce, offset/4, min(4U, minibatchSize - (offset - head))*sizeof(float), m_KEYS_enc, 14);
+			memcpy(samples, block + head*sizeof(float), headCount*sizeof(float));
+			samples += headCount;
+			firstSample += headCount;
+			numSamples -= headCount;
+			count -= headCount;
+			offset += headCount;
+		}
+		m_ctrXcrypt((unsigned char*)(encryptedColumn + firstSample), (unsigned char*)samples, nonce, offset/4, count*sizeof(float), m_KEYS_enc, 14);
+		samples += count;
+		firstSample += count;
+		numSamples -= count;
+	}
 }
\ No newline at end of file
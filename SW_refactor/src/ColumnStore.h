@@ -17,13 +17,28 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cmath>
 #include <string>
 #include <fstream>
 #include <iostream>
 #include <limits>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "aes.h"
+#include "ChunkCache.h"
+#include "NumaTopology.h"
+#include "HugePageArena.h"
+
+#ifdef AVX2
+#include "immintrin.h"
+#endif
 
 using namespace std;
 
@@ -34,8 +49,430 @@ static double get_time()
 	return t.tv_sec + t.tv_usec*1e-6;
 }
 
+// Counter-based random numbers: the value only depends on (seed, counter), so any thread can
+// produce any element of a stream without sharing state
+static inline uint64_t CounterHash(uint64_t seed, uint64_t counter) {
+	uint64_t z = seed + (counter + 1)*0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30))*0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27))*0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+// Uniform in [0, 1)
+static inline float CounterUniform(uint64_t seed, uint64_t counter) {
+	return (float)(CounterHash(seed, counter) >> 40)*(1.0f/16777216.0f);
+}
+
 enum NormType {ZeroToOne, MinusOneToOne};
 enum NormDirection {row, column};
+enum SyntheticDistribution {uniform, gaussian, laplace};
+enum SamplesPrecision {fp32, fp16, bf16};
+// columnLayout: one array per feature. paxLayout: the samples are cut into chunks, each chunk
+// holds the slices of all features back to back (feature-major inside the chunk).
+enum SamplesLayout {columnLayout, paxLayout};
+// lineDeltaCodec: 8 word lines of 7, 9, 14 or 31 bit deltas to the first value of the line, the
+// format the FPGA decompressor reads. frameOfReferenceCodec: frames of FOR_FRAME_SIZE values,
+// see compressFrames. adaptiveCodec is only passed to CompressSamples, which then picks one of
+// the two per column.
+enum CompressionCodec {lineDeltaCodec, frameOfReferenceCodec, adaptiveCodec};
+// cbcMode: every encrypted minibatch is one AES-256 CBC stream starting from m_ivec, the mode the
+// FPGA AES core decrypts. ctrMode: AES-256 CTR with a nonce per feature and minibatch, so that
+// minibatches are encrypted in parallel blocks and any range of one can be decrypted on its own.
+enum EncryptionMode {cbcMode, ctrMode};
+
+// Values per frame of frameOfReferenceCodec
+#define FOR_FRAME_SIZE 32
+// Zero words at the end of a frameOfReferenceCodec minibatch
+#define FOR_TAIL_WORDS 9
+
+// Largest dictionary of a dictionary encoded column, the codes are one byte
+#define DICTIONARY_MAX_SIZE 256
+
+// Words a compressed minibatch can take at most, with either codec: lineDeltaCodec never needs
+// more than minibatchSize words plus a partial last line, frameOfReferenceCodec 2 words per
+// frame on top of 32 bit wide values and the tail. Both are padded to 4 words.
+static inline uint64_t MaxCompressedMinibatchWords(uint32_t minibatchSize) {
+	return (uint64_t)minibatchSize + 2*((minibatchSize + FOR_FRAME_SIZE-1)/FOR_FRAME_SIZE) + FOR_TAIL_WORDS + 8;
+}
+
+// IEEE half, round to nearest even
+static inline uint16_t FloatToHalf(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(float));
+	uint32_t sign = (bits >> 16) & 0x8000;
+	uint32_t magnitude = bits & 0x7FFFFFFF;
+	if (magnitude >= 0x7F800000) { // Inf, NaN
+		return sign | 0x7C00 | ((magnitude > 0x7F800000) ? 0x200 : 0);
+	}
+	if (magnitude >= 0x477FF000) { // Rounds to a value beyond the largest half
+		return sign | 0x7C00;
+	}
+	if (magnitude < 0x38800000) { // Subnormal half
+		if (magnitude < 0x33000000) {
+			return sign;
+		}
+		uint32_t exponent = magnitude >> 23;
+		uint32_t mantissa = (magnitude & 0x7FFFFF) | 0x800000;
+		uint32_t shift = 126 - exponent;
+		uint32_t half = mantissa >> shift;
+		uint32_t remainder = mantissa & ((1 << shift) - 1);
+		uint32_t halfway = 1 << (shift - 1);
+		if (remainder > halfway || (remainder == halfway && (half & 1))) {
+			half++;
+		}
+		return sign | half;
+	}
+	uint32_t half = (magnitude - 0x38000000) >> 13;
+	uint32_t remainder = magnitude & 0x1FFF;
+	if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) {
+		half++;
+	}
+	return sign | half;
+}
+
+static inline float HalfToFloat(uint16_t half) {
+	uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+	uint32_t exponent = (half >> 10) & 0x1F;
+	uint32_t mantissa = half & 0x3FF;
+	uint32_t bits;
+	if (exponent == 0x1F) {
+		bits = sign | 0x7F800000 | (mantissa << 13);
+	}
+	else if (exponent > 0) {
+		bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+	}
+	else if (mantissa == 0) {
+		bits = sign;
+	}
+	else { // Subnormal half, normal float
+		exponent = 113;
+		while ((mantissa & 0x400) == 0) {
+			mantissa <<= 1;
+			exponent--;
+		}
+		bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+	}
+	float value;
+	memcpy(&value, &bits, sizeof(float));
+	return value;
+}
+
+// bfloat16, round to nearest even
+static inline uint16_t FloatToBfloat(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(float));
+	if ((bits & 0x7FFFFFFF) > 0x7F800000) {
+		return (bits >> 16) | 0x40;
+	}
+	bits += 0x7FFF + ((bits >> 16) & 1);
+	return bits >> 16;
+}
+
+static inline float BfloatToFloat(uint16_t bfloat) {
+	uint32_t bits = (uint32_t)bfloat << 16;
+	float value;
+	memcpy(&value, &bits, sizeof(float));
+	return value;
+}
+
+#ifdef AVX2
+// Widens 8 consecutive 16-bit samples to fp32: F16C for half, a shift for bfloat16
+static inline __m256 AVX_WidenSamples(const uint16_t* samples, SamplesPrecision precision) {
+	__m128i AVX_half = _mm_loadu_si128((const __m128i*)samples);
+	if (precision == fp16) {
+		return _mm256_cvtph_ps(AVX_half);
+	}
+	return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(AVX_half), 16));
+}
+
+// Unpacks the quantization levels of 8 consecutive samples, sampleIndex%8 == 0
+static inline __m256i AVX_UnpackQuantized(const uint8_t* column, uint32_t sampleIndex, uint32_t numBits) {
+	const uint8_t* packed = column + (sampleIndex/8)*numBits;
+	if (numBits == 8) {
+		return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)packed));
+	}
+	uint32_t word;
+	memcpy(&word, packed, sizeof(uint32_t));
+	__m256i AVX_word = _mm256_set1_epi32(word);
+	if (numBits == 4) {
+		return _mm256_and_si256(_mm256_srlv_epi32(AVX_word, _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28)), _mm256_set1_epi32(0xF));
+	}
+	return _mm256_and_si256(_mm256_srlv_epi32(AVX_word, _mm256_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14)), _mm256_set1_epi32(0x3));
+}
+
+// Where the values of a compressed line of one meta class come from. Value t of the line is
+// lane t%8 of vector t/8: value 0 is the base, value t > 0 delta t-1, which starts at bit
+// (t-1)*width of words 1 to 7. A delta is (lo >> right) | (hi << left), sign extended from width
+// bits by shifting left and arithmetically right by extend. Lanes past the deltas decode to the base.
+struct DecompressLanes {
+	uint32_t m_numVectors;
+	__m256i m_lo[4];
+	__m256i m_hi[4];
+	__m256i m_right[4];
+	__m256i m_left[4];
+	__m256i m_extend[4];
+
+	DecompressLanes(uint32_t width, uint32_t numDeltas);
+};
+
+extern const DecompressLanes decompressLanes7Bit;
+extern const DecompressLanes decompressLanes9Bit;
+extern const DecompressLanes decompressLanes14Bit;
+extern const DecompressLanes decompressLanes31Bit;
+
+// Decodes the 8 words of one compressed line into AVX_values, returns the number of values in
+// the line: 32, 24 or 16, or up to 8 for raw lines. Lanes past the values are not meaningful.
+static inline uint32_t AVX_DecompressLine(const uint32_t* line, __m256 AVX_reciprocal, __m256* AVX_values) {
+	uint32_t meta = (line[7] >> 24) & 0xFC;
+	__m256i AVX_line = _mm256_loadu_si256((const __m256i*)line);
+	__m256i AVX_base = _mm256_set1_epi32((int)line[0]);
+
+	const DecompressLanes* lanes;
+	uint32_t numValues;
+	if (meta == 0x40) {
+		lanes = &decompressLanes7Bit;
+		numValues = 32;
+	}
+	else if (meta == 0x30) {
+		lanes = &decompressLanes9Bit;
+		numValues = 24;
+	}
+	else if (meta == 0x20) {
+		lanes = &decompressLanes14Bit;
+		numValues = 16;
+	}
+	else {
+		lanes = &decompressLanes31Bit;
+		numValues = 1 + (meta >> 2);
+	}
+
+	for (uint32_t v = 0; v < lanes->m_numVectors; v++) {
+		__m256i AVX_lo = _mm256_permutevar8x32_epi32(AVX_line, lanes->m_lo[v]);
+		__m256i AVX_hi = _mm256_permutevar8x32_epi32(AVX_line, lanes->m_hi[v]);
+		__m256i AVX_delta = _mm256_or_si256(_mm256_srlv_epi32(AVX_lo, lanes->m_right[v]), _mm256_sllv_epi32(AVX_hi, lanes->m_left[v]));
+		AVX_delta = _mm256_srav_epi32(_mm256_sllv_epi32(AVX_delta, lanes->m_extend[v]), lanes->m_extend[v]);
+		AVX_values[v] = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_add_epi32(AVX_base, AVX_delta)), AVX_reciprocal);
+	}
+	return numValues;
+}
+
+// Decodes one compressed line to out, which only needs room for the values of the line
+static inline uint32_t AVX_DecompressLineTo(const uint32_t* line, __m256 AVX_reciprocal, float* out) {
+	// Only the vectors the line's meta class has are decoded, the rest are never stored
+	__m256 AVX_values[4] = {};
+	uint32_t numValues = AVX_DecompressLine(line, AVX_reciprocal, AVX_values);
+	for (uint32_t v = 0; v < (numValues + 7)/8; v++) {
+		if (v*8 + 8 <= numValues) {
+			_mm256_storeu_ps(out + v*8, AVX_values[v]);
+		}
+		else {
+			_mm256_maskstore_ps(out + v*8, _mm256_cmpgt_epi32(_mm256_set1_epi32(numValues - v*8), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)), AVX_values[v]);
+		}
+	}
+	return numValues;
+}
+
+// Inclusive prefix sum over the 8 lanes
+static inline __m256i AVX_PrefixSum(__m256i AVX_x) {
+	AVX_x = _mm256_add_epi32(AVX_x, _mm256_and_si256(_mm256_permutevar8x32_epi32(AVX_x, _mm256_setr_epi32(0, 0, 1, 2, 3, 4, 5, 6)), _mm256_setr_epi32(0, -1, -1, -1, -1, -1, -1, -1)));
+	AVX_x = _mm256_add_epi32(AVX_x, _mm256_and_si256(_mm256_permutevar8x32_epi32(AVX_x, _mm256_setr_epi32(0, 0, 0, 1, 2, 3, 4, 5)), _mm256_setr_epi32(0, 0, -1, -1, -1, -1, -1, -1)));
+	return _mm256_add_epi32(AVX_x, _mm256_and_si256(_mm256_permutevar8x32_epi32(AVX_x, _mm256_setr_epi32(0, 0, 0, 0, 0, 1, 2, 3)), _mm256_setr_epi32(0, 0, 0, 0, -1, -1, -1, -1)));
+}
+
+// Where the 8 fields of vector v of a frame of width-bit fields are, in the 9 words from
+// m_firstWord[v] on
+struct FrameLanes {
+	uint32_t m_firstWord[4];
+	__m256i m_words[4];
+	__m256i m_right[4];
+	__m256i m_left[4];
+	__m256i m_fieldMask;
+
+	FrameLanes(uint32_t width);
+};
+
+// One per width, 0 to 32
+extern const FrameLanes frameLanes[33];
+
+// Decodes one frameOfReferenceCodec frame to out, which only needs room for the values of the
+// frame. Returns the number of values, numWords gets the length of the frame. Reads up to 9
+// words past the frame, see compressFrames.
+static inline uint32_t AVX_DecompressFrameTo(const uint32_t* frame, __m256 AVX_reciprocal, float* out, uint32_t &numWords) {
+	uint32_t width = frame[0] & 0x3F;
+	bool deltas = (frame[0] >> 6) & 0x1;
+	uint32_t numValues = (frame[0] >> 8) & 0x3F;
+	uint32_t numExceptions = (frame[0] >> 16) & 0x3F;
+	uint32_t numPackedWords = (numValues*width + 31)/32;
+	const uint32_t* packed = frame + 2;
+	const FrameLanes* lanes = &frameLanes[width];
+	// Exceptions: the bits above width of some values, in the order of their positions
+	const uint8_t* positions = (const uint8_t*)(packed + numPackedWords);
+	const uint32_t* highBits = packed + numPackedWords + (numExceptions + 3)/4;
+	uint32_t e = 0;
+
+	__m256i AVX_laneIndexes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	__m256i AVX_carry = _mm256_set1_epi32((int)frame[1]);
+	for (uint32_t v = 0; v*8 < numValues; v++) {
+		const uint32_t* window = packed + lanes->m_firstWord[v];
+		__m256i AVX_lo = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i*)window), lanes->m_words[v]);
+		__m256i AVX_hi = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i*)(window + 1)), lanes->m_words[v]);
+		__m256i AVX_fields = _mm256_or_si256(_mm256_srlv_epi32(AVX_lo, lanes->m_right[v]), _mm256_sllv_epi32(AVX_hi, lanes->m_left[v]));
+		AVX_fields = _mm256_and_si256(AVX_fields, lanes->m_fieldMask);
+		if (e < numExceptions && positions[e] < v*8 + 8) {
+			uint32_t fields[8] __attribute__((aligned(32)));
+			_mm256_store_si256((__m256i*)fields, AVX_fields);
+			for (; e < numExceptions && positions[e] < v*8 + 8; e++) {
+				fields[positions[e] - v*8] |= highBits[e] << width;
+			}
+			AVX_fields = _mm256_load_si256((__m256i*)fields);
+		}
+
+		// Frame of reference: value = reference + field. Deltas: the fields are the zig-zag encoded
+		// differences to the previous value, the first one to the reference.
+		__m256i AVX_integers;
+		if (deltas) {
+			AVX_fields = _mm256_xor_si256(_mm256_srli_epi32(AVX_fields, 1), _mm256_sub_epi32(_mm256_setzero_si256(), _mm256_and_si256(AVX_fields, _mm256_set1_epi32(1))));
+			AVX_integers = _mm256_add_epi32(AVX_PrefixSum(AVX_fields), AVX_carry);
+			AVX_carry = _mm256_permutevar8x32_epi32(AVX_integers, _mm256_set1_epi32(7));
+		}
+		else {
+			AVX_integers = _mm256_add_epi32(AVX_fields, AVX_carry);
+		}
+		__m256 AVX_values = _mm256_mul_ps(_mm256_cvtepi32_ps(AVX_integers), AVX_reciprocal);
+		if (v*8 + 8 <= numValues) {
+			_mm256_storeu_ps(out + v*8, AVX_values);
+		}
+		else {
+			_mm256_maskstore_ps(out + v*8, _mm256_cmpgt_epi32(_mm256_set1_epi32(numValues - v*8), AVX_laneIndexes), AVX_values);
+		}
+	}
+	numWords = 2 + numPackedWords + (numExceptions + 3)/4 + numExceptions;
+	return numValues;
+}
+
+// Decodes the next line or frame of a compressed minibatch to out and moves block past it
+static inline uint32_t AVX_DecompressBlockTo(const uint32_t* &block, CompressionCodec codec, __m256 AVX_reciprocal, float* out) {
+	if (codec == frameOfReferenceCodec) {
+		uint32_t numWords;
+		uint32_t numValues = AVX_DecompressFrameTo(block, AVX_reciprocal, out, numWords);
+		block += numWords;
+		return numValues;
+	}
+	uint32_t numValues = AVX_DecompressLineTo(block, AVX_reciprocal, out);
+	block += 8;
+	return numValues;
+}
+#endif
+
+struct SyntheticDataParameters
+{
+	uint64_t m_seed = 7;
+	// Fraction of the sample values that are 0
+	float m_sparsity = 0;
+	// Correlation between any two features, through a latent factor shared by all features of a sample
+	float m_correlation = 0;
+	// Binary labels: probability that a label is flipped. Real labels: standard deviation of the added noise
+	float m_labelNoise = 0;
+	// Distribution of the feature values, scaled to zero mean and unit variance
+	SyntheticDistribution m_distribution = uniform;
+};
+
+// Column normalization the solvers apply on the fly instead of NormalizeSamples rewriting the
+// columns: feature j of a sample is used as m_scale[j]*value + m_shift[j]. Several of them can
+// share the raw samples of one store. See ColumnStore::CreateColumnNormalization.
+class ColumnNormalization {
+public:
+	uint32_t m_numFeatures;
+	NormType m_norm;
+	float* m_scale;
+	float* m_shift;
+
+	ColumnNormalization(uint32_t numFeatures, NormType norm) {
+		m_numFeatures = numFeatures;
+		m_norm = norm;
+		uint64_t numBytes = ((uint64_t)numFeatures*sizeof(float) + 63)/64*64;
+		m_scale = (float*)aligned_alloc(64, numBytes > 0 ? numBytes : 64);
+		m_shift = (float*)aligned_alloc(64, numBytes > 0 ? numBytes : 64);
+		for (uint32_t j = 0; j < numFeatures; j++) {
+			m_scale[j] = 1.0;
+			m_shift[j] = 0.0;
+		}
+	}
+
+	~ColumnNormalization() {
+		free(m_scale);
+		free(m_shift);
+	}
+
+	// Same mapping as NormalizeSamples: (value - min)/range, then to [-1, 1] for MinusOneToOne.
+	// Features with a range of 0 stay as they are.
+	void SetFeature(uint32_t j, float min, float range) {
+		if (range > 0) {
+			float outputRange = (m_norm == MinusOneToOne) ? 2.0 : 1.0;
+			float outputMin = (m_norm == MinusOneToOne) ? -1.0 : 0.0;
+			m_scale[j] = outputRange/range;
+			m_shift[j] = outputMin - min*m_scale[j];
+		}
+		else {
+			m_scale[j] = 1.0;
+			m_shift[j] = 0.0;
+		}
+	}
+
+	// Model over the raw samples with the same dots as x over the normalized ones, once the
+	// returned offset is added: rawX[j] = x[j]*m_scale[j]
+	float FoldIntoModel(const float* x, float* rawX) {
+		float offset = 0;
+		for (uint32_t j = 0; j < m_numFeatures; j++) {
+			rawX[j] = x[j]*m_scale[j];
+			offset += x[j]*m_shift[j];
+		}
+		return offset;
+	}
+
+private:
+	ColumnNormalization(const ColumnNormalization&);
+	ColumnNormalization& operator=(const ColumnNormalization&);
+};
+
+#define COLUMNSTORE_FILE_MAGIC 0x45524F5453434D5AULL // "ZMCSTORE"
+#define COLUMNSTORE_FILE_VERSION 3
+#define COLUMNSTORE_FILE_ALIGNMENT 64
+
+// Header of the binary columnar file written by ColumnStore::Save. All offsets are in bytes
+// from the beginning of the file and are multiples of COLUMNSTORE_FILE_ALIGNMENT.
+struct ColumnStoreFileHeader {
+	uint64_t m_magic;
+	uint32_t m_version;
+	uint32_t m_numSamples;
+	uint32_t m_numFeatures;
+	uint32_t m_samplesBiased;
+	uint32_t m_samplesNorm;
+	uint32_t m_labelsNorm;
+	uint32_t m_samplesNormDirection;
+	uint32_t m_numNormalizationValues;
+	float m_labelsRange;
+	float m_labelsMin;
+
+	uint32_t m_compressedMinibatchSize;
+	uint32_t m_compressedToIntegerScaler;
+	uint32_t m_encryptedMinibatchSize;
+	uint32_t m_encryptedUseCompressed;
+
+	uint64_t m_samplesOffset;
+	uint64_t m_samplesColumnStride;
+	uint64_t m_labelsOffset;
+	uint64_t m_samplesRangeOffset;
+	uint64_t m_samplesMinOffset;
+	uint64_t m_compressedSizesOffset;
+	uint64_t m_compressedColumnsOffset;
+	uint64_t m_encryptedColumnsOffset;
+	// Since version 2, version 1 files only have lineDeltaCodec columns
+	uint64_t m_compressedCodecsOffset;
+	// Since version 3, older files only have cbcMode encrypted columns
+	uint32_t m_encryptionMode;
+	uint32_t m_encryptedMinibatchBase;
+};
 
 class ColumnStore {
 public:
@@ -44,28 +481,154 @@ public:
 
 	uint32_t** m_compressedSamples;
 	uint32_t** m_compressedSamplesSizes;
+	// Codec of each compressed column, lineDeltaCodec or frameOfReferenceCodec
+	CompressionCodec* m_compressedCodecs;
 	uint32_t** m_encryptedSamples;
 
+	// Compressed sparse column samples, used instead of m_samples when present. Rows are sorted
+	// within a column, m_sparseSegments[j][m] is the first nonzero of minibatch m in column j.
+	uint32_t** m_sparseRows;
+	float** m_sparseValues;
+	uint32_t* m_sparseNnz;
+	uint32_t** m_sparseSegments;
+	uint32_t m_sparseMinibatchSize;
+
+	// 16-bit samples, used instead of m_samples when m_samplesPrecision is fp16 or bf16
+	uint16_t** m_halfSamples;
+	SamplesPrecision m_samplesPrecision;
+
+	// Quantized samples, used instead of m_samples when present. Sample i of column j is the
+	// m_quantizedBits wide level at bit i*m_quantizedBits, its value m_quantizedMin[j] + level*m_quantizedScale[j].
+	uint8_t** m_quantizedSamples;
+	float* m_quantizedScale;
+	float* m_quantizedMin;
+	uint32_t m_quantizedBits;
+
+	// Dictionary encoded samples, used instead of m_samples when present. Sample i of column j is
+	// m_dictionaryValues[j][m_dictionaryCodes[j][i]]. Columns with more than the dictionary size
+	// distinct values have no codes and are kept as fp32 in m_dictionaryPlain.
+	uint8_t** m_dictionaryCodes;
+	float** m_dictionaryValues;
+	uint32_t* m_dictionarySizes;
+	float** m_dictionaryPlain;
+
+	// Run-length columns, found by FindRunColumns next to whatever representation the store holds.
+	// Column j is m_runValues[j][r] from sample m_runStarts[j][r] up to m_runStarts[j][r+1], and
+	// m_runStarts[j][m_numRuns[j]] is m_numSamples. nullptr for the other columns.
+	uint32_t** m_runStarts;
+	float** m_runValues;
+	uint32_t* m_numRuns;
+	// Whether the runs hold the decoded compressed samples, which only useCompressed solvers read
+	bool m_runsUseCompressed;
+
+	// Dense samples in PAX layout, used instead of m_samples when present. The slice of
+	// feature j in chunk c starts at m_paxSamples + (c*m_numFeatures + j)*m_paxChunkSize.
+	float* m_paxSamples;
+	uint32_t m_paxChunkSize;
+
 	uint32_t m_numSamples;
 	uint32_t m_numFeatures;
 	bool m_samplesBiased;
 
 	NormType m_samplesNorm;
 	NormType m_labelsNorm;
+	NormDirection m_samplesNormDirection;
 
 	float* m_samplesRange;
 	float* m_samplesMin;
 	float m_labelsRange;
 	float m_labelsMin;
 
+	// Per-feature min and max of the stored samples. The loaders gather them while parsing,
+	// NormalizeSamples and AppendSamples keep them up to date. Values outside the normalization
+	// range show that appended data drifted. nullptr if nothing gathered them.
+	float* m_runningMin;
+	float* m_runningMax;
+
+	// Parameters the compressed and encrypted samples were created with, 0 if not present
+	uint32_t m_compressedMinibatchSize;
+	uint32_t m_compressedToIntegerScaler;
+	uint32_t m_encryptedMinibatchSize;
+	bool m_encryptedUseCompressed;
+	EncryptionMode m_encryptionMode;
+	// Minibatches the sliding window dropped since EncryptSamples, CTR nonces count from there
+	uint32_t m_encryptedMinibatchBase;
+
 	ColumnStore() {
 		m_samples = nullptr;
 		m_labels = nullptr;
 
 		m_compressedSamples = nullptr;
 		m_compressedSamplesSizes = nullptr;
+		m_compressedCodecs = nullptr;
 		m_encryptedSamples = nullptr;
 
+		m_sparseRows = nullptr;
+		m_sparseValues = nullptr;
+		m_sparseNnz = nullptr;
+		m_sparseSegments = nullptr;
+		m_sparseMinibatchSize = 0;
+
+		m_halfSamples = nullptr;
+		m_samplesPrecision = fp32;
+
+		m_quantizedSamples = nullptr;
+		m_quantizedScale = nullptr;
+		m_quantizedMin = nullptr;
+		m_quantizedBits = 0;
+		m_dictionaryCodes = nullptr;
+		m_dictionaryValues = nullptr;
+		m_dictionarySizes = nullptr;
+		m_dictionaryPlain = nullptr;
+		m_runStarts = nullptr;
+		m_runValues = nullptr;
+		m_numRuns = nullptr;
+		m_runsUseCompressed = false;
+
+		m_paxSamples = nullptr;
+		m_paxChunkSize = 0;
+
+		m_samplesNorm = ZeroToOne;
+		m_labelsNorm = ZeroToOne;
+		m_samplesNormDirection = column;
+		m_samplesRange = nullptr;
+		m_samplesMin = nullptr;
+		m_labelsRange = 0;
+		m_labelsMin = 0;
+		m_runningMin = nullptr;
+		m_runningMax = nullptr;
+		m_runningMinMaxExact = false;
+
+		m_compressedMinibatchSize = 0;
+		m_compressedToIntegerScaler = 0;
+		m_encryptedMinibatchSize = 0;
+		m_encryptedUseCompressed = false;
+		m_encryptionMode = cbcMode;
+		m_encryptedMinibatchBase = 0;
+
+		m_mappedFile = nullptr;
+		m_mappedFileSize = 0;
+		m_samplesMapped = false;
+		m_compressedMapped = false;
+		m_encryptedMapped = false;
+		m_chunkCache = nullptr;
+
+		m_samplesCapacity = 0;
+		m_compressedCapacity = 0;
+		m_compressedSizesCapacity = 0;
+		m_encryptedCapacity = 0;
+		m_windowNumMinibatches = 0;
+		m_windowMinibatchSize = 0;
+
+		m_arenaPageSize = noArena;
+		m_arenaStridePadding = 0;
+		m_samplesArena = nullptr;
+		m_halfArena = nullptr;
+		m_quantizedArena = nullptr;
+		m_paxArena = nullptr;
+		m_compressedArena = nullptr;
+		m_encryptedArena = nullptr;
+
 		for (uint32_t i = 0; i < 32; i++) {
 			m_initKey[i] = (unsigned char)i;
 		}
@@ -73,12 +636,18 @@ public:
 		m_KEYS_dec = (unsigned char*)malloc(16*15);
 		AES_256_Key_Expansion(m_initKey, m_KEYS_enc);
 		AES_256_Decryption_Keys(m_KEYS_enc, m_KEYS_dec);
+		m_cbcDecrypt = AES_Select_CBC_decrypt(&m_cbcDecryptName);
+		m_ctrXcrypt = AES_Select_CTR_xcrypt();
 	}
 
 	~ColumnStore() {
 		deallocData();
 		deallocCompressed();
 		deallocEncrypted();
+		unmapFile();
+
+		free(m_samplesRange);
+		free(m_samplesMin);
 
 		free(m_KEYS_enc);
 		free(m_KEYS_dec);
@@ -97,19 +666,203 @@ public:
 
 	// Data loading functions
 	void LoadLibsvmData(char* pathToFile, uint32_t numSamples, uint32_t numFeatures, bool samplesBiased);
+	// mmap based LibSVM loader, parses line-aligned chunks of the file on numThreads threads
+	void LoadLibsvmDataParallel(char* pathToFile, uint32_t numSamples, uint32_t numFeatures, bool samplesBiased, uint32_t numThreads);
+	// Same as LoadLibsvmDataParallel, but builds compressed sparse columns without ever expanding the samples
+	void LoadLibsvmDataSparse(char* pathToFile, uint32_t numSamples, uint32_t numFeatures, bool samplesBiased, uint32_t numThreads);
 	void LoadRawData(char* pathToFile, uint32_t numSamples, uint32_t numFeatures, bool labelPresent);
+	// mmap based LoadRawData, transposes the row-major doubles tile by tile without a temporary copy
+	void LoadRawDataStreaming(char* pathToFile, uint32_t numSamples, uint32_t numFeatures, bool labelPresent, uint32_t numThreads);
 	void GenerateSyntheticData(uint32_t numSamples, uint32_t numFeatures, bool labelBinary, NormType labelsNorm);
+	// Labels come from a random linear model over the generated features. The data only depends on
+	// parameters, not on numThreads.
+	void GenerateSyntheticDataParallel(uint32_t numSamples, uint32_t numFeatures, bool labelBinary, NormType labelsNorm, SyntheticDataParameters* parameters, uint32_t numThreads);
 
 	// Normalization and data shaping
 	void NormalizeSamples(NormType norm, NormDirection direction);
+	// AVX normalization on numThreads threads, each one on a range of the samples. Column
+	// statistics the loaders gathered save the first pass, rows are normalized tile by tile.
+	void NormalizeSamplesParallel(NormType norm, NormDirection direction, uint32_t numThreads);
+	// Column normalization that leaves the samples raw, to be passed to the solvers in
+	// AdditionalArguments. The caller owns it. m_samplesMin and m_samplesRange are not touched.
+	ColumnNormalization* CreateColumnNormalization(NormType norm, uint32_t numThreads);
 	void NormalizeLabels(NormType norm, bool binarizeLabels, float labelsToBinarizeTo);
-	float CompressSamples(uint32_t minibatchSize, uint32_t toIntegerScaler);
-	void EncryptSamples(uint32_t minibatchSize, bool useCompressed);
+	// Returns the compression rate. With adaptiveCodec, every column gets the codec that compresses
+	// its first minibatches best. The FPGA only reads lineDeltaCodec columns.
+	float CompressSamples(uint32_t minibatchSize, uint32_t toIntegerScaler, CompressionCodec codec = lineDeltaCodec);
+	// Same output as CompressSamples, the features are split over numThreads threads
+	float CompressSamplesParallel(uint32_t minibatchSize, uint32_t toIntegerScaler, uint32_t numThreads, CompressionCodec codec = lineDeltaCodec);
+	// The codec that compresses the first minibatches of column j best, with the minibatch size and
+	// toIntegerScaler of the compressed samples
+	CompressionCodec ChooseCodec(uint32_t j);
+	void EncryptSamples(uint32_t minibatchSize, bool useCompressed, EncryptionMode mode = cbcMode);
+	// Same output as EncryptSamples. Every minibatch of every feature is encrypted on its own, so
+	// all of them together are split over numThreads threads. In cbcMode uncompressed minibatches
+	// must be whole AES blocks, minibatchSize%4 == 0.
+	void EncryptSamplesParallel(uint32_t minibatchSize, bool useCompressed, uint32_t numThreads, EncryptionMode mode = cbcMode);
+	// Decrypts all encrypted minibatches on numThreads threads and compares them with the samples
+	// they were encrypted from, if those are still there. Prints the decryption throughput and
+	// returns the number of minibatches that differ.
+	uint32_t VerifyEncryptedSamples(uint32_t numThreads);
+	// Appends numNewSamples samples, given row after row without the bias term, and normalizes them
+	// with the statistics NormalizeSamples computed. labels (already normalized) may be nullptr.
+	// The columns grow geometrically. Only the minibatches completed by the new samples are
+	// compressed and encrypted.
+	void AppendSamples(float* samples, float* labels, uint32_t numNewSamples);
+	// Appends numSamples samples from a file in the format LoadRawData reads
+	void AppendRawData(char* pathToFile, uint32_t numSamples, bool labelPresent);
+	// After every append, drops the oldest minibatches of minibatchSize beyond the newest
+	// numMinibatches. 0 turns the window off.
+	void SetSlidingWindow(uint32_t numMinibatches, uint32_t minibatchSize);
+	// Converts the dense samples to fp16 or bf16 and frees the fp32 columns
+	void ReduceSamplesPrecision(SamplesPrecision precision);
+	inline float GetHalfSample(uint32_t j, uint32_t i) {
+		return (m_samplesPrecision == fp16) ? HalfToFloat(m_halfSamples[j][i]) : BfloatToFloat(m_halfSamples[j][i]);
+	}
+	// Quantizes the dense samples to numBits (8, 4 or 2) levels per column with stochastic rounding and frees the fp32 columns
+	void QuantizeSamples(uint32_t numBits, uint64_t seed);
+	inline uint32_t GetQuantizedLevel(uint32_t j, uint32_t i) {
+		uint64_t bit = (uint64_t)i*m_quantizedBits;
+		return (m_quantizedSamples[j][bit/8] >> (bit%8)) & ((1 << m_quantizedBits) - 1);
+	}
+	inline float GetQuantizedSample(uint32_t j, uint32_t i) {
+		return m_quantizedMin[j] + (float)GetQuantizedLevel(j, i)*m_quantizedScale[j];
+	}
+	// Dictionary encodes the dense columns with at most maxDictionarySize (up to DICTIONARY_MAX_SIZE)
+	// distinct values and frees the fp32 columns
+	void DictionaryEncodeSamples(uint32_t maxDictionarySize);
+	inline float GetDictionarySample(uint32_t j, uint32_t i) {
+		if (m_dictionaryCodes[j] == nullptr) {
+			return m_dictionaryPlain[j][i];
+		}
+		return m_dictionaryValues[j][m_dictionaryCodes[j][i]];
+	}
+	// Finds the columns with at most maxRuns runs of equal values, such as the bias column, which
+	// the SCD kernels then handle in closed form without reading them. Changing the samples drops them.
+	// With useCompressed the runs are found on the decoded compressed samples, for the solvers
+	// that train on those.
+	uint32_t FindRunColumns(uint32_t maxRuns, bool useCompressed = false);
+	inline bool IsRunColumn(uint32_t j) {
+		return m_runStarts != nullptr && m_runStarts[j] != nullptr;
+	}
+	// Moves the dense samples between column and PAX layout. chunkSize is the PAX chunk (and
+	// solver minibatch) size, a multiple of 8, and ignored when going back to column layout.
+	void SetSamplesLayout(SamplesLayout layout, uint32_t chunkSize);
+	SamplesLayout GetSamplesLayout() {
+		return (m_paxSamples != nullptr) ? paxLayout : columnLayout;
+	}
+	inline float* GetPaxSlice(uint32_t j, uint32_t chunk) {
+		return m_paxSamples + ((uint64_t)chunk*m_numFeatures + j)*m_paxChunkSize;
+	}
+	// The compressed lines of minibatch m of feature j
+	inline uint32_t* GetCompressedMinibatch(uint32_t j, uint32_t m) {
+		return m_compressedSamples[j] + ((m > 0) ? m_compressedSamplesSizes[j][m-1] : 0);
+	}
+	// Exits if the PAX chunks do not line up with the solver's minibatches
+	void CheckLayoutMinibatchSize(uint32_t minibatchSize) {
+		if (m_paxSamples != nullptr && m_paxChunkSize != minibatchSize) {
+			cout << "Samples in PAX layout need minibatchSize == " << m_paxChunkSize << "!" << endl;
+			exit(1);
+		}
+	}
+	// Sample i of feature j for any in-memory, non-sparse representation and layout
+	inline float GetSample(uint32_t j, uint32_t i) {
+		if (m_samples != nullptr) {
+			return m_samples[j][i];
+		}
+		if (m_paxSamples != nullptr) {
+			return GetPaxSlice(j, i/m_paxChunkSize)[i%m_paxChunkSize];
+		}
+		if (m_halfSamples != nullptr) {
+			return GetHalfSample(j, i);
+		}
+		if (m_dictionaryCodes != nullptr) {
+			return GetDictionarySample(j, i);
+		}
+		return GetQuantizedSample(j, i);
+	}
+	// Converts the dense samples to compressed sparse columns and frees them
+	void SparsifySamples();
+	// Sets up m_sparseSegments for minibatches of minibatchSize, no-op for dense samples
+	void SetSparseMinibatchSize(uint32_t minibatchSize);
+	// Columns of the dense (column or PAX layout), reduced precision, quantized, compressed and encrypted samples created
+	// from now on are allocated from one HugePageArena per representation. stridePadding bytes
+	// are left between consecutive columns.
+	void UseArena(ArenaPageSize pageSize, uint32_t stridePadding) {
+		m_arenaPageSize = pageSize;
+		m_arenaStridePadding = stridePadding;
+	}
+	// Binds minibatches [firstMinibatch, firstMinibatch+numMinibatches) of the labels and of the
+	// column representation a solver with useEncrypted/useCompressed reads to a NUMA node,
+	// migrating pages already touched. Compressed and sparse minibatches are only bound when
+	// they were built with the same minibatchSize.
+	void BindMinibatchesToNode(uint32_t firstMinibatch, uint32_t numMinibatches, uint32_t minibatchSize, uint32_t node, bool useEncrypted, bool useCompressed);
+	bool IsSparse() {
+		return m_sparseRows != nullptr;
+	}
+	uint64_t GetSparseNnz() {
+		uint64_t nnz = 0;
+		for (uint32_t j = 0; j < m_numFeatures && m_sparseNnz != nullptr; j++) {
+			nnz += m_sparseNnz[j];
+		}
+		return nnz;
+	}
 
-	static uint32_t decompressColumn(uint32_t* compressedColumn, uint32_t inNumWords, float* decompressedColumn, uint32_t toIntegerScaler);
-	static uint32_t compressColumn(float* originalColumn, uint32_t inNumWords, uint32_t* compressedColumn, uint32_t toIntegerScaler);
-	void decryptColumn(uint32_t* encryptedColumn, uint32_t inNumWords, float* decryptedColumn);
-	void encryptColumn(float* originalColumn, uint32_t inNumWords, uint32_t* encryptedColumn);
+	// Binary columnar file: samples, labels, normalization and, if present, compressed/encrypted samples
+	void Save(char* pathToFile);
+	// mmaps a file written by Save, the columns point into the (copy-on-write) mapping
+	void Open(char* pathToFile);
+	// Keeps only labels and normalization in memory, the columns are read through a chunkSize x cacheSizeInBytes LRU cache
+	void OpenOutOfCore(char* pathToFile, uint32_t chunkSize, uint64_t cacheSizeInBytes, uint32_t readAheadDepth);
+	bool IsOutOfCore() {
+		return m_chunkCache != nullptr;
+	}
+	// Tells the read-ahead in which order the solver is going to visit the (feature, minibatch)
+	// pairs, and the size of its minibatches (0 keeps the current one)
+	void SetReadAheadOrder(ChunkOrder order, uint32_t minibatchSize = 0) {
+		if (m_chunkCache != nullptr) {
+			m_chunkCache->SetOrder(order, minibatchSize);
+		}
+	}
+	ChunkOrder GetReadAheadOrder() {
+		return (m_chunkCache != nullptr) ? m_chunkCache->GetOrder() : minibatchMajor;
+	}
+	// Copies count samples of column j, starting at firstSample, from the out-of-core cache
+	void ReadColumn(uint32_t j, uint32_t firstSample, uint32_t count, float* out) {
+		uint32_t chunkSize = m_chunkCache->GetChunkSize();
+		while (count > 0) {
+			uint32_t inChunk = chunkSize - firstSample%chunkSize;
+			if (inChunk > count) {
+				inChunk = count;
+			}
+			m_chunkCache->Read(j, firstSample, inChunk, out);
+			firstSample += inChunk;
+			out += inChunk;
+			count -= inChunk;
+		}
+	}
+	static bool IsColumnStoreFile(char* pathToFile) {
+		uint64_t magic = 0;
+		FILE* f = fopen(pathToFile, "r");
+		if (f == NULL) {
+			return false;
+		}
+		size_t readsize = fread(&magic, sizeof(uint64_t), 1, f);
+		fclose(f);
+		return readsize == 1 && magic == COLUMNSTORE_FILE_MAGIC;
+	}
+
+	static uint32_t decompressColumn(uint32_t* compressedColumn, uint32_t inNumWords, float* decompressedColumn, uint32_t toIntegerScaler, CompressionCodec codec = lineDeltaCodec);
+	static uint32_t compressColumn(float* originalColumn, uint32_t inNumWords, uint32_t* compressedColumn, uint32_t toIntegerScaler, CompressionCodec codec = lineDeltaCodec);
+	// frameOfReferenceCodec, called by the two above
+	static uint32_t decompressFrames(uint32_t* compressedColumn, uint32_t inNumWords, float* decompressedColumn, uint32_t toIntegerScaler);
+	static uint32_t compressFrames(float* originalColumn, uint32_t inNumWords, uint32_t* compressedColumn, uint32_t toIntegerScaler);
+	// One minibatch of feature coordinate, the CTR nonce depends on both
+	void decryptColumn(uint32_t* encryptedColumn, uint32_t inNumWords, float* decryptedColumn, uint32_t coordinate, uint32_t minibatchIndex);
+	void encryptColumn(float* originalColumn, uint32_t inNumWords, uint32_t* encryptedColumn, uint32_t coordinate, uint32_t minibatchIndex);
+	// Decrypts just samples firstSample to firstSample+numSamples of feature coordinate, for
+	// samples encrypted in ctrMode without compression
+	void DecryptSamples(uint32_t coordinate, uint32_t firstSample, uint32_t numSamples, float* samples);
 
 	inline void ReturnDecompressedAndDecrypted(
 		float* transformedColumn1,
@@ -122,8 +875,13 @@ public:
 		bool useCompressed,
 		uint32_t toIntegerScaler,
 		double &decryptionTime,
-		double &decompressionTime)
+		double &decompressionTime,
+		bool decompress = true)
 	{
+		if (m_sparseRows != nullptr) {
+			// Sparse columns are read in place by the sparse kernels
+			return;
+		}
 		double timeStamp1, timeStamp2, timeStamp3;
 		for (uint32_t l = 0; l < numMinibatchesAtATime; l++) {
 			if (useEncrypted && useCompressed) {
@@ -132,29 +890,58 @@ public:
 					compressedSamplesOffset = m_compressedSamplesSizes[coordinate][minibatchIndex[l]-1];
 				}
 				timeStamp1 = get_time();
-				decryptColumn(m_encryptedSamples[coordinate] + compressedSamplesOffset, m_compressedSamplesSizes[coordinate][minibatchIndex[l]] - compressedSamplesOffset, transformedColumn1 + l*minibatchSize);
+				decryptColumn(m_encryptedSamples[coordinate] + compressedSamplesOffset, m_compressedSamplesSizes[coordinate][minibatchIndex[l]] - compressedSamplesOffset, transformedColumn1 + l*minibatchSize, coordinate, minibatchIndex[l]);
 				timeStamp2 = get_time();
 				decryptionTime += (timeStamp2-timeStamp1);
-				ColumnStore::decompressColumn((uint32_t*)transformedColumn1 + l*minibatchSize, m_compressedSamplesSizes[coordinate][minibatchIndex[l]] - compressedSamplesOffset, transformedColumn2 + l*minibatchSize, toIntegerScaler);
+				ColumnStore::decompressColumn((uint32_t*)transformedColumn1 + l*minibatchSize, m_compressedSamplesSizes[coordinate][minibatchIndex[l]] - compressedSamplesOffset, transformedColumn2 + l*minibatchSize, toIntegerScaler, m_compressedCodecs[coordinate]);
 				timeStamp3 = get_time();
 				decompressionTime += (timeStamp3-timeStamp2);
 			}
 			else if (useEncrypted) {
 				timeStamp1 = get_time();
-				decryptColumn(m_encryptedSamples[coordinate] + minibatchIndex[l]*minibatchSize, minibatchSize, transformedColumn2 + l*minibatchSize);
+				decryptColumn(m_encryptedSamples[coordinate] + minibatchIndex[l]*minibatchSize, minibatchSize, transformedColumn2 + l*minibatchSize, coordinate, minibatchIndex[l]);
 				timeStamp2 = get_time();
 				decryptionTime += (timeStamp2-timeStamp1);
 			}
 			else if (useCompressed) {
+				if (!decompress) {
+					// Left to the kernels that decode while computing, see AVX_CompressedGetStep
+					continue;
+				}
 				timeStamp1 = get_time();
 				int32_t compressedSamplesOffset = 0;
 				if (minibatchIndex[l] > 0) {
 					compressedSamplesOffset = m_compressedSamplesSizes[coordinate][minibatchIndex[l]-1];
 				}
-				ColumnStore::decompressColumn(m_compressedSamples[coordinate] + compressedSamplesOffset, m_compressedSamplesSizes[coordinate][minibatchIndex[l]] - compressedSamplesOffset, transformedColumn2 + l*minibatchSize, toIntegerScaler);
+				ColumnStore::decompressColumn(m_compressedSamples[coordinate] + compressedSamplesOffset, m_compressedSamplesSizes[coordinate][minibatchIndex[l]] - compressedSamplesOffset, transformedColumn2 + l*minibatchSize, toIntegerScaler, m_compressedCodecs[coordinate]);
 				timeStamp2 = get_time();
 				decompressionTime += (timeStamp2-timeStamp1);
 			}
+			else if (m_halfSamples != nullptr || m_quantizedSamples != nullptr) {
+				// Reduced precision and quantized columns are widened in place by the column kernels
+			}
+			else if (m_dictionaryCodes != nullptr) {
+				// Encoded columns are looked up in place by the dictionary kernels, the others are plain fp32
+				if (m_dictionaryCodes[coordinate] == nullptr) {
+					if (numMinibatchesAtATime > 1) {
+						memcpy(transformedColumn2 + l*minibatchSize, m_dictionaryPlain[coordinate] + minibatchIndex[l]*minibatchSize, minibatchSize*sizeof(float));
+					}
+					else {
+						transformedColumn2 = m_dictionaryPlain[coordinate] + minibatchIndex[l]*minibatchSize;
+					}
+				}
+			}
+			else if (m_paxSamples != nullptr) {
+				if (numMinibatchesAtATime > 1) {
+					memcpy(transformedColumn2 + l*minibatchSize, GetPaxSlice(coordinate, minibatchIndex[l]), minibatchSize*sizeof(float));
+				}
+				else {
+					transformedColumn2 = GetPaxSlice(coordinate, minibatchIndex[l]);
+				}
+			}
+			else if (m_chunkCache != nullptr) {
+				ReadColumn(coordinate, minibatchIndex[l]*minibatchSize, minibatchSize, transformedColumn2 + l*minibatchSize);
+			}
 			else if (numMinibatchesAtATime > 1) {
 				for (uint32_t i = 0; i < minibatchSize; i++) {
 					transformedColumn2[l*minibatchSize + i] = m_samples[coordinate][minibatchIndex[l]*minibatchSize + i];
@@ -169,16 +956,109 @@ public:
 	unsigned char m_initKey[32];
 	unsigned char* m_KEYS_enc;
 	unsigned char* m_KEYS_dec;
+	// The pipelined CBC decryption decryptColumn uses, picked for the CPU
+	AES_CBC_decrypt_function m_cbcDecrypt;
+	const char* m_cbcDecryptName;
+	AES_CTR_xcrypt_function m_ctrXcrypt;
 	unsigned char m_ivec[16] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
 private:
+	void* m_mappedFile;
+	size_t m_mappedFileSize;
+	bool m_samplesMapped;
+	bool m_compressedMapped;
+	bool m_encryptedMapped;
+	ChunkCache* m_chunkCache;
+
+	// Room the columns have for appended samples, 0 if they were allocated for exactly m_numSamples
+	uint32_t m_samplesCapacity;
+	uint32_t m_compressedCapacity;
+	uint32_t m_compressedSizesCapacity;
+	uint32_t m_encryptedCapacity;
+	uint32_t m_windowNumMinibatches;
+	uint32_t m_windowMinibatchSize;
+	// m_runningMin and m_runningMax are those of exactly the stored samples, not of samples
+	// the sliding window dropped since
+	bool m_runningMinMaxExact;
+
+	// Starts gathering m_runningMin and m_runningMax from scratch
+	void resetRunningMinMax() {
+		m_runningMin = (float*)realloc(m_runningMin, m_numFeatures*sizeof(float));
+		m_runningMax = (float*)realloc(m_runningMax, m_numFeatures*sizeof(float));
+		for (uint32_t j = 0; j < m_numFeatures; j++) {
+			m_runningMin[j] = numeric_limits<float>::max();
+			m_runningMax[j] = -numeric_limits<float>::max();
+		}
+		m_runningMinMaxExact = true;
+	}
+	// Column statistics pass over the dense samples, unless the running ones are exact
+	void gatherColumnStatistics(uint32_t numThreads);
+
+	void growColumns(void** columns, uint64_t usedBytes, uint64_t newBytes, HugePageArena* &arena, bool owned);
+	void growSamples(uint32_t capacity);
+	void compressMinibatches(uint32_t firstMinibatch, uint32_t lastMinibatch, uint32_t numThreads, bool chooseCodecs);
+	void encryptMinibatches(uint32_t firstMinibatch, uint32_t lastMinibatch, uint32_t numThreads);
+	// Returns how many of the minibatches do not decrypt to the samples they were encrypted from
+	uint32_t decryptMinibatches(uint32_t firstMinibatch, uint32_t lastMinibatch, uint32_t numThreads);
+	// m_ivec with feature coordinate and minibatch minibatchIndex in its high 64 bits
+	void ctrNonce(uint32_t coordinate, uint32_t minibatchIndex, unsigned char nonce[16]);
+	void dropOldestMinibatches(uint32_t numMinibatches, uint32_t minibatchSize);
+
+	ArenaPageSize m_arenaPageSize;
+	uint32_t m_arenaStridePadding;
+	HugePageArena* m_samplesArena;
+	HugePageArena* m_halfArena;
+	HugePageArena* m_quantizedArena;
+	HugePageArena* m_paxArena;
+	HugePageArena* m_compressedArena;
+	HugePageArena* m_encryptedArena;
+
+	// Allocates the m_numFeatures columns of columnBytes each, from a new arena if UseArena was called
+	void allocColumns(void** columns, uint64_t columnBytes, HugePageArena* &arena) {
+		if (m_arenaPageSize == noArena) {
+			for (uint32_t j = 0; j < m_numFeatures; j++) {
+				columns[j] = aligned_alloc(64, columnBytes);
+			}
+			return;
+		}
+		arena = new HugePageArena(m_numFeatures*HugePageArena::GetStride(columnBytes, m_arenaStridePadding), m_arenaPageSize);
+		for (uint32_t j = 0; j < m_numFeatures; j++) {
+			columns[j] = arena->Allocate(columnBytes, m_arenaStridePadding);
+		}
+	}
+
+	void freeColumns(void** columns, HugePageArena* &arena) {
+		if (arena != nullptr) {
+			delete arena;
+			arena = nullptr;
+			return;
+		}
+		for (uint32_t j = 0; j < m_numFeatures; j++) {
+			free(columns[j]);
+		}
+	}
+
+	// Exits for operations that need m_samples, i.e. sparse and out-of-core stores
+	void requireDenseSamples(const char* operation) {
+		if (m_samples == nullptr) {
+			cout << operation << " needs the dense samples in memory!" << endl;
+			exit(1);
+		}
+	}
+
+	void unmapFile() {
+		if (m_mappedFile != nullptr) {
+			munmap(m_mappedFile, m_mappedFileSize);
+			m_mappedFile = nullptr;
+			m_mappedFileSize = 0;
+		}
+	}
+
 	void reallocData() {
 		deallocData();
 		
 		// Allocate memory
 		m_samples = (float**)malloc(m_numFeatures*sizeof(float*));
-		for (uint32_t j = 0; j < m_numFeatures; j++) {
-			m_samples[j] = (float*)aligned_alloc(64, m_numSamples*sizeof(float));
-		}
+		allocColumns((void**)m_samples, m_numSamples*sizeof(float), m_samplesArena);
 		m_labels = (float*)aligned_alloc(64, m_numSamples*sizeof(float));
 	}
 
@@ -186,58 +1066,208 @@ private:
 		// dealloc if not nullptr
 		if (m_samples != nullptr) {
 			cout << "Freeing m_samples..." << endl;
-			for (uint32_t j = 0; j < m_numFeatures; j++) {
-				free(m_samples[j]);
+			if (!m_samplesMapped) {
+				freeColumns((void**)m_samples, m_samplesArena);
 			}
 			free(m_samples);
+			m_samples = nullptr;
+		}
+		deallocSparse();
+		deallocHalf();
+		deallocQuantized();
+		deallocDictionary();
+		deallocRuns();
+		deallocPax();
+		if (m_chunkCache != nullptr) {
+			cout << "Closing out-of-core samples..." << endl;
+			delete m_chunkCache;
+			m_chunkCache = nullptr;
 		}
 		if (m_labels != nullptr) {
 			cout << "Freeing m_labels..." << endl;
-			free(m_labels);
+			if (!m_samplesMapped) {
+				free(m_labels);
+			}
+			m_labels = nullptr;
+		}
+		m_samplesMapped = false;
+		m_samplesCapacity = 0;
+		free(m_runningMin);
+		free(m_runningMax);
+		m_runningMin = nullptr;
+		m_runningMax = nullptr;
+		m_runningMinMaxExact = false;
+	}
+
+	void reallocSparse() {
+		deallocSparse();
+
+		m_sparseRows = (uint32_t**)malloc(m_numFeatures*sizeof(uint32_t*));
+		m_sparseValues = (float**)malloc(m_numFeatures*sizeof(float*));
+		m_sparseNnz = (uint32_t*)malloc(m_numFeatures*sizeof(uint32_t));
+		memset(m_sparseRows, 0, m_numFeatures*sizeof(uint32_t*));
+		memset(m_sparseValues, 0, m_numFeatures*sizeof(float*));
+		memset(m_sparseNnz, 0, m_numFeatures*sizeof(uint32_t));
+	}
+
+	void deallocSparse() {
+		if (m_sparseRows != nullptr) {
+			cout << "Freeing sparse samples..." << endl;
+			for (uint32_t j = 0; j < m_numFeatures; j++) {
+				free(m_sparseRows[j]);
+				free(m_sparseValues[j]);
+				if (m_sparseSegments != nullptr) {
+					free(m_sparseSegments[j]);
+				}
+			}
+			free(m_sparseRows);
+			free(m_sparseValues);
+			free(m_sparseNnz);
+			free(m_sparseSegments);
+			m_sparseRows = nullptr;
+			m_sparseValues = nullptr;
+			m_sparseNnz = nullptr;
+			m_sparseSegments = nullptr;
 		}
+		m_sparseMinibatchSize = 0;
 	}
 
-	void reallocCompressed(uint32_t numMinibatches) {
+	void deallocHalf() {
+		if (m_halfSamples != nullptr) {
+			cout << "Freeing m_halfSamples..." << endl;
+			freeColumns((void**)m_halfSamples, m_halfArena);
+			free(m_halfSamples);
+			m_halfSamples = nullptr;
+		}
+		m_samplesPrecision = fp32;
+	}
+
+	void deallocQuantized() {
+		if (m_quantizedSamples != nullptr) {
+			cout << "Freeing m_quantizedSamples..." << endl;
+			freeColumns((void**)m_quantizedSamples, m_quantizedArena);
+			free(m_quantizedSamples);
+			free(m_quantizedScale);
+			free(m_quantizedMin);
+			m_quantizedSamples = nullptr;
+			m_quantizedScale = nullptr;
+			m_quantizedMin = nullptr;
+		}
+		m_quantizedBits = 0;
+	}
+
+	void deallocDictionary() {
+		if (m_dictionaryCodes != nullptr) {
+			cout << "Freeing dictionary encoded samples..." << endl;
+			for (uint32_t j = 0; j < m_numFeatures; j++) {
+				free(m_dictionaryCodes[j]);
+				free(m_dictionaryValues[j]);
+				free(m_dictionaryPlain[j]);
+			}
+			free(m_dictionaryCodes);
+			free(m_dictionaryValues);
+			free(m_dictionarySizes);
+			free(m_dictionaryPlain);
+			m_dictionaryCodes = nullptr;
+			m_dictionaryValues = nullptr;
+			m_dictionarySizes = nullptr;
+			m_dictionaryPlain = nullptr;
+		}
+	}
+
+	void deallocRuns() {
+		if (m_runStarts != nullptr) {
+			cout << "Freeing run-length columns..." << endl;
+			for (uint32_t j = 0; j < m_numFeatures; j++) {
+				free(m_runStarts[j]);
+				free(m_runValues[j]);
+			}
+			free(m_runStarts);
+			free(m_runValues);
+			free(m_numRuns);
+			m_runStarts = nullptr;
+			m_runValues = nullptr;
+			m_numRuns = nullptr;
+			m_runsUseCompressed = false;
+		}
+	}
+
+	void deallocPax() {
+		if (m_paxSamples != nullptr) {
+			cout << "Freeing m_paxSamples..." << endl;
+			if (m_paxArena != nullptr) {
+				delete m_paxArena;
+				m_paxArena = nullptr;
+			}
+			else {
+				free(m_paxSamples);
+			}
+			m_paxSamples = nullptr;
+		}
+		m_paxChunkSize = 0;
+	}
+
+	void reallocCompressed(uint32_t numMinibatches, uint32_t minibatchSize) {
 		deallocCompressed();
 
+		uint32_t capacity = max((uint64_t)m_numSamples, numMinibatches*MaxCompressedMinibatchWords(minibatchSize));
 		m_compressedSamples = (uint32_t**)malloc(m_numFeatures*sizeof(uint32_t*));
 		m_compressedSamplesSizes = (uint32_t**)malloc(m_numFeatures*sizeof(uint32_t*));
+		m_compressedCodecs = (CompressionCodec*)malloc(m_numFeatures*sizeof(CompressionCodec));
+		allocColumns((void**)m_compressedSamples, (uint64_t)capacity*sizeof(uint32_t), m_compressedArena);
 		for (uint32_t j = 0; j < m_numFeatures; j++) {
-			m_compressedSamples[j] = (uint32_t*)aligned_alloc(64, m_numSamples*sizeof(uint32_t));
 			m_compressedSamplesSizes[j] = (uint32_t*)aligned_alloc(64, numMinibatches*sizeof(uint32_t));
+			m_compressedCodecs[j] = lineDeltaCodec;
 		}
+		m_compressedCapacity = capacity;
+		m_compressedSizesCapacity = numMinibatches;
 	}
 
 	void deallocCompressed() {
 		if (m_compressedSamples != nullptr) {
-			for (uint32_t j = 0; j < m_numFeatures; j++) {
-				free(m_compressedSamples[j]);
+			if (!m_compressedMapped) {
+				freeColumns((void**)m_compressedSamples, m_compressedArena);
 			}
 			free(m_compressedSamples);
+			m_compressedSamples = nullptr;
 		}
 		if (m_compressedSamplesSizes != nullptr) {
-			for (uint32_t j = 0; j < m_numFeatures; j++) {
-				free(m_compressedSamplesSizes[j]);
+			if (!m_compressedMapped) {
+				for (uint32_t j = 0; j < m_numFeatures; j++) {
+					free(m_compressedSamplesSizes[j]);
+				}
 			}
 			free(m_compressedSamplesSizes);
+			m_compressedSamplesSizes = nullptr;
 		}
+		free(m_compressedCodecs);
+		m_compressedCodecs = nullptr;
+		m_compressedMapped = false;
+		m_compressedMinibatchSize = 0;
+		m_compressedCapacity = 0;
+		m_compressedSizesCapacity = 0;
 	}
 
-	void reallocEncrypted() {
+	void reallocEncrypted(uint32_t capacity) {
 		deallocEncrypted();
 
 		m_encryptedSamples = (uint32_t**)malloc(m_numFeatures*sizeof(uint32_t*));
-		for (uint32_t j = 0; j < m_numFeatures; j++) {
-			m_encryptedSamples[j] = (uint32_t*)aligned_alloc(64, m_numSamples*sizeof(uint32_t));
-		}
+		allocColumns((void**)m_encryptedSamples, (uint64_t)capacity*sizeof(uint32_t), m_encryptedArena);
+		m_encryptedCapacity = capacity;
 	}
 
 	void deallocEncrypted() {
 		if (m_encryptedSamples != nullptr) {
-			for (uint32_t j = 0; j < m_numFeatures; j++) {
-				free(m_encryptedSamples[j]);
+			if (!m_encryptedMapped) {
+				freeColumns((void**)m_encryptedSamples, m_encryptedArena);
 			}
 			free(m_encryptedSamples);
+			m_encryptedSamples = nullptr;
 		}
+		m_encryptedMapped = false;
+		m_encryptedMinibatchSize = 0;
+		m_encryptedCapacity = 0;
+		m_encryptionMode = cbcMode;
+		m_encryptedMinibatchBase = 0;
 	}
 };
\ No newline at end of file
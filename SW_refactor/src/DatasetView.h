@@ -0,0 +1,132 @@
+// Copyright (C) 2018 Kaan Kara - Systems Group, ETH Zurich
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+//*************************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+
+using namespace std;
+
+// A subset of the samples of one ColumnStore, for training on one part and evaluating on
+// another without copying or reloading anything. The view only lists which samples belong
+// to it: either whole minibatches, which every solver accepts as long as the solver's
+// minibatch size divides m_minibatchSize, or single samples, which SGD, AVXrowwise_SGD,
+// blockwise_SGD and Loss/Accuracy accept.
+class DatasetView {
+public:
+	uint32_t m_numSamples;
+
+	// Minibatch views, m_minibatches is nullptr for index views
+	uint32_t m_minibatchSize;
+	uint32_t m_numMinibatches;
+	uint32_t* m_minibatches;
+
+	// Index views, m_sampleIndexes is nullptr for minibatch views
+	uint32_t* m_sampleIndexes;
+
+	~DatasetView() {
+		free(m_minibatches);
+		free(m_sampleIndexes);
+	}
+
+	// Minibatches firstMinibatch .. firstMinibatch+numMinibatches-1
+	static DatasetView* CreateMinibatchRange(uint32_t firstMinibatch, uint32_t numMinibatches, uint32_t minibatchSize) {
+		DatasetView* view = new DatasetView(numMinibatches, minibatchSize);
+		for (uint32_t k = 0; k < numMinibatches; k++) {
+			view->m_minibatches[k] = firstMinibatch + k;
+		}
+		return view;
+	}
+
+	// The listed minibatches in the listed order, the list is copied
+	static DatasetView* CreateMinibatchList(uint32_t* minibatches, uint32_t numMinibatches, uint32_t minibatchSize) {
+		DatasetView* view = new DatasetView(numMinibatches, minibatchSize);
+		memcpy(view->m_minibatches, minibatches, numMinibatches*sizeof(uint32_t));
+		return view;
+	}
+
+	// The listed samples in the listed order, the list is copied
+	static DatasetView* CreateIndexList(uint32_t* sampleIndexes, uint32_t numSamples) {
+		DatasetView* view = new DatasetView();
+		view->m_numSamples = numSamples;
+		view->m_sampleIndexes = (uint32_t*)malloc((numSamples > 0 ? numSamples : 1)*sizeof(uint32_t));
+		memcpy(view->m_sampleIndexes, sampleIndexes, numSamples*sizeof(uint32_t));
+		return view;
+	}
+
+	// Fold 'fold' out of numFolds over minibatches 0 .. numMinibatches-1: the test view gets
+	// the fold's contiguous share of the minibatches, the train view all the others
+	static void CreateFold(
+		uint32_t numMinibatches,
+		uint32_t minibatchSize,
+		uint32_t numFolds,
+		uint32_t fold,
+		DatasetView*& trainView,
+		DatasetView*& testView)
+	{
+		if (numFolds == 0 || fold >= numFolds || numMinibatches < numFolds) {
+			cout << "Fold " << fold << " out of " << numFolds << " is not possible with " << numMinibatches << " minibatches!" << endl;
+			exit(1);
+		}
+		uint32_t firstTestMinibatch = (uint64_t)fold*numMinibatches/numFolds;
+		uint32_t endTestMinibatch = (uint64_t)(fold+1)*numMinibatches/numFolds;
+
+		testView = CreateMinibatchRange(firstTestMinibatch, endTestMinibatch - firstTestMinibatch, minibatchSize);
+		trainView = new DatasetView(numMinibatches - (endTestMinibatch - firstTestMinibatch), minibatchSize);
+		uint32_t k = 0;
+		for (uint32_t m = 0; m < numMinibatches; m++) {
+			if (m < firstTestMinibatch || m >= endTestMinibatch) {
+				trainView->m_minibatches[k++] = m;
+			}
+		}
+	}
+
+	bool IsMinibatchView() {
+		return m_minibatches != nullptr;
+	}
+
+	// Index in the store of sample i of the view
+	inline uint32_t GetSample(uint32_t i) {
+		if (m_minibatches != nullptr) {
+			return m_minibatches[i/m_minibatchSize]*m_minibatchSize + i%m_minibatchSize;
+		}
+		return m_sampleIndexes[i];
+	}
+
+private:
+	DatasetView() {
+		m_numSamples = 0;
+		m_minibatchSize = 0;
+		m_numMinibatches = 0;
+		m_minibatches = nullptr;
+		m_sampleIndexes = nullptr;
+	}
+
+	DatasetView(uint32_t numMinibatches, uint32_t minibatchSize) {
+		m_numSamples = numMinibatches*minibatchSize;
+		m_minibatchSize = minibatchSize;
+		m_numMinibatches = numMinibatches;
+		// Also for no minibatches, an empty minibatch view is still a minibatch view
+		m_minibatches = (uint32_t*)malloc((numMinibatches > 0 ? numMinibatches : 1)*sizeof(uint32_t));
+		m_sampleIndexes = nullptr;
+	}
+
+	DatasetView(const DatasetView&);
+	DatasetView& operator=(const DatasetView&);
+};
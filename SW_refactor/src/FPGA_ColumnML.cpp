@@ -226,6 +226,17 @@ void FPGA_ColumnML::FPGA_SCD(
 		cout << "numInstancesToUse is larger than NUM_FINSTANCES" << endl;
 		exit(1);
 	}
+	// The instances stream the columns as copied to the shared memory, from sample 0 on
+	if (args->m_view != nullptr || args->m_firstSample > 0) {
+		cout << "FPGA_SCD trains on the first m_numSamples samples, views can only be evaluated!" << endl;
+		exit(1);
+	}
+	// The AES core on the FPGA only decrypts CBC
+	if (useEncrypted && m_cstore->m_encryptionMode != cbcMode) {
+		cout << "FPGA_SCD needs samples encrypted in cbcMode!" << endl;
+		exit(1);
+	}
+	CheckNoNormalization(args, "FPGA_SCD");
 
 	cout << "SCD ---------------------------------------" << endl;
 	uint32_t numMinibatches = args->m_numSamples/minibatchSize;
@@ -261,6 +272,13 @@ void FPGA_ColumnML::FPGA_SCD(
 	}
 
 	if (useCompressed) {
+		// The instances only decode the line format
+		for (uint32_t j = 0; j < m_cstore->m_numFeatures; j++) {
+			if (m_cstore->m_compressedCodecs[j] != lineDeltaCodec) {
+				cout << "FPGA_SCD needs columns compressed with lineDeltaCodec, feature " << j << " is not!" << endl;
+				exit(1);
+			}
+		}
 		FPGA_CopyCompressedDataIntoMemory(numMinibatches, minibatchSize, numMinibatchesToAssign, numEpochs, useEncrypted);
 	}
 	else {
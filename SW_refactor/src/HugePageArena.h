@@ -0,0 +1,135 @@
+// Copyright (C) 2018 Kaan Kara - Systems Group, ETH Zurich
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+//*************************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <sys/mman.h>
+
+using namespace std;
+
+#define ARENA_ALIGNMENT 64
+#define HUGE_PAGE_SIZE_2MB (1ULL << 21)
+#define HUGE_PAGE_SIZE_1GB (1ULL << 30)
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+enum ArenaPageSize {noArena, smallPages, hugePages2MB, hugePages1GB};
+
+// One mapping that a set of equally sized columns is carved out of, front to back. Consecutive
+// columns are stridePadding bytes further apart than their 64 byte aligned size, so that the
+// same sample of neighbouring columns does not always fall into the same cache set.
+// Huge pages come from the hugetlb pool if pages are reserved there, otherwise the mapping
+// is left to transparent huge pages.
+class HugePageArena {
+public:
+	HugePageArena(uint64_t capacity, ArenaPageSize pageSize) {
+		uint64_t pageBytes = (pageSize == hugePages1GB) ? HUGE_PAGE_SIZE_1GB : (pageSize == hugePages2MB) ? HUGE_PAGE_SIZE_2MB : 4096;
+		m_capacity = (capacity + pageBytes-1)/pageBytes*pageBytes;
+		m_used = 0;
+
+		m_base = MAP_FAILED;
+		if (pageSize == hugePages2MB || pageSize == hugePages1GB) {
+			int log2PageBytes = (pageSize == hugePages1GB) ? 30 : 21;
+			m_base = mmap(NULL, m_capacity, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB|(log2PageBytes << MAP_HUGE_SHIFT), -1, 0);
+			if (m_base == MAP_FAILED) {
+				cout << "HugePageArena: no reserved " << ((pageSize == hugePages1GB) ? "1GB" : "2MB") << " pages, using transparent huge pages" << endl;
+			}
+		}
+		if (m_base == MAP_FAILED) {
+			m_base = mmap(NULL, m_capacity, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+			if (m_base == MAP_FAILED) {
+				cout << "HugePageArena: mapping " << m_capacity << " bytes failed" << endl;
+				exit(1);
+			}
+			if (pageSize == hugePages2MB || pageSize == hugePages1GB) {
+				madvise(m_base, m_capacity, MADV_HUGEPAGE);
+			}
+		}
+	}
+
+	~HugePageArena() {
+		munmap(m_base, m_capacity);
+	}
+
+	// Distance between the starts of two consecutive columns of numBytes
+	static uint64_t GetStride(uint64_t numBytes, uint32_t stridePadding) {
+		return (numBytes + ARENA_ALIGNMENT-1)/ARENA_ALIGNMENT*ARENA_ALIGNMENT + (stridePadding + ARENA_ALIGNMENT-1)/ARENA_ALIGNMENT*ARENA_ALIGNMENT;
+	}
+
+	void* Allocate(uint64_t numBytes, uint32_t stridePadding) {
+		uint64_t stride = GetStride(numBytes, stridePadding);
+		if (m_used + stride > m_capacity) {
+			cout << "HugePageArena: out of space, " << m_capacity << " bytes" << endl;
+			exit(1);
+		}
+		void* allocation = (char*)m_base + m_used;
+		m_used += stride;
+		return allocation;
+	}
+
+private:
+	void* m_base;
+	uint64_t m_capacity;
+	uint64_t m_used;
+};
+
+enum ScratchSlot {scratchResidual, scratchX, scratchXFinal, scratchColumn1, scratchColumn2, scratchDecodedColumns, numScratchSlots};
+
+// Buffers a solver thread reuses from one call to the next instead of allocating them every
+// time. A slot only grows, buffers of 2MB and more are backed by transparent huge pages.
+class ScratchPool {
+public:
+	ScratchPool() {
+		for (uint32_t s = 0; s < numScratchSlots; s++) {
+			m_buffers[s] = nullptr;
+			m_capacities[s] = 0;
+		}
+	}
+
+	~ScratchPool() {
+		for (uint32_t s = 0; s < numScratchSlots; s++) {
+			free(m_buffers[s]);
+		}
+	}
+
+	// The contents are undefined, callers initialize what they read
+	float* Get(ScratchSlot slot, uint64_t numFloats) {
+		uint64_t numBytes = numFloats*sizeof(float);
+		if (numBytes > m_capacities[slot]) {
+			free(m_buffers[slot]);
+			if (numBytes >= HUGE_PAGE_SIZE_2MB) {
+				numBytes = (numBytes + HUGE_PAGE_SIZE_2MB-1)/HUGE_PAGE_SIZE_2MB*HUGE_PAGE_SIZE_2MB;
+				m_buffers[slot] = (float*)aligned_alloc(HUGE_PAGE_SIZE_2MB, numBytes);
+				madvise(m_buffers[slot], numBytes, MADV_HUGEPAGE);
+			}
+			else {
+				numBytes = (numBytes + ARENA_ALIGNMENT-1)/ARENA_ALIGNMENT*ARENA_ALIGNMENT;
+				m_buffers[slot] = (float*)aligned_alloc(ARENA_ALIGNMENT, numBytes);
+			}
+			m_capacities[slot] = numBytes;
+		}
+		return m_buffers[slot];
+	}
+
+private:
+	float* m_buffers[numScratchSlots];
+	uint64_t m_capacities[numScratchSlots];
+};
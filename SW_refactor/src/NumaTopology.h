@@ -0,0 +1,129 @@
+// Copyright (C) 2018 Kaan Kara - Systems Group, ETH Zurich
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+//*************************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <vector>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+using namespace std;
+
+#define NUMA_PAGE_SIZE 4096
+#define NUMA_MAX_NODES 960
+// From linux/mempolicy.h, so that we do not depend on libnuma
+#define NUMA_MPOL_BIND 2
+#define NUMA_MPOL_MF_MOVE (1<<1)
+
+// CPUs of every online NUMA node as listed in sysfs. Falls back to a single node holding all
+// online CPUs if sysfs does not describe the nodes.
+class NumaTopology {
+public:
+	NumaTopology() {
+		vector<uint32_t> onlineNodes = ReadList("/sys/devices/system/node/online");
+		for (uint32_t k = 0; k < onlineNodes.size(); k++) {
+			char path[128];
+			sprintf(path, "/sys/devices/system/node/node%u/cpulist", onlineNodes[k]);
+			vector<uint32_t> cpus = ReadList(path);
+			// Memory-only nodes get no threads
+			if (cpus.size() > 0 && onlineNodes[k] < NUMA_MAX_NODES) {
+				m_nodes.push_back(onlineNodes[k]);
+				m_nodeCpus.push_back(cpus);
+			}
+		}
+		if (m_nodeCpus.size() == 0) {
+			vector<uint32_t> cpus;
+			long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+			for (long c = 0; c < numCpus; c++) {
+				cpus.push_back(c);
+			}
+			m_nodes.push_back(0);
+			m_nodeCpus.push_back(cpus);
+		}
+	}
+
+	uint32_t GetNumNodes() {
+		return m_nodes.size();
+	}
+
+	// Threads are split into contiguous groups, one per node, so that neighbouring
+	// minibatch ranges end up on the same socket. Within a node the threads take the
+	// CPUs in sysfs order, which lists the physical cores before their SMT siblings.
+	uint32_t GetThreadNode(uint32_t tid, uint32_t numThreads) {
+		return m_nodes[GetThreadNodeIndex(tid, numThreads)];
+	}
+
+	uint32_t GetThreadCpu(uint32_t tid, uint32_t numThreads) {
+		uint32_t nodeIndex = GetThreadNodeIndex(tid, numThreads);
+		uint32_t firstThread = (uint32_t)(((uint64_t)nodeIndex*numThreads + m_nodes.size()-1)/m_nodes.size());
+		vector<uint32_t>& cpus = m_nodeCpus[nodeIndex];
+		return cpus[(tid - firstThread)%cpus.size()];
+	}
+
+	// Binds (and migrates) the pages that lie fully inside [address, address+numBytes) to node.
+	// Pages shared with a neighbouring range are left where they are.
+	static void BindToNode(void* address, uint64_t numBytes, uint32_t node) {
+		uint64_t begin = ((uint64_t)address + NUMA_PAGE_SIZE-1)/NUMA_PAGE_SIZE*NUMA_PAGE_SIZE;
+		uint64_t end = ((uint64_t)address + numBytes)/NUMA_PAGE_SIZE*NUMA_PAGE_SIZE;
+		if (end <= begin || node >= NUMA_MAX_NODES) {
+			return;
+		}
+		unsigned long nodeMask[NUMA_MAX_NODES/(8*sizeof(unsigned long)) + 1];
+		memset(nodeMask, 0, sizeof(nodeMask));
+		nodeMask[node/(8*sizeof(unsigned long))] = 1UL << (node%(8*sizeof(unsigned long)));
+		syscall(SYS_mbind, begin, end - begin, NUMA_MPOL_BIND, nodeMask, NUMA_MAX_NODES + 1, NUMA_MPOL_MF_MOVE);
+	}
+
+private:
+	vector<uint32_t> m_nodes;
+	vector< vector<uint32_t> > m_nodeCpus;
+
+	uint32_t GetThreadNodeIndex(uint32_t tid, uint32_t numThreads) {
+		return (uint32_t)((uint64_t)tid*m_nodes.size()/numThreads);
+	}
+
+	// Parses a sysfs list such as "0-23,48-71", empty if the file does not exist
+	static vector<uint32_t> ReadList(const char* path) {
+		vector<uint32_t> list;
+		FILE* f = fopen(path, "r");
+		if (f == NULL) {
+			return list;
+		}
+		uint32_t first, last;
+		char separator;
+		while (fscanf(f, "%u", &first) == 1) {
+			last = first;
+			if (fscanf(f, "%c", &separator) == 1 && separator == '-') {
+				if (fscanf(f, "%u", &last) != 1) {
+					break;
+				}
+				if (fscanf(f, "%c", &separator) != 1) {
+					separator = 0;
+				}
+			}
+			for (uint32_t c = first; c <= last; c++) {
+				list.push_back(c);
+			}
+		}
+		fclose(f);
+		return list;
+	}
+};
@@ -19,6 +19,7 @@
 #include <wmmintrin.h>
 #include <emmintrin.h>
 #include <smmintrin.h>
+#include <immintrin.h>
 
 inline void KEY_256_ASSIST_1(__m128i* temp1, __m128i * temp2) { 
     __m128i temp4; 
@@ -155,6 +156,163 @@ static void AES_CBC_decrypt(const unsigned char *in,
     } 
 }
 
+// CBC decryption of the blocks does not depend on the previous plaintext, only on the previous
+// ciphertext, so the blocks below are decrypted in batches of 8 (16 with AVX-512) independent ones
+// that fill the AES pipeline. Same arguments and result as AES_CBC_decrypt, in may equal out.
+static void AES_CBC_decrypt_8x(const unsigned char *in,
+                     unsigned char *out,
+                     unsigned char ivec[16],
+                     unsigned long length,
+                     unsigned char *key,
+                     int number_of_rounds) {
+    __m128i data[8], last_in[8], feedback;
+    unsigned long i;
+    int j, k;
+    if (length%16)
+        length = length/16+1;
+    else
+        length /=16;
+    feedback = _mm_loadu_si128 ((__m128i*)ivec);
+    for(i = 0; i + 8 <= length; i += 8) {
+        for(k = 0; k < 8; k++) {
+            last_in[k] = _mm_loadu_si128 (&((__m128i*)in)[i+k]);
+            data[k] = _mm_xor_si128 (last_in[k],((__m128i*)key)[0]);
+        }
+        for(j = 1; j < number_of_rounds; j++) {
+            __m128i round_key = ((__m128i*)key)[j];
+            for(k = 0; k < 8; k++) {
+                data[k] = _mm_aesdec_si128 (data[k],round_key);
+            }
+        }
+        for(k = 0; k < 8; k++) {
+            data[k] = _mm_aesdeclast_si128 (data[k],((__m128i*)key)[j]);
+        }
+        _mm_storeu_si128 (&((__m128i*)out)[i],_mm_xor_si128 (data[0],feedback));
+        for(k = 1; k < 8; k++) {
+            _mm_storeu_si128 (&((__m128i*)out)[i+k],_mm_xor_si128 (data[k],last_in[k-1]));
+        }
+        feedback = last_in[7];
+    }
+    for(; i < length; i++) {
+        last_in[0] = _mm_loadu_si128 (&((__m128i*)in)[i]);
+        data[0] = _mm_xor_si128 (last_in[0],((__m128i*)key)[0]);
+        for(j = 1; j < number_of_rounds; j++) {
+            data[0] = _mm_aesdec_si128 (data[0],((__m128i*)key)[j]);
+        }
+        data[0] = _mm_aesdeclast_si128 (data[0],((__m128i*)key)[j]);
+        _mm_storeu_si128 (&((__m128i*)out)[i],_mm_xor_si128 (data[0],feedback));
+        feedback = last_in[0];
+    }
+}
+
+// VAES on 256 bit registers, 2 blocks per register. The previous ciphertexts of a register are
+// its own low block and the high block of the register before.
+__attribute__((target("vaes,avx2")))
+static void AES_CBC_decrypt_vaes256(const unsigned char *in,
+                     unsigned char *out,
+                     unsigned char ivec[16],
+                     unsigned long length,
+                     unsigned char *key,
+                     int number_of_rounds) {
+    __m256i data[4], last_in[4], feedback;
+    unsigned long i;
+    int j, k;
+    unsigned long blocks = (length%16) ? length/16+1 : length/16;
+    feedback = _mm256_broadcastsi128_si256 (_mm_loadu_si128 ((__m128i*)ivec));
+    for(i = 0; i + 8 <= blocks; i += 8) {
+        __m256i round_key = _mm256_broadcastsi128_si256 (((__m128i*)key)[0]);
+        for(k = 0; k < 4; k++) {
+            last_in[k] = _mm256_loadu_si256 ((__m256i*)&((__m128i*)in)[i+2*k]);
+            data[k] = _mm256_xor_si256 (last_in[k],round_key);
+        }
+        for(j = 1; j < number_of_rounds; j++) {
+            round_key = _mm256_broadcastsi128_si256 (((__m128i*)key)[j]);
+            for(k = 0; k < 4; k++) {
+                data[k] = _mm256_aesdec_epi128 (data[k],round_key);
+            }
+        }
+        round_key = _mm256_broadcastsi128_si256 (((__m128i*)key)[j]);
+        for(k = 0; k < 4; k++) {
+            data[k] = _mm256_aesdeclast_epi128 (data[k],round_key);
+            data[k] = _mm256_xor_si256 (data[k],_mm256_permute2x128_si256 (last_in[k],(k == 0) ? feedback : last_in[k-1],0x03));
+            _mm256_storeu_si256 ((__m256i*)&((__m128i*)out)[i+2*k],data[k]);
+        }
+        feedback = last_in[3];
+    }
+    if (i < blocks) {
+        unsigned char tail_ivec[16];
+        _mm_storeu_si128 ((__m128i*)tail_ivec,_mm256_extracti128_si256 (feedback,1));
+        AES_CBC_decrypt_8x(in + 16*i,out + 16*i,tail_ivec,16*(blocks - i),key,number_of_rounds);
+    }
+}
+
+// The block in all 4 lanes. _mm512_broadcast_i32x4 merges into an undefined register, which GCC
+// reports as uninitialized, the zero-masked form with all lanes kept is the same instruction.
+__attribute__((target("avx512f")))
+static inline __m512i AES_Broadcast_512(__m128i block) {
+    return _mm512_maskz_broadcast_i32x4 ((__mmask16)-1,block);
+}
+
+// VAES on 512 bit registers, 4 blocks per register
+__attribute__((target("vaes,avx512f")))
+static void AES_CBC_decrypt_vaes512(const unsigned char *in,
+                     unsigned char *out,
+                     unsigned char ivec[16],
+                     unsigned long length,
+                     unsigned char *key,
+                     int number_of_rounds) {
+    __m512i data[4], last_in[4], round_keys[15], feedback;
+    unsigned long i;
+    int j, k;
+    unsigned long blocks = (length%16) ? length/16+1 : length/16;
+    for(j = 0; j <= number_of_rounds; j++) {
+        round_keys[j] = AES_Broadcast_512 (((__m128i*)key)[j]);
+    }
+    feedback = AES_Broadcast_512 (_mm_loadu_si128 ((__m128i*)ivec));
+    for(i = 0; i + 16 <= blocks; i += 16) {
+        for(k = 0; k < 4; k++) {
+            last_in[k] = _mm512_loadu_si512 ((__m512i*)&((__m128i*)in)[i+4*k]);
+            data[k] = _mm512_xor_si512 (last_in[k],round_keys[0]);
+        }
+        for(j = 1; j < number_of_rounds; j++) {
+            for(k = 0; k < 4; k++) {
+                data[k] = _mm512_aesdec_epi128 (data[k],round_keys[j]);
+            }
+        }
+        for(k = 0; k < 4; k++) {
+            data[k] = _mm512_aesdeclast_epi128 (data[k],round_keys[j]);
+            // The high block of the register before, then the 3 low blocks of this one (zero-masked
+            // for the same reason as AES_Broadcast_512)
+            data[k] = _mm512_xor_si512 (data[k],_mm512_maskz_alignr_epi64 ((__mmask8)-1,last_in[k],(k == 0) ? feedback : last_in[k-1],6));
+            _mm512_storeu_si512 ((__m512i*)&((__m128i*)out)[i+4*k],data[k]);
+        }
+        feedback = last_in[3];
+    }
+    if (i < blocks) {
+        // The last ciphertext block is the high lane of feedback
+        unsigned char tail_ivec[64];
+        _mm512_storeu_si512 ((__m512i*)tail_ivec,feedback);
+        AES_CBC_decrypt_8x(in + 16*i,out + 16*i,tail_ivec + 48,16*(blocks - i),key,number_of_rounds);
+    }
+}
+
+typedef void (*AES_CBC_decrypt_function)(const unsigned char*, unsigned char*, unsigned char*, unsigned long, unsigned char*, int);
+
+// The widest of the CBC decryptions above the CPU runs
+static AES_CBC_decrypt_function AES_Select_CBC_decrypt(const char** name) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("vaes") && __builtin_cpu_supports("avx512f")) {
+        *name = "VAES/AVX-512";
+        return AES_CBC_decrypt_vaes512;
+    }
+    if (__builtin_cpu_supports("vaes") && __builtin_cpu_supports("avx2")) {
+        *name = "VAES/AVX2";
+        return AES_CBC_decrypt_vaes256;
+    }
+    *name = "AES-NI";
+    return AES_CBC_decrypt_8x;
+}
+
 static void AES_CTR_encrypt (const unsigned char *in, 
                       unsigned char *out, 
                       const unsigned char ivec[8], 
@@ -190,3 +348,100 @@ static void AES_CTR_encrypt (const unsigned char *in,
         _mm_storeu_si128 (&((__m128i*)out)[i], tmp);
     } 
 }
+
+// CTR mode with 128 bit counter blocks nonce + n, n counted in the low 64 bits, for the blocks
+// n = first_block, first_block+1, ... Encryption and decryption are the same. Every block is
+// independent, so any block range of a stream can be processed on its own, and a last partial
+// block only touches length%16 bytes. key is the encryption key schedule.
+static void AES_CTR_xcrypt_8x(const unsigned char *in,
+                     unsigned char *out,
+                     const unsigned char nonce[16],
+                     unsigned long first_block,
+                     unsigned long length,
+                     const unsigned char *key,
+                     int number_of_rounds) {
+    __m128i data[8], ctr_block;
+    unsigned long i, blocks = length/16;
+    int j, k;
+    ctr_block = _mm_add_epi64 (_mm_loadu_si128 ((__m128i*)nonce),_mm_set_epi64x (0,first_block));
+    for(i = 0; i + 8 <= blocks; i += 8) {
+        for(k = 0; k < 8; k++) {
+            data[k] = _mm_xor_si128 (_mm_add_epi64 (ctr_block,_mm_set_epi64x (0,k)),((__m128i*)key)[0]);
+        }
+        for(j = 1; j < number_of_rounds; j++) {
+            __m128i round_key = ((__m128i*)key)[j];
+            for(k = 0; k < 8; k++) {
+                data[k] = _mm_aesenc_si128 (data[k],round_key);
+            }
+        }
+        for(k = 0; k < 8; k++) {
+            data[k] = _mm_aesenclast_si128 (data[k],((__m128i*)key)[j]);
+            _mm_storeu_si128 (&((__m128i*)out)[i+k],_mm_xor_si128 (data[k],_mm_loadu_si128 (&((__m128i*)in)[i+k])));
+        }
+        ctr_block = _mm_add_epi64 (ctr_block,_mm_set_epi64x (0,8));
+    }
+    for(; i*16 < length; i++) {
+        data[0] = _mm_xor_si128 (ctr_block,((__m128i*)key)[0]);
+        for(j = 1; j < number_of_rounds; j++) {
+            data[0] = _mm_aesenc_si128 (data[0],((__m128i*)key)[j]);
+        }
+        data[0] = _mm_aesenclast_si128 (data[0],((__m128i*)key)[j]);
+        ctr_block = _mm_add_epi64 (ctr_block,_mm_set_epi64x (0,1));
+        if (i < blocks) {
+            _mm_storeu_si128 (&((__m128i*)out)[i],_mm_xor_si128 (data[0],_mm_loadu_si128 (&((__m128i*)in)[i])));
+        }
+        else {
+            unsigned char key_stream[16];
+            _mm_storeu_si128 ((__m128i*)key_stream,data[0]);
+            for(k = 0; k < (int)(length%16); k++) {
+                out[16*i+k] = in[16*i+k] ^ key_stream[k];
+            }
+        }
+    }
+}
+
+// VAES on 512 bit registers, 16 blocks at a time
+__attribute__((target("vaes,avx512f")))
+static void AES_CTR_xcrypt_vaes512(const unsigned char *in,
+                     unsigned char *out,
+                     const unsigned char nonce[16],
+                     unsigned long first_block,
+                     unsigned long length,
+                     const unsigned char *key,
+                     int number_of_rounds) {
+    __m512i data[4], round_keys[15], ctr_block;
+    unsigned long i, blocks = length/16;
+    int j, k;
+    for(j = 0; j <= number_of_rounds; j++) {
+        round_keys[j] = AES_Broadcast_512 (((__m128i*)key)[j]);
+    }
+    ctr_block = _mm512_add_epi64 (AES_Broadcast_512 (_mm_loadu_si128 ((__m128i*)nonce)),_mm512_set_epi64 (0,first_block+3,0,first_block+2,0,first_block+1,0,first_block));
+    for(i = 0; i + 16 <= blocks; i += 16) {
+        for(k = 0; k < 4; k++) {
+            data[k] = _mm512_xor_si512 (_mm512_add_epi64 (ctr_block,_mm512_set_epi64 (0,4*k,0,4*k,0,4*k,0,4*k)),round_keys[0]);
+        }
+        for(j = 1; j < number_of_rounds; j++) {
+            for(k = 0; k < 4; k++) {
+                data[k] = _mm512_aesenc_epi128 (data[k],round_keys[j]);
+            }
+        }
+        for(k = 0; k < 4; k++) {
+            data[k] = _mm512_aesenclast_epi128 (data[k],round_keys[j]);
+            _mm512_storeu_si512 ((__m512i*)&((__m128i*)out)[i+4*k],_mm512_xor_si512 (data[k],_mm512_loadu_si512 ((__m512i*)&((__m128i*)in)[i+4*k])));
+        }
+        ctr_block = _mm512_add_epi64 (ctr_block,_mm512_set_epi64 (0,16,0,16,0,16,0,16));
+    }
+    if (i*16 < length) {
+        AES_CTR_xcrypt_8x(in + 16*i,out + 16*i,nonce,first_block + i,length - 16*i,key,number_of_rounds);
+    }
+}
+
+typedef void (*AES_CTR_xcrypt_function)(const unsigned char*, unsigned char*, const unsigned char*, unsigned long, unsigned long, const unsigned char*, int);
+
+static AES_CTR_xcrypt_function AES_Select_CTR_xcrypt() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("vaes") && __builtin_cpu_supports("avx512f")) {
+        return AES_CTR_xcrypt_vaes512;
+    }
+    return AES_CTR_xcrypt_8x;
+}
@@ -81,6 +81,10 @@ int main(int argc, char* argv[]) {
 		columnML->m_cstore->GenerateSyntheticData(numSamples, numFeatures, false, MinusOneToOne);
 		type = linreg;
 	}
+	else if (ColumnStore::IsColumnStoreFile(pathToDataset)) {
+		columnML->m_cstore->Open(pathToDataset);
+		type = logreg;
+	}
 	else {
 		columnML->m_cstore->LoadRawData(pathToDataset, numSamples, numFeatures, true);
 		columnML->m_cstore->NormalizeSamples(ZeroToOne, column);
@@ -273,9 +277,12 @@ void PredictionSCD(
 {
 	ModelType type = logreg;
 
+	// Without predictions to write, the last fifth of the minibatches is the test set
+	DatasetView* trainView = nullptr;
+	DatasetView* testView = nullptr;
 	if (!WritePredictions) {
-		args.m_firstSample = 0;
-		args.m_numSamples = obj->m_cstore->m_numSamples * 0.8;
+		DatasetView::CreateFold(obj->m_cstore->m_numSamples/minibatchSize, minibatchSize, 5, 4, trainView, testView);
+		args.m_view = trainView;
 	}
 
 	float* xHistory_SCD = new float[numEpochs*obj->m_cstore->m_numFeatures];
@@ -316,8 +323,7 @@ void PredictionSCD(
 		obj->WriteLogregPredictions((char*)"pSCD10_predictions.txt", xHistory_pSCD_P10 + (numEpochs-1)*obj->m_cstore->m_numFeatures);
 	}
 	else {
-		args.m_firstSample = obj->m_cstore->m_numSamples * 0.8;
-		args.m_numSamples = obj->m_cstore->m_numSamples - args.m_firstSample;
+		args.m_view = testView;
 
 		uint32_t SCD_corrects = obj->Accuracy(type, xHistory_SCD + (numEpochs-1)*obj->m_cstore->m_numFeatures, &args);
 		uint32_t pSCDinf_corrects = obj->Accuracy(type, xHistory_pSCD_Pinf + (numEpochs-1)*obj->m_cstore->m_numFeatures, &args);
@@ -325,13 +331,15 @@ void PredictionSCD(
 		uint32_t pSCD10_corrects = obj->Accuracy(type, xHistory_pSCD_P10 + (numEpochs-1)*obj->m_cstore->m_numFeatures, &args);
 
 		cout << "SCD accuracy: " << endl;
-		cout << SCD_corrects << " corrects out of " << args.m_numSamples << ". " << (float)SCD_corrects/(float)args.m_numSamples << "%" << endl;
+		cout << SCD_corrects << " corrects out of " << testView->m_numSamples << ". " << (float)SCD_corrects/(float)testView->m_numSamples << "%" << endl;
 		cout << "pSCDinf accuracy: " << endl;
-		cout << pSCDinf_corrects << " corrects out of " << args.m_numSamples << ". " << (float)pSCDinf_corrects/(float)args.m_numSamples << "%" << endl;
+		cout << pSCDinf_corrects << " corrects out of " << testView->m_numSamples << ". " << (float)pSCDinf_corrects/(float)testView->m_numSamples << "%" << endl;
 		cout << "pSCD100 accuracy: " << endl;
-		cout << pSCD100_corrects << " corrects out of " << args.m_numSamples << ". " << (float)pSCD100_corrects/(float)args.m_numSamples << "%" << endl;
+		cout << pSCD100_corrects << " corrects out of " << testView->m_numSamples << ". " << (float)pSCD100_corrects/(float)testView->m_numSamples << "%" << endl;
 		cout << "pSCD10 accuracy: " << endl;
-		cout << pSCD10_corrects << " corrects out of " << args.m_numSamples << ". " << (float)pSCD10_corrects/(float)args.m_numSamples << "%" << endl;
+		cout << pSCD10_corrects << " corrects out of " << testView->m_numSamples << ". " << (float)pSCD10_corrects/(float)testView->m_numSamples << "%" << endl;
 	}
+	delete trainView;
+	delete testView;
 }
 #endif
\ No newline at end of file
@@ -63,6 +63,10 @@ int main(int argc, char* argv[]) {
 		columnML->m_cstore->GenerateSyntheticData(numSamples, numFeatures, false, MinusOneToOne);
 		type = logreg;
 	}
+	else if (ColumnStore::IsColumnStoreFile(pathToDataset)) {
+		columnML->m_cstore->Open(pathToDataset);
+		type = logreg;
+	}
 	else {
 		columnML->m_cstore->LoadRawData(pathToDataset, numSamples, numFeatures, true);
 		columnML->m_cstore->NormalizeSamples(ZeroToOne, column);
@@ -63,6 +63,9 @@ int main(int argc, char* argv[]) {
 	if ( strcmp(pathToDataset, "syn") == 0) {
 		columnML->m_cstore->GenerateSyntheticData(numSamples, numFeatures, doLogreg, ZeroToOne);
 	}
+	else if (ColumnStore::IsColumnStoreFile(pathToDataset)) {
+		columnML->m_cstore->Open(pathToDataset);
+	}
 	else {
 		columnML->m_cstore->LoadRawData(pathToDataset, numSamples, numFeatures, true);
 		columnML->m_cstore->NormalizeSamples(ZeroToOne, column);